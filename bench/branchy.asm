@@ -0,0 +1,5 @@
+1 0x3ffff for 0x3ffff for
+2* -if 0x2d or then 0x3ffff and
+dup 1 and if . then drop
+next next
+boot ;
@@ -0,0 +1,6 @@
+ahead
+: leaf dup drop ;
+: inner leaf leaf ;
+: outer inner . inner ;
+then 0x3ffff for 0x3ffff for outer next next
+boot ;
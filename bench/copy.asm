@@ -0,0 +1,5 @@
+0x3ffff for 0x3ffff for
+0x30 a! 7 for @+ unext
+0x38 a! 7 for !+ unext
+.. next next
+boot ;
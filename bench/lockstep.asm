@@ -0,0 +1,8 @@
+dup 7 and for . next
+dup 8 and if 0x1d5 push ; then drop
+dup 16 and if 0x145 push ex then drop
+dup 32 and if 0x115 a! @ then drop
+dup 64 and if 0x175 push ; then drop
+dup 128 and if . then drop
+: end end ;
+boot ;
@@ -0,0 +1,53 @@
+#!/bin/sh
+#
+# runs lockstep.asm once per random input, in lockstep, then each input on
+# its own, and checks that every instance ends exactly as it did alone:
+# status, steps and the whole node, time included. depending on the input,
+# the program branches different ways and then runs on into a comm port,
+# by ; or ex, or reads one, so groups split and lanes leave them mid-group.
+# a batch of one goes straight to the scalar engine (see PEEL in batch.c).
+#
+# usage: bench/lockstep.sh [instances [seed [engine]]]
+
+set -e
+
+dir=$(cd "$(dirname "$0")" && pwd)
+f18a="$dir/../f18a"
+ffas="$dir/../ffas"
+n=${1:-400}
+seed=${2:-1}
+engine=${3:-switch}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+"$ffas" "$dir/lockstep.asm" "$tmp/lockstep.img"
+awk -v n=$n -v seed=$seed 'BEGIN {
+  srand(seed)
+  for (i = 0; i < n; i++) print int(rand() * 256)
+}' > "$tmp/inputs"
+
+# the instances of a batch's results, one per line
+instances() {
+  sed -e 's/^.*"instances": \[{/{/' -e 's/}\]}$/}/' \
+    -e 's/}, {"status"/}\n{"status"/g' "$1"
+}
+
+for steps in 20 50 100 1000; do
+  "$f18a" -H -e $engine -n $steps -B "$tmp/inputs" -l /dev/null \
+    -o "$tmp/batch.json" "$tmp/lockstep.img" || true
+  instances "$tmp/batch.json" > "$tmp/batch"
+  : > "$tmp/alone"
+  while read -r input; do
+    echo "$input" > "$tmp/one"
+    "$f18a" -H -e $engine -n $steps -B "$tmp/one" -l /dev/null \
+      -o "$tmp/one.json" "$tmp/lockstep.img" || true
+    instances "$tmp/one.json" >> "$tmp/alone"
+  done < "$tmp/inputs"
+  if [ $(wc -l < "$tmp/batch") != $n ] \
+      || ! cmp -s "$tmp/alone" "$tmp/batch"; then
+    diff "$tmp/alone" "$tmp/batch" | head -4 >&2
+    echo "batch of $n differs from running alone, at $steps steps" >&2
+    exit 1
+  fi
+  echo "$n instances match at $steps steps"
+done
@@ -0,0 +1,2 @@
+0x3ffff for 0x3ffff for 0x1234 a! 0x567 0 17 for +* unext drop drop next next
+boot ;
@@ -0,0 +1,2 @@
+0x3ffff for 0x3ffff for 0x3ff for dup 2* + 2/ next next next
+boot ;
@@ -0,0 +1,3 @@
+0x1d5 a!
+0x3ffff for 0x3ffff for @ 15 for 2/ unext drop next next
+boot ;
@@ -0,0 +1,55 @@
+#!/bin/sh
+#
+# runs a full fabric of ping (even columns) and pong (odd columns) nodes on
+# 1, 2, 4, 8 and 16 threads, and reports throughput for each. the final state
+# must be identical at every thread count; a mismatch is reported and fails.
+#
+# usage: bench/scaling.sh [steps [epoch]]
+
+set -e
+
+dir=$(cd "$(dirname "$0")" && pwd)
+f18a="$dir/../f18a"
+ffas="$dir/../ffas"
+steps=${1:-100000000}
+epoch=${2:-256}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+"$ffas" "$dir/ping.asm" "$tmp/ping.img"
+"$ffas" "$dir/pong.asm" "$tmp/pong.img"
+
+nodes=""
+for row in 0 1 2 3 4 5 6 7; do
+  for col in 0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17; do
+    if [ $((col % 2)) = 0 ]; then img=ping; else img=pong; fi
+    nodes="$nodes -N $(printf '%d%02d' $row $col)=$tmp/$img.img"
+  done
+done
+
+now() { date +%s%N; }
+
+printf '%8s %10s %12s %8s\n' threads seconds steps/s speedup
+base=""
+for threads in 1 2 4 8 16; do
+  start=$(now)
+  status=0
+  "$f18a" -H $nodes -j $threads -E $epoch -n $steps -l /dev/null \
+    -o "$tmp/$threads.json" || status=$?
+  end=$(now)
+  if [ $status != 2 ]; then
+    echo "unexpected exit status $status with $threads threads" >&2
+    exit 1
+  fi
+  if ! cmp -s "$tmp/1.json" "$tmp/$threads.json"; then
+    echo "final state with $threads threads differs from 1 thread" >&2
+    exit 1
+  fi
+  ran=$(sed -n 's/^{"status": "[a-z]*", "steps": \([0-9]*\).*/\1/p' \
+    "$tmp/$threads.json")
+  ns=$((end - start))
+  [ -n "$base" ] || base=$ns
+  awk -v t=$threads -v ns=$ns -v n=$ran -v base=$base 'BEGIN {
+    printf "%8d %10.3f %12.0f %7.2fx\n", t, ns / 1e9, n / (ns / 1e9), base / ns
+  }'
+done
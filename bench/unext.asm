@@ -0,0 +1,2 @@
+0x3ffff for 0x3ffff for 1 15 for 2* unext drop 15 for . unext .. next next
+boot ;
@@ -0,0 +1,799 @@
+/*
+ * Copyright (c) 2013, Matt Hellige
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above copyright 
+ *   notice, this list of conditions and the following disclaimer in the 
+ *   documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT 
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// many independent nodes run in lockstep, for running one program over lots
+// of inputs.
+//
+// node state is kept as structure of arrays, one lane per node, and a group of
+// lanes that agree on p, slot, i and both stack pointers runs each op with
+// vector code across the whole group. whatever the lanes disagree on after
+// an op (a branch, a fetch from ram they've written differently) splits the
+// group. the next group is led by the lane furthest behind, so lanes that
+// took different sides of a branch tend to meet again where it rejoins. lanes
+// in groups too small to be worth it, and lanes that touch ports, io or rom
+// writes, are peeled off and finished one at a time by a scalar engine.
+// either way, every node ends up exactly as a scalar run would have left it.
+//
+// vectors are gcc vector extensions: eight lanes when built with -mavx2, four
+// otherwise, which is sse2 on any x86-64 and plain scalar code where there's
+// nothing better.
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "f18a.h"
+#include "opcodes.h"
+
+#ifdef __AVX2__
+#define LANES 8
+#else
+#define LANES 4
+#endif
+
+typedef u32 vec_t __attribute__ ((vector_size (LANES * 4)));
+typedef int32_t svec_t __attribute__ ((vector_size (LANES * 4)));
+
+#define PEEL 4 // groups smaller than this go to the scalar engine
+#define POLL 0x1000 // ops a group runs between checks for break and timeout
+#define REFILL 0x80000000u // steps a lane counts down at a time
+
+#define SEL(m, x, y) (((x) & (m)) | ((y) & ~(m)))
+#define LANE(v, k) (((u32 *)(v))[k])
+// run the statements for each vector c of the group, with its lanes in m
+#define EACH(...) do { \
+    for (int c = b->lo; c < b->hi; c++) { \
+      vec_t m = b->mask[c]; \
+      if (any(m)) { __VA_ARGS__; } \
+    } \
+  } while (0)
+
+typedef struct {
+  int n; // lanes, not counting padding
+  int vecs;
+  vec_t *p, *io, *r, *t, *s, *i, *a, *b, *sp, *rsp, *slot, *cw, *carry;
+  vec_t *stack[STACK_WORDS];
+  vec_t *rstack[RSTACK_WORDS];
+  vec_t *mem[CACHE_WORDS]; // ram, then rom, by cache index
+  vec_t *left; // steps until the lane draws on more
+  vec_t *live; // all ones while the lane runs in lockstep
+  vec_t *mask; // lanes in the current group
+  int lo, hi; // the vectors of mask that have any lanes set
+  decoded_t words[CACHE_WORDS + 1]; // by cache index, as in f18a.dcache
+  u64 *more;
+  tstamp_t *time; // simulated time, per lane
+  void *block;
+
+  f18a *nodes;
+  stop_t *stops;
+  u64 *steps;
+  engine_t engine;
+  u64 max; // per lane
+  double max_secs;
+  tstamp_t deadline;
+  struct timespec start;
+} batch_t;
+
+// what every lane of the current group agrees on
+typedef struct {
+  int lead; // a lane in the group
+  u32 p, slot, i, cw, sp, rsp;
+  bool stale; // the lanes' own copies of the above are out of date
+  u32 room; // steps the group can run before a lane's left runs out
+  u32 ran; // steps run since left was last brought up to date
+  tstamp_t ps; // and the simulated time they took
+  const decoded_t *d;
+} group_t;
+
+static const u32 dmasks[] = {0x3ff, 0xff, 0x7};
+
+
+static inline vec_t splat(u32 x) {
+  return (vec_t){0} + x;
+}
+
+
+static inline bool any(vec_t m) {
+  u64 x[LANES / 2];
+  memcpy(x, &m, sizeof(x));
+  for (int k = 1; k < LANES / 2; k++) x[0] |= x[k];
+  return x[0];
+}
+
+
+static double elapsed(struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+
+static bool alloc(batch_t *b, int n) {
+  b->n = n;
+  b->vecs = (n + LANES - 1) / LANES;
+  int arrays = 13 + STACK_WORDS + RSTACK_WORDS + CACHE_WORDS + 3;
+  size_t size = (size_t)arrays * b->vecs * sizeof(vec_t);
+  b->more = calloc(b->vecs * LANES, sizeof(u64));
+  b->time = calloc(b->vecs * LANES, sizeof(tstamp_t));
+  if (!b->more || !b->time
+      || posix_memalign(&b->block, sizeof(vec_t), size)) {
+    free(b->more);
+    free(b->time);
+    return false;
+  }
+  memset(b->block, 0, size);
+
+  vec_t *next = b->block;
+#define CARVE(x) ((x) = next, next += b->vecs)
+  CARVE(b->p); CARVE(b->io); CARVE(b->r); CARVE(b->t); CARVE(b->s);
+  CARVE(b->i); CARVE(b->a); CARVE(b->b); CARVE(b->sp); CARVE(b->rsp);
+  CARVE(b->slot); CARVE(b->cw); CARVE(b->carry);
+  for (int k = 0; k < STACK_WORDS; k++) CARVE(b->stack[k]);
+  for (int k = 0; k < RSTACK_WORDS; k++) CARVE(b->rstack[k]);
+  for (int k = 0; k < CACHE_WORDS; k++) CARVE(b->mem[k]);
+  CARVE(b->left); CARVE(b->live); CARVE(b->mask);
+#undef CARVE
+  return true;
+}
+
+
+static void pack(batch_t *b, int k, const f18a *f) {
+  LANE(b->p, k) = f->p;
+  LANE(b->io, k) = f->io;
+  LANE(b->r, k) = f->r;
+  LANE(b->t, k) = f->t;
+  LANE(b->s, k) = f->s;
+  LANE(b->i, k) = f->i;
+  LANE(b->a, k) = f->a;
+  LANE(b->b, k) = f->b;
+  LANE(b->sp, k) = f->sp;
+  LANE(b->rsp, k) = f->rsp;
+  LANE(b->slot, k) = f->slot;
+  LANE(b->cw, k) = f->cw;
+  LANE(b->carry, k) = f->carry;
+  for (int w = 0; w < STACK_WORDS; w++) LANE(b->stack[w], k) = f->stack[w];
+  for (int w = 0; w < RSTACK_WORDS; w++) LANE(b->rstack[w], k) = f->rstack[w];
+  for (int w = 0; w < RAM_WORDS; w++) LANE(b->mem[w], k) = f->ram[w];
+  for (int w = 0; w < ROM_WORDS; w++)
+    LANE(b->mem[RAM_WORDS + w], k) = f->rom[w];
+  b->time[k] = f->time;
+}
+
+
+// write lane k back to its node
+static void unpack(batch_t *b, int k, f18a *f) {
+  f->p = LANE(b->p, k);
+  f->io = LANE(b->io, k);
+  f->r = LANE(b->r, k);
+  f->t = LANE(b->t, k);
+  f->s = LANE(b->s, k);
+  f->i = LANE(b->i, k);
+  f->a = LANE(b->a, k);
+  f->b = LANE(b->b, k);
+  f->sp = LANE(b->sp, k);
+  f->rsp = LANE(b->rsp, k);
+  f->slot = LANE(b->slot, k);
+  f->cw = LANE(b->cw, k);
+  f->carry = LANE(b->carry, k);
+  for (int w = 0; w < STACK_WORDS; w++) f->stack[w] = LANE(b->stack[w], k);
+  for (int w = 0; w < RSTACK_WORDS; w++) f->rstack[w] = LANE(b->rstack[w], k);
+  for (int w = 0; w < RAM_WORDS; w++) f->ram[w] = LANE(b->mem[w], k);
+  for (int w = 0; w < ROM_WORDS; w++)
+    f->rom[w] = LANE(b->mem[RAM_WORDS + w], k);
+  f->time = b->time[k];
+  f18a_latch(f);
+}
+
+
+static u64 used(batch_t *b, int k) {
+  return b->max - b->more[k] - LANE(b->left, k);
+}
+
+
+static void retire(batch_t *b, int k, stop_t stop) {
+  b->stops[k] = stop;
+  b->steps[k] = used(b, k);
+  unpack(b, k, &b->nodes[k]);
+  LANE(b->live, k) = LANE(b->mask, k) = 0;
+}
+
+
+// finish lane k on the scalar engine
+static void peel(batch_t *b, int k) {
+  f18a *f = &b->nodes[k];
+  unpack(b, k, f);
+  double secs = 0;
+  if (b->max_secs > 0) {
+    secs = b->max_secs - elapsed(&b->start);
+    if (secs <= 0) secs = 1e-9;
+  }
+  u64 steps;
+  b->stops[k] = f18a_runheadless(f, b->engine, b->max - used(b, k), secs,
+      b->deadline, &steps);
+  b->steps[k] = used(b, k) + steps;
+  LANE(b->live, k) = LANE(b->mask, k) = 0;
+}
+
+
+// fetch lane k's next word, as next() in emulator.c does. returns true if
+// it's to come from a port, which only the scalar engine can wait on: the
+// lane is left as f18a_fill leaves a node, for the caller to peel.
+static bool fetch(batch_t *b, int k) {
+  u32 addr = LANE(b->p, k);
+  u8 cw = CACHE_INDEX(addr);
+  bool port = (b->nodes[k].map[addr & ADDR_MASK] & 0xf) == M_PORT;
+  if (port) LANE(b->i, k) = I_PORTFETCH;
+  else if (cw != CACHE_SCRATCH) LANE(b->i, k) = LANE(b->mem[cw], k);
+  else LANE(b->i, k) = (addr & ADDR_MASK) == IO_ADDR ? LANE(b->io, k) : 0;
+  if (!port) LANE(b->p, k) = f18a_inc(addr);
+  LANE(b->cw, k) = cw;
+  LANE(b->slot, k) = 0;
+  b->time[k] += T_FETCH;
+  return port;
+}
+
+
+// the live lane furthest behind, so that lanes that have gone ahead down one
+// side of a branch wait for the rest to catch up with them
+static int laggard(batch_t *b) {
+  vec_t most = {0};
+  for (int c = 0; c < b->vecs; c++) {
+    vec_t left = b->left[c] & b->live[c];
+    most = SEL((vec_t)(left > most), left, most);
+  }
+  u32 max = 0;
+  for (int l = 0; l < LANES; l++) if (most[l] > max) max = most[l];
+  if (!max) return -1;
+  for (int c = 0; c < b->vecs; c++) {
+    vec_t hit = b->live[c] & (vec_t)(b->left[c] == splat(max));
+    for (int l = 0; any(hit) && l < LANES; l++)
+      if (hit[l]) return c * LANES + l;
+  }
+  return -1;
+}
+
+
+static void decodeword(batch_t *b, group_t *g) {
+  decoded_t *d = &b->words[g->cw];
+  if (!d->valid || d->word != g->i) {
+    f18a_decode(d, g->cw, g->i);
+    d->valid = g->cw != CACHE_SCRATCH;
+  }
+  g->d = d;
+}
+
+
+// the lanes of m that can run for a while before the deadline, cutting *room
+// to the steps they all can. those that have reached it are retired, and
+// those too close to it to run even one step blind are peeled, since a scalar
+// run steps up to it one at a time.
+static vec_t timely(batch_t *b, int c, vec_t m, u32 *room) {
+  for (int l = 0; l < LANES; l++) {
+    if (!m[l]) continue;
+    int k = c * LANES + l;
+    tstamp_t now = b->time[k];
+    if (now >= b->deadline) {
+      retire(b, k, S_DEADLINE);
+      m[l] = 0;
+    } else if (b->deadline - now < T_STEP_MAX) {
+      peel(b, k);
+      m[l] = 0;
+    } else if ((b->deadline - now) / T_STEP_MAX < *room) {
+      *room = (b->deadline - now) / T_STEP_MAX;
+    }
+  }
+  return m;
+}
+
+
+// make the group all the live lanes that agree with lane k. returns its size.
+static int gather(batch_t *b, group_t *g, int k) {
+  g->lead = k;
+  g->p = LANE(b->p, k);
+  g->slot = LANE(b->slot, k);
+  g->i = LANE(b->i, k);
+  g->cw = LANE(b->cw, k);
+  g->sp = LANE(b->sp, k);
+  g->rsp = LANE(b->rsp, k);
+  g->stale = false;
+  decodeword(b, g);
+
+  vec_t p = splat(g->p), slot = splat(g->slot), i = splat(g->i);
+  vec_t cw = splat(g->cw), sp = splat(g->sp), rsp = splat(g->rsp);
+  vec_t left = splat(~0u);
+  u32 room = ~0u;
+  int count = 0;
+  b->lo = b->vecs;
+  b->hi = 0;
+  for (int c = 0; c < b->vecs; c++) {
+    vec_t m = b->live[c];
+    if (any(m))
+      m &= (vec_t)(b->p[c] == p) & (vec_t)(b->slot[c] == slot)
+        & (vec_t)(b->i[c] == i) & (vec_t)(b->cw[c] == cw)
+        & (vec_t)(b->sp[c] == sp) & (vec_t)(b->rsp[c] == rsp);
+    b->mask[c] = m;
+    if (b->deadline && any(m)) b->mask[c] = m = timely(b, c, m, &room);
+    if (!any(m)) continue;
+    if (c < b->lo) b->lo = c;
+    b->hi = c + 1;
+    for (int l = 0; l < LANES; l++) count += m[l] & 1;
+    left = SEL((vec_t)(b->left[c] < left) & m, b->left[c], left);
+  }
+  g->room = room;
+  for (int l = 0; l < LANES; l++) if (left[l] < g->room) g->room = left[l];
+  g->ran = 0;
+  g->ps = 0;
+  return count;
+}
+
+
+// bring the lanes' copies of what the group agrees on up to date, before
+// anything that treats lanes separately
+static void sync(batch_t *b, group_t *g) {
+  if (!g->stale) return;
+  g->stale = false;
+  vec_t p = splat(g->p), slot = splat(g->slot), i = splat(g->i);
+  vec_t cw = splat(g->cw), sp = splat(g->sp), rsp = splat(g->rsp);
+  EACH(
+    b->p[c] = SEL(m, p, b->p[c]);
+    b->slot[c] = SEL(m, slot, b->slot[c]);
+    b->i[c] = SEL(m, i, b->i[c]);
+    b->cw[c] = SEL(m, cw, b->cw[c]);
+    b->sp[c] = SEL(m, sp, b->sp[c]);
+    b->rsp[c] = SEL(m, rsp, b->rsp[c]));
+}
+
+
+// charge the group's lanes for the steps they've run together, drawing on
+// more for any that have used up left, or retiring them if there's no more.
+static void settle(batch_t *b, group_t *g) {
+  vec_t ran = splat(g->ran);
+  g->room -= g->ran;
+  g->ran = 0;
+  tstamp_t ps = g->ps;
+  g->ps = 0;
+  EACH(
+    b->left[c] -= ran & m;
+    for (int l = 0; ps && l < LANES; l++)
+      if (m[l]) b->time[c * LANES + l] += ps;
+    vec_t out = m & (vec_t)(b->left[c] == 0);
+    for (int l = 0; any(out) && l < LANES; l++) {
+      if (!out[l]) continue;
+      int k = c * LANES + l;
+      if (b->more[k]) {
+        u32 refill = b->more[k] < REFILL ? b->more[k] : REFILL;
+        LANE(b->left, k) = refill;
+        b->more[k] -= refill;
+      } else {
+        retire(b, k, S_BUDGET);
+      }
+    });
+}
+
+
+// peel lanes whose memory op would touch anything but ram, or rom for loads.
+// returns true if any were.
+static bool screen(batch_t *b, group_t *g, u8 op) {
+  u32 bad = op >= OP_SVPI ? 0x180 : 0x100;
+  bool peeled = false;
+  EACH(
+    vec_t addr;
+    switch (op) {
+      case OP_LVPI: case OP_SVPI: addr = splat(g->p); break;
+      case OP_LVB: case OP_SVB: addr = b->b[c]; break;
+      default: addr = b->a[c]; break;
+    }
+    vec_t out = m & (vec_t)((addr & bad) != 0);
+    if (any(out)) {
+      if (!peeled) {
+        sync(b, g);
+        settle(b, g);
+      }
+      for (int l = 0; l < LANES; l++)
+        if (out[l]) peel(b, c * LANES + l);
+      peeled = true;
+    });
+  return peeled;
+}
+
+
+static inline vec_t loadv(batch_t *b, int c, vec_t m, vec_t addr) {
+  vec_t val = {0};
+  for (int l = 0; l < LANES; l++)
+    if (m[l]) val[l] = LANE(b->mem[CACHE_INDEX(addr[l] & ADDR_MASK)],
+        c * LANES + l);
+  return val;
+}
+
+
+static inline void storev(batch_t *b, int c, vec_t m, vec_t addr, vec_t val) {
+  for (int l = 0; l < LANES; l++)
+    if (m[l]) LANE(b->mem[addr[l] & 0x3f], c * LANES + l) = val[l];
+}
+
+
+static inline vec_t incv(vec_t addr) {
+  // only for addresses outside the io range, see f18a_inc()
+  return (addr & ~0x7fu) | ((addr + 1) & 0x7f);
+}
+
+
+// lanes that have left their word fetch the next one, each on its own. those
+// fetching from a port are peeled, but only once the group's steps so far
+// have been charged to them.
+static bool fetchlanes(batch_t *b, group_t *g) {
+  bool port = false;
+  EACH(
+    vec_t due = m & (vec_t)(b->slot[c] == 4);
+    for (int l = 0; any(due) && l < LANES; l++)
+      if (due[l]) port |= fetch(b, c * LANES + l));
+  if (!port) return false;
+  settle(b, g);
+  EACH(
+    for (int l = 0; l < LANES; l++)
+      if (m[l] && LANE(b->i, c * LANES + l) == I_PORTFETCH)
+        peel(b, c * LANES + l));
+  return false;
+}
+
+
+// the group fetches the next word. returns true if every lane got the same.
+static bool refetch(batch_t *b, group_t *g) {
+  u8 cw = CACHE_INDEX(g->p);
+  if (cw == CACHE_SCRATCH) {
+    sync(b, g);
+    return fetchlanes(b, g);
+  }
+  u32 i = LANE(b->mem[cw], g->lead);
+  vec_t want = splat(i);
+  bool same = true;
+  EACH(same &= !any(m & (b->mem[cw][c] ^ want)));
+  g->p = f18a_inc(g->p);
+  g->slot = 0;
+  g->i = i;
+  g->cw = cw;
+  g->ps += T_FETCH;
+  if (!same) {
+    sync(b, g);
+    EACH(b->i[c] = SEL(m, b->mem[cw][c], b->i[c]));
+    return false;
+  }
+  decodeword(b, g);
+  return true;
+}
+
+
+// some lanes take a conditional transfer and some don't, so from here on
+// they go their own ways
+static bool diverge(batch_t *b, group_t *g, u8 op, u32 dest) {
+  sync(b, g);
+  u32 rsp = g->rsp, rdn = (rsp + RSTACK_WORDS - 1) % RSTACK_WORDS;
+  vec_t slot = splat(op == OP_UNXT ? g->slot + 1 : 4);
+  EACH(
+    vec_t cond = op == OP_IF ? (vec_t)(b->t[c] == 0)
+      : op == OP_IFG ? (vec_t)((b->t[c] & 0x20000) == 0)
+      : (vec_t)(b->r[c] != 0);
+    cond &= m;
+    b->slot[c] = SEL(m, slot, b->slot[c]);
+    if (op == OP_UNXT || op == OP_NEXT) {
+      vec_t out = m & ~cond;
+      b->r[c] -= cond & 1;
+      b->r[c] = SEL(out, b->rstack[rsp][c], b->r[c]);
+      b->rsp[c] = SEL(out, splat(rdn), b->rsp[c]);
+    }
+    if (op == OP_UNXT) b->slot[c] &= ~cond;
+    else b->p[c] = SEL(cond, splat(dest), b->p[c]));
+  return fetchlanes(b, g);
+}
+
+
+// run the group's next op on all its lanes, then fetch if they've finished
+// the word. returns true if they all still agree afterwards.
+static bool step(batch_t *b, group_t *g) {
+  u8 op = g->d->ops[g->slot];
+  if (op == OP_HALT) {
+    sync(b, g);
+    settle(b, g);
+    EACH(
+      for (int l = 0; l < LANES; l++)
+        if (m[l]) retire(b, c * LANES + l, S_HALT));
+    return false;
+  }
+  if (op >= OP_LVPI && op <= OP_SVA && screen(b, g, op)) return false;
+
+  u32 sp = g->sp;
+  u32 spup = (sp + 1) % STACK_WORDS, spdn = (sp + STACK_WORDS - 1) % STACK_WORDS;
+  u32 rsp = g->rsp;
+  u32 rup = (rsp + 1) % RSTACK_WORDS;
+  u32 rdn = (rsp + RSTACK_WORDS - 1) % RSTACK_WORDS;
+  u32 p = g->p;
+  u32 dest = g->slot < 3 ?
+    (p & ~(dmasks[g->slot] | 0x100)) | g->d->dest[g->slot] : 0;
+  int dsp = 0, drsp = 0;
+  bool yes = false, no = false; // lanes taking a conditional transfer, or not
+  g->ran++;
+  g->ps += optimes[op];
+
+  // sp and rsp are the same on every lane, and kept in the group...
+#define PUSH(v) do { \
+    vec_t v_ = (v); \
+    b->stack[spup][c] = SEL(m, b->s[c], b->stack[spup][c]); \
+    b->s[c] = SEL(m, b->t[c], b->s[c]); \
+    b->t[c] = SEL(m, v_, b->t[c]); \
+  } while (0)
+#define POPS() (b->s[c] = SEL(m, b->stack[sp][c], b->s[c]))
+#define POP() do { b->t[c] = SEL(m, b->s[c], b->t[c]); POPS(); } while (0)
+#define PUSHR(v) do { \
+    vec_t v_ = (v); \
+    b->rstack[rup][c] = SEL(m, b->r[c], b->rstack[rup][c]); \
+    b->r[c] = SEL(m, v_, b->r[c]); \
+  } while (0)
+#define POPR() (b->r[c] = SEL(m, b->rstack[rsp][c], b->r[c]))
+#define TOOK(cond) do { \
+    vec_t took_ = m & (vec_t)(cond); \
+    yes |= any(took_); \
+    no |= any(m & ~took_); \
+  } while (0)
+
+  vec_t tmp;
+  switch (op) {
+    case OP_RET:
+      sync(b, g);
+      EACH(
+        b->p[c] = SEL(m, b->r[c] & MAX_P, b->p[c]);
+        POPR();
+        b->rsp[c] = SEL(m, splat(rdn), b->rsp[c]);
+        b->slot[c] = SEL(m, splat(4), b->slot[c]));
+      return fetchlanes(b, g);
+    case OP_EXEC:
+      sync(b, g);
+      EACH(
+        tmp = b->r[c];
+        b->r[c] = SEL(m, splat(p), b->r[c]);
+        b->p[c] = SEL(m, tmp & MAX_P, b->p[c]);
+        b->slot[c] = SEL(m, splat(4), b->slot[c]));
+      return fetchlanes(b, g);
+    case OP_JUMP:
+      g->p = dest;
+      g->slot = 3;
+      break;
+    case OP_CALL:
+      EACH(PUSHR(splat(p)));
+      drsp = 1;
+      g->p = dest;
+      g->slot = 3;
+      break;
+    case OP_UNXT:
+    case OP_NEXT:
+      EACH(TOOK(b->r[c] != 0));
+      if (yes && no) return diverge(b, g, op, dest);
+      if (yes) {
+        EACH(b->r[c] -= m & 1);
+        if (op == OP_UNXT) {
+          g->slot = 0;
+          g->stale = true;
+          return true;
+        }
+        g->p = dest;
+      } else {
+        EACH(POPR());
+        drsp = -1;
+      }
+      if (op == OP_NEXT) g->slot = 3;
+      break;
+    case OP_IF:
+    case OP_IFG:
+      if (op == OP_IF) EACH(TOOK(b->t[c] == 0));
+      else EACH(TOOK((b->t[c] & 0x20000) == 0));
+      if (yes && no) return diverge(b, g, op, dest);
+      if (yes) g->p = dest;
+      g->slot = 3;
+      break;
+    case OP_LVPI:
+      EACH(PUSH(b->mem[CACHE_INDEX(p & ADDR_MASK)][c]));
+      dsp = 1;
+      g->p = f18a_inc(p);
+      break;
+    case OP_LVAI:
+      EACH(
+        PUSH(loadv(b, c, m, b->a[c]));
+        b->a[c] = SEL(m, incv(b->a[c]), b->a[c]));
+      dsp = 1;
+      break;
+    case OP_LVB: EACH(PUSH(loadv(b, c, m, b->b[c]))); dsp = 1; break;
+    case OP_LVA: EACH(PUSH(loadv(b, c, m, b->a[c]))); dsp = 1; break;
+    case OP_SVPI:
+      EACH(
+        b->mem[p & 0x3f][c] = SEL(m, b->t[c], b->mem[p & 0x3f][c]);
+        POP());
+      dsp = -1;
+      g->p = f18a_inc(p);
+      break;
+    case OP_SVAI:
+      EACH(
+        storev(b, c, m, b->a[c], b->t[c]);
+        POP();
+        b->a[c] = SEL(m, incv(b->a[c]), b->a[c]));
+      dsp = -1;
+      break;
+    case OP_SVB:
+      EACH(storev(b, c, m, b->b[c], b->t[c]); POP());
+      dsp = -1;
+      break;
+    case OP_SVA:
+      EACH(storev(b, c, m, b->a[c], b->t[c]); POP());
+      dsp = -1;
+      break;
+    case OP_MULS:
+      // as f18a_muls, with the add masked to the lanes whose a0 is set
+      EACH(
+        vec_t t = b->t[c] & MAX_VAL, a = b->a[c] & MAX_VAL;
+        vec_t add = -(a & 1);
+        vec_t sum = t + (b->s[c] & MAX_VAL & add);
+        if (p & P9) {
+          sum += b->carry[c] & add;
+          b->carry[c] = SEL(m & add, sum >> 18, b->carry[c]);
+        }
+        sum &= MAX_VAL;
+        b->a[c] = SEL(m, a >> 1 | (sum & 1) << 17, b->a[c]);
+        b->t[c] = SEL(m, sum >> 1 | (sum & 0x20000), b->t[c]));
+      break;
+    case OP_SHL: EACH(b->t[c] = SEL(m, b->t[c] << 1, b->t[c])); break;
+    case OP_SHR:
+      EACH(b->t[c] = SEL(m, (vec_t)((svec_t)b->t[c] >> 1), b->t[c]));
+      break;
+    case OP_INV: EACH(b->t[c] ^= m); break;
+    case OP_ADD:
+      if (p & P9) {
+        EACH(
+          tmp = (b->t[c] & MAX_VAL) + (b->s[c] & MAX_VAL) + b->carry[c];
+          b->carry[c] = SEL(m, tmp >> 18, b->carry[c]);
+          b->t[c] = SEL(m, tmp & MAX_VAL, b->t[c]);
+          POPS());
+      } else {
+        EACH(b->t[c] = SEL(m, b->t[c] + b->s[c], b->t[c]); POPS());
+      }
+      dsp = -1;
+      break;
+    case OP_AND: EACH(b->t[c] &= b->s[c] | ~m; POPS()); dsp = -1; break;
+    case OP_OR: EACH(b->t[c] ^= b->s[c] & m; POPS()); dsp = -1; break;
+    case OP_DROP: EACH(POP()); dsp = -1; break;
+    case OP_DUP: EACH(PUSH(b->t[c])); dsp = 1; break;
+    case OP_POP:
+      EACH(tmp = b->r[c]; POPR(); PUSH(tmp));
+      dsp = 1;
+      drsp = -1;
+      break;
+    case OP_OVER: EACH(PUSH(b->s[c])); dsp = 1; break;
+    case OP_A: EACH(PUSH(b->a[c])); dsp = 1; break;
+    case OP_NOP: break;
+    case OP_PUSH:
+      EACH(tmp = b->t[c]; POP(); PUSHR(tmp));
+      dsp = -1;
+      drsp = 1;
+      break;
+    case OP_SB:
+      EACH(b->b[c] = SEL(m, b->t[c] & MAX_B, b->b[c]); POP());
+      dsp = -1;
+      break;
+    case OP_SA:
+      EACH(b->a[c] = SEL(m, b->t[c], b->a[c]); POP());
+      dsp = -1;
+      break;
+  }
+#undef PUSH
+#undef POPS
+#undef POP
+#undef PUSHR
+#undef POPR
+#undef TOOK
+
+  g->sp = dsp > 0 ? spup : dsp < 0 ? spdn : sp;
+  g->rsp = drsp > 0 ? rup : drsp < 0 ? rdn : rsp;
+  g->stale = true;
+  return ++g->slot < 4 || refetch(b, g);
+}
+
+
+static stop_t runbatch(batch_t *b) {
+  for (int k = 0; k < b->n; k++) {
+    pack(b, k, &b->nodes[k]);
+    LANE(b->left, k) = b->max < REFILL ? b->max : REFILL;
+    b->more[k] = b->max - LANE(b->left, k);
+    LANE(b->live, k) = ~0u;
+    // as f18a_stepn does before the first step...
+    if (LANE(b->slot, k) > 3) fetch(b, k);
+  }
+  // ...and a node waiting on a port is left to the scalar engine
+  for (int k = 0; k < b->n; k++)
+    if (LANE(b->i, k) == I_PORTFETCH) peel(b, k);
+
+  group_t g;
+  stop_t stop = S_HALT;
+  for (;;) {
+    if (f18a_stopped(b->nodes[0].host)) stop = S_BREAK;
+    else if (b->max_secs > 0 && elapsed(&b->start) >= b->max_secs)
+      stop = S_TIMEOUT;
+    if (stop != S_HALT) break;
+
+    int k = laggard(b);
+    if (k < 0) break;
+    int count = gather(b, &g, k);
+    if (!count) continue;
+    if (count < PEEL) {
+      for (int c = b->lo; c < b->hi; c++)
+        for (int l = 0; any(b->mask[c]) && l < LANES; l++)
+          if (b->mask[c][l]) peel(b, c * LANES + l);
+      continue;
+    }
+    for (int n = 0; n < POLL && g.ran < g.room && step(b, &g); n++) {}
+    sync(b, &g);
+    settle(b, &g);
+  }
+
+  for (int k = 0; k < b->n; k++)
+    if (LANE(b->live, k)) retire(b, k, stop);
+  for (int k = 0; k < b->n; k++)
+    if (b->stops[k] > stop) stop = b->stops[k];
+  return stop;
+}
+
+
+// run n nodes for up to max_steps steps each (zero for no limit), leaving
+// each node, its stop reason and its step count as f18a_runheadless would.
+// returns the most severe of the stop reasons.
+stop_t f18a_batch(f18a *nodes, int n, engine_t engine, u64 max_steps,
+    double max_secs, tstamp_t deadline, stop_t *stops, u64 *steps) {
+  batch_t b;
+  b.nodes = nodes;
+  b.stops = stops;
+  b.steps = steps;
+  b.engine = engine;
+  b.max = max_steps ? max_steps : UINT64_MAX;
+  b.max_secs = max_secs;
+  b.deadline = deadline;
+  for (int w = 0; w <= CACHE_WORDS; w++) b.words[w].valid = false;
+  clock_gettime(CLOCK_MONOTONIC, &b.start);
+
+  if (!alloc(&b, n)) {
+    f18a_hostmsg(nodes[0].host,
+        "unable to allocate a batch of %d, running one at a time\n", n);
+    stop_t stop = S_HALT;
+    for (int k = 0; k < n; k++) {
+      stops[k] = f18a_runheadless(&nodes[k], engine, max_steps, max_secs,
+          deadline, &steps[k]);
+      if (stops[k] > stop) stop = stops[k];
+    }
+    return stop;
+  }
+
+  stop_t stop = runbatch(&b);
+  free(b.block);
+  free(b.more);
+  free(b.time);
+  return stop;
+}
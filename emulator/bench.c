@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) 2013, Matt Hellige
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above copyright 
+ *   notice, this list of conditions and the following disclaimer in the 
+ *   documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT 
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// f18a-bench: measures the emulator core, for `make bench`. each image is
+// run on every engine, reps times from a fresh load, and each opcode is run
+// alone on f18a_step, from a node whose every word holds just that op.
+// results are steps per second, as a mean and standard deviation over the
+// reps, written as json so that releases can be compared.
+
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "f18a.h"
+#include "opcodes.h"
+
+#define MAX_REPS 100
+
+typedef struct {
+  const char *name;
+  engine_t engine;
+} bengine_t;
+
+static const bengine_t engines[] = {
+  {"switch", f18a_stepn},
+  {"threaded", f18a_threaded},
+  {"jit", f18a_jit},
+};
+
+#define ENGINES (int)(sizeof(engines) / sizeof(engines[0]))
+
+typedef struct {
+  int reps;
+  u64 steps; // per run of an image
+  u64 opsteps; // per run of an opcode
+} config_t;
+
+typedef struct {
+  double rates[MAX_REPS]; // steps per second
+  int n;
+  u64 steps; // in the last run
+} result_t;
+
+static void error(f18a_host *host, const char *fmt, va_list args) {
+  (void)host;
+  vfprintf(stderr, fmt, args);
+}
+
+// messages are dropped, but errors are worth seeing
+static f18a_host host = {.error = error};
+
+static void usage(char **argv) {
+  fprintf(stderr, "usage: %s [options] <image>...\n", argv[0]);
+  fprintf(stderr, "   -h, --help           display this message\n");
+  fprintf(stderr, "   -r, --reps <n>       runs of each image and opcode "
+      "(default 5)\n");
+  fprintf(stderr, "   -n, --steps <n>      steps per run of an image "
+      "(default 50000000)\n");
+  fprintf(stderr, "   -m, --op-steps <n>   steps per run of an opcode "
+      "(default 10000000)\n");
+  fprintf(stderr, "   -o, --output <file>  write results to file, not "
+      "stdout\n");
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double mean(const result_t *res) {
+  double sum = 0;
+  for (int i = 0; i < res->n; i++) sum += res->rates[i];
+  return sum / res->n;
+}
+
+// sample standard deviation
+static double stddev(const result_t *res) {
+  if (res->n < 2) return 0;
+  double m = mean(res), sum = 0;
+  for (int i = 0; i < res->n; i++)
+    sum += (res->rates[i] - m) * (res->rates[i] - m);
+  return sqrt(sum / (res->n - 1));
+}
+
+static void record(result_t *res, u64 steps, double secs) {
+  res->steps = steps;
+  res->rates[res->n++] = secs > 0 ? steps / secs : 0;
+}
+
+static bool runimage(const char *image, engine_t engine, config_t *cfg,
+    result_t *res) {
+  static f18a f;
+  bool ok = true;
+  for (int rep = 0; ok && rep < cfg->reps; rep++) {
+    // a fresh node each time, and the last one's code buffer goes with it
+    f18a_init(&f, &host);
+    if ((ok = f18a_loadcore(&f, image))) {
+      u64 steps;
+      double start = now();
+      f18a_runheadless(&f, engine, cfg->steps, 0, 0, &steps);
+      record(res, steps, now() - start);
+    }
+    f18a_release(&f);
+  }
+  return ok;
+}
+
+// every word decodes to op and three nops, and a and b point away from ram,
+// so nothing is ever decoded again. the slot is put back to 0 before each
+// step; transfers fetch a word just like the last.
+static void runop(u8 op, config_t *cfg, result_t *res) {
+  static f18a f;
+  decoded_t d = {.ops = {op, OP_NOP, OP_NOP, OP_NOP}, .slots = 4,
+    .valid = true};
+  for (int rep = 0; rep < cfg->reps; rep++) {
+    f18a_init(&f, &host);
+    for (int cw = 0; cw < CACHE_WORDS; cw++) f.dcache[cw] = d;
+    f.p = 0;
+    f.a = f.b = IO_ADDR;
+    f.cw = 0;
+    double start = now();
+    for (u64 i = 0; i < cfg->opsteps; i++) {
+      f.slot = 0;
+      f18a_step(&f);
+    }
+    record(res, cfg->opsteps, now() - start);
+  }
+}
+
+static void jsonresult(FILE *out, const result_t *res) {
+  fprintf(out, "\"steps\": %llu, \"mean\": %.0f, \"stddev\": %.0f, "
+      "\"runs\": [", (unsigned long long)res->steps, mean(res), stddev(res));
+  for (int i = 0; i < res->n; i++)
+    fprintf(out, "%s%.0f", i ? ", " : "", res->rates[i]);
+  fprintf(out, "]");
+}
+
+static void report(const char *what, const char *engine, const result_t *res) {
+  double m = mean(res);
+  fprintf(stderr, "%-16s %-8s %10.2f M/s  +- %5.1f%%\n", what, engine, m / 1e6,
+      m > 0 ? 100 * stddev(res) / m : 0);
+}
+
+// the name of an image, for the results: its file name without the extension
+static const char *imagename(const char *path, char *buf, size_t n) {
+  const char *base = strrchr(path, '/');
+  base = base ? base + 1 : path;
+  snprintf(buf, n, "%s", base);
+  char *dot = strrchr(buf, '.');
+  if (dot && dot != buf) *dot = '\0';
+  return buf;
+}
+
+int main(int argc, char **argv) {
+  config_t cfg = {.reps = 5, .steps = 50000000, .opsteps = 10000000};
+  const char *outpath = NULL;
+  char *endptr;
+
+  for (;;) {
+    static struct option long_options[] = {
+      {"help", 0, 0, 'h'},
+      {"reps", 1, 0, 'r'},
+      {"steps", 1, 0, 'n'},
+      {"op-steps", 1, 0, 'm'},
+      {"output", 1, 0, 'o'},
+      {0, 0, 0, 0},
+    };
+
+    int c = getopt_long(argc, argv, "hr:n:m:o:", long_options, NULL);
+    if (c == -1) break;
+
+    switch (c) {
+      case 'h':
+        usage(argv);
+        return 0;
+      case 'r':
+        cfg.reps = strtol(optarg, &endptr, 10);
+        if (*endptr || cfg.reps <= 0 || cfg.reps > MAX_REPS) {
+          fprintf(stderr, "argument to --reps must be from 1 to %d\n",
+              MAX_REPS);
+          return 1;
+        }
+        break;
+      case 'n':
+        cfg.steps = strtoull(optarg, &endptr, 10);
+        if (*endptr || !cfg.steps) {
+          fprintf(stderr, "argument to --steps must be a positive number\n");
+          return 1;
+        }
+        break;
+      case 'm':
+        cfg.opsteps = strtoull(optarg, &endptr, 10);
+        if (*endptr || !cfg.opsteps) {
+          fprintf(stderr, "argument to --op-steps must be a positive "
+              "number\n");
+          return 1;
+        }
+        break;
+      case 'o':
+        outpath = optarg;
+        break;
+      default:
+        usage(argv);
+        return 1;
+    }
+  }
+
+  FILE *out = stdout;
+  if (outpath && !(out = fopen(outpath, "w"))) {
+    fprintf(stderr, "error opening '%s': %s\n", outpath, strerror(errno));
+    return 1;
+  }
+  fprintf(out, "{\"version\": \"%s\", \"reps\": %d, \"images\": [",
+      F18A_VERSION, cfg.reps);
+  bool first = true;
+  for (int i = optind; i < argc; i++) {
+    char name[64];
+    imagename(argv[i], name, sizeof(name));
+    for (int e = 0; e < ENGINES; e++) {
+      result_t res = {.n = 0};
+      if (!runimage(argv[i], engines[e].engine, &cfg, &res)) return 1;
+      report(name, engines[e].name, &res);
+      fprintf(out, "%s\n  {\"image\": \"%s\", \"engine\": \"%s\", ",
+          first ? "" : ",", name, engines[e].name);
+      jsonresult(out, &res);
+      fprintf(out, "}");
+      first = false;
+    }
+  }
+  fprintf(out, "],\n \"ops\": [");
+  for (int op = 0; op < OP_COUNT; op++) {
+    result_t res = {.n = 0};
+    runop(op, &cfg, &res);
+    report(opnames[op], "step", &res);
+    fprintf(out, "%s\n  {\"op\": \"%s\", ", op ? "," : "", opnames[op]);
+    jsonresult(out, &res);
+    fprintf(out, "}");
+  }
+  fprintf(out, "]}\n");
+  if (out != stdout) fclose(out);
+  return 0;
+}
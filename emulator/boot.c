@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) 2013, Matt Hellige
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above copyright 
+ *   notice, this list of conditions and the following disclaimer in the 
+ *   documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT 
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// boot streams: a fabric boots the way the chip does, with every node in
+// multiport execute, running whatever its neighbours write to it, and one
+// boot node fed boot frames from outside (see fabric_boot). a boot stream is
+// any number of frames, each
+//
+//   completion address, load address, count, count words...
+//
+// as on the ga144: the boot node stores the words from the load address on
+// and then jumps to the completion address. frames loaded at a port address
+// pass their words on to a neighbour, and a frame that completes at
+// MULTIPORT_ADDR leaves the boot node waiting for the next. a stream is
+// written big-endian, a u32 per word, as ffas writes images.
+//
+// the boot node's rom isn't emulated: the host turns each frame into the
+// instruction words that rom would run for it, and feeds them to the node's
+// port fetch, through a port of its own that faces off the chip.
+//
+// the streams written here wind through every node up to the last one being
+// loaded, in a fixed path from the boot node, which has to be in the top row.
+// the path is our own: west along the top row, then back and forth across
+// the columns west of the boot node, bottom row last, then back and forth up
+// the columns east of it. a stream comes in two parts, each passed down the
+// path with every node forwarding what's beyond it before taking its own
+// share. the first loads every node's ram and a, and the second starts them,
+// each with just b and a jump to p. so nodes start close together
+// at the end, rather than running through the rest of the boot, which a
+// fabric can only feed a word every couple of epochs. between the parts each
+// node executes from the port it's fed through, and no other, so a neighbour
+// that starts first and writes to it waits, as it would for a node that had
+// been loaded, rather than having its word run. every push a node runs is
+// undone before it starts, so that nodes other than the boot node start as
+// loading them from an image would leave them, but for time.
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "f18a.h"
+#include "opcodes.h"
+
+#define FRAME_WORDS 3 // completion, load address and count
+#define LOAD_WORDS 5 // as many again to set up a load, see load
+#define RAM_LOAD (LOAD_WORDS + RAM_WORDS + 2) // see ramload
+#define START_WORDS 3 // see start
+
+
+static u32 word(u8 s0, u8 s1, u8 s2, u8 s3) {
+  return ((s0 << 13) | (s1 << 8) | (s2 << 3) | (s3 >> 2)) ^ OP_XOR_MASK;
+}
+
+
+// a slot 0 jump, whose destination isn't scrambled
+static u32 jumpto(u32 dest) {
+  return ((OP_JUMP << 13 ^ OP_XOR_MASK) & ~MAX_P) | (dest & MAX_P);
+}
+
+
+// the words that store the n words following them from addr on, with store,
+// which is one of !+, ! or !b (a port address doesn't increment)
+static u32 *load(u32 *out, u32 addr, u32 n, u8 store) {
+  *out++ = word(OP_LVPI, store == OP_SVB ? OP_SB : OP_SA, OP_LVPI, OP_NOP);
+  *out++ = addr;
+  *out++ = n - 1;
+  *out++ = word(OP_PUSH, OP_NOP, OP_NOP, OP_NOP);
+  *out++ = word(OP_LVPI, store, OP_UNXT, OP_NOP);
+  return out;
+}
+
+
+// the host's stand-in for the boot rom: the words the boot node runs for
+// every frame in the stream, or NULL if it isn't a well-formed stream. they're
+// fetched from home, where a frame that completes at MULTIPORT_ADDR goes.
+u32 *f18a_readboot(f18a_host *host, const char *path, u32 home, u32 *n) {
+  FILE *in = fopen(path, "rb");
+  if (!in) {
+    f18a_hosterr(host, "can't open boot stream '%s': %s\n", path,
+        strerror(errno));
+    return NULL;
+  }
+  u32 size = 0, cap = 1024;
+  u32 *frames = malloc(cap * sizeof(u32));
+  bool ok = frames;
+  for (size_t got; ok && (got = fread(frames + size, sizeof(u32),
+          cap - size, in)); ) {
+    size += got;
+    if (size < cap) continue;
+    u32 *more = realloc(frames, 2 * cap * sizeof(u32));
+    if ((ok = more)) {
+      frames = more;
+      cap *= 2;
+    }
+  }
+  if (!ok) {
+    f18a_hosterr(host, "unable to allocate boot stream '%s'\n", path);
+  } else if (ferror(in)) {
+    f18a_hosterr(host, "error reading boot stream '%s'\n", path);
+    ok = false;
+  }
+  fclose(in);
+  if (!ok) {
+    free(frames);
+    return NULL;
+  }
+  for (u32 k = 0; k < size; k++) frames[k] = ntohl(frames[k]);
+
+  // every frame turns into no more words than it had, plus a load and a jump
+  u32 len = 0, nframes = 0;
+  for (u32 k = 0; k < size; k += FRAME_WORDS + frames[k + 2], nframes++) {
+    if (size - k < FRAME_WORDS || frames[k + 2] > MAX_VAL + 1u
+        || frames[k + 2] > size - k - FRAME_WORDS) {
+      f18a_hosterr(host, "boot stream '%s' is cut short in frame %u\n", path,
+          nframes + 1);
+      free(frames);
+      return NULL;
+    }
+    len += LOAD_WORDS + frames[k + 2] + 1;
+  }
+  if (!nframes) {
+    f18a_hosterr(host, "boot stream '%s' is empty\n", path);
+    free(frames);
+    return NULL;
+  }
+
+  u32 *words = malloc((len ? len : 1) * sizeof(u32));
+  u32 *out = words;
+  for (u32 k = 0; words && k < size; k += FRAME_WORDS + frames[k + 2]) {
+    u32 count = frames[k + 2];
+    if (count) {
+      out = load(out, frames[k + 1] & ADDR_MASK, count, OP_SVAI);
+      for (u32 w = 0; w < count; w++)
+        *out++ = frames[k + FRAME_WORDS + w] & MAX_VAL;
+    }
+    *out++ = jumpto(frames[k] == MULTIPORT_ADDR ? home : frames[k]);
+  }
+  free(frames);
+  if (!words) {
+    f18a_hosterr(host, "out of memory reading boot stream '%s'\n", path);
+    return NULL;
+  }
+  *n = out - words;
+  return words;
+}
+
+
+// the path from the boot node, by index, as described above
+static void bootpath(int boot, int *path) {
+  int col = boot % FABRIC_COLS, n = 0;
+  for (int c = col; c >= 0; c--)
+    path[n++] = (FABRIC_ROWS - 1) * FABRIC_COLS + c;
+  for (int r = FABRIC_ROWS - 2; r >= 0; r--)
+    for (int k = 0; k <= col; k++)
+      path[n++] = r * FABRIC_COLS + ((FABRIC_ROWS - 2 - r) % 2 ? col - k : k);
+  for (int r = 0; r < FABRIC_ROWS; r++)
+    for (int k = 0; k < FABRIC_COLS - col - 1; k++)
+      path[n++] = r * FABRIC_COLS
+        + (r % 2 ? FABRIC_COLS - 1 - k : col + 1 + k);
+}
+
+
+// the address of the port of node i that faces node j
+static u32 facing(int i, int j) {
+  return f18a_portaddr(1 << fabric_port(i, j));
+}
+
+
+// what a node runs to load itself: its ram, then a
+static u32 *ramload(u32 *out, const f18a *f) {
+  out = load(out, 0, RAM_WORDS, OP_SVAI);
+  for (int w = 0; w < RAM_WORDS; w++) *out++ = f->ram[w] & MAX_VAL;
+  *out++ = word(OP_LVPI, OP_SA, OP_NOP, OP_NOP);
+  *out++ = f->a & MAX_VAL;
+  return out;
+}
+
+
+// ...and what starts it
+static void start(u32 *out, const f18a *f) {
+  *out++ = word(OP_LVPI, OP_SB, OP_NOP, OP_NOP);
+  *out++ = f->b & MAX_B;
+  *out++ = jumpto(f->p);
+}
+
+
+// the length of each part of the stream as passed to each node on the path
+// up to last: what it forwards (the same for the next node, after a load to
+// pass it on), then its own share. the first part always ends by sending the
+// node home, to execute from the port it's fed through.
+static void measure(const f18a *const *loaded, int last,
+    u32 lens[2][FABRIC_NODES + 1]) {
+  lens[0][last + 1] = lens[1][last + 1] = 0;
+  for (int k = last; k > 0; k--) {
+    u32 fwd = k < last ? LOAD_WORDS : 0;
+    lens[0][k] = fwd + lens[0][k + 1] + (loaded[k] ? RAM_LOAD : 0) + 1;
+    lens[1][k] = fwd + lens[1][k + 1] + (loaded[k] ? START_WORDS : 0);
+  }
+}
+
+
+// both parts, one after the other, as the boot node passes them to node 1.
+// the first forwards with a, which its share goes on to set, the second
+// with b.
+static void layout(u32 *out, const int *way, const f18a *const *loaded,
+    int last, u32 lens[2][FABRIC_NODES + 1]) {
+  u32 *next = out;
+  for (int k = 1; k <= last; k++) {
+    if (k < last)
+      next = load(next, facing(way[k], way[k + 1]), lens[0][k + 1], OP_SVA);
+    u32 *share = next + lens[0][k + 1];
+    if (loaded[k]) share = ramload(share, loaded[k]);
+    *share = jumpto(facing(way[k], way[k - 1]));
+  }
+  next = out + lens[0][1];
+  for (int k = 1; k <= last; k++) {
+    if (k < last)
+      next = load(next, facing(way[k], way[k + 1]), lens[1][k + 1], OP_SVB);
+    if (loaded[k]) start(next + lens[1][k + 1], loaded[k]);
+  }
+}
+
+
+static bool put(FILE *out, u32 w) {
+  w = htonl(w);
+  return fwrite(&w, sizeof(w), 1, out) == 1;
+}
+
+
+// writes a boot stream that loads the ram of the given nodes, sets their a
+// and b and starts them at p, booting through node boot (yxx). ids are yxx,
+// one per node. the boot node's own a and b are left as loading leaves them,
+// as are the rest of every node's registers, and rom is never touched.
+bool f18a_writeboot(f18a_host *host, const char *path,
+    const f18a *const *nodes, const int *ids, int n, int boot) {
+  int b = fabric_index(boot);
+  if (b < 0 || b / FABRIC_COLS != FABRIC_ROWS - 1) {
+    f18a_hosterr(host, "can't boot through node %03d: boot nodes are in the "
+        "top row\n", boot);
+    return false;
+  }
+  if (n < 1 || n > FABRIC_NODES) {
+    f18a_hosterr(host, "can't write %d nodes to a boot stream\n", n);
+    return false;
+  }
+  int way[FABRIC_NODES], at[FABRIC_NODES];
+  const f18a *loaded[FABRIC_NODES] = {NULL};
+  bootpath(b, way);
+  for (int k = 0; k < FABRIC_NODES; k++) at[way[k]] = k;
+  int last = 0;
+  for (int k = 0; k < n; k++) {
+    int i = fabric_index(ids[k]);
+    if (i < 0) {
+      f18a_hosterr(host, "no such node: %03d\n", ids[k]);
+      return false;
+    }
+    loaded[at[i]] = nodes[k];
+    if (at[i] > last) last = at[i];
+  }
+
+  u32 lens[2][FABRIC_NODES + 1];
+  measure(loaded, last, lens);
+  if (lens[0][1] > MAX_VAL + 1u) {
+    f18a_hosterr(host, "boot stream too long\n");
+    return false;
+  }
+  u32 *stream = malloc((lens[0][1] + lens[1][1] + 1) * sizeof(u32));
+  if (!stream) {
+    f18a_hosterr(host, "out of memory writing boot stream\n");
+    return false;
+  }
+  layout(stream, way, loaded, last, lens);
+
+  FILE *out = fopen(path, "wb");
+  bool ok = out != NULL;
+  // a frame for each part, and then one for the boot node's own ram
+  u32 *words = stream;
+  for (int part = 0; ok && last && part < 2; part++) {
+    ok = put(out, MULTIPORT_ADDR)
+      && put(out, facing(b, way[1]))
+      && put(out, lens[part][1]);
+    for (u32 w = 0; ok && w < lens[part][1]; w++) ok = put(out, *words++);
+  }
+  if (ok && loaded[0]) {
+    ok = put(out, loaded[0]->p) && put(out, 0) && put(out, RAM_WORDS);
+    for (int w = 0; ok && w < RAM_WORDS; w++)
+      ok = put(out, loaded[0]->ram[w] & MAX_VAL);
+  }
+  free(stream);
+  if (out && fclose(out)) ok = false;
+  if (!ok)
+    f18a_hosterr(host, "error writing boot stream '%s': %s\n", path,
+        strerror(errno));
+  return ok;
+}
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2013, Matt Hellige
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above copyright 
+ *   notice, this list of conditions and the following disclaimer in the 
+ *   documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT 
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// breakpoints and watchpoints cost nothing until they're set, and little
+// after: rather than check every step, f18a_mark puts OP_TRAP in place of the
+// ops they concern as words are decoded, and only those steps come here (see
+// trap() in emulator.c). a breakpoint marks its slots of one word. a
+// watchpoint can't know where its address will be read or written from, so
+// while there is one every op that reads or writes memory is marked.
+
+#include <stdlib.h>
+
+#include "f18a.h"
+#include "opcodes.h"
+
+#define MAX_POINTS 64
+
+typedef struct breaks_t {
+  breakpoint points[MAX_POINTS];
+  int n;
+  int nextid;
+  int hit; // the point that raised the last A_BREAK
+  bool resume; // let the next trap run its op (see f18a_stepover)
+} breaks_t;
+
+
+static u16 norm(u32 addr) {
+  addr &= 0x1ff;
+  return addr & 0x100 ? addr : addr & 0xbf;
+}
+
+
+// the address of the word in cache entry cw. words fetched from io go to the
+// scratch entry, and p doesn't increment in the io range, so it's still there.
+static u16 wordaddr(const f18a *f, u8 cw) {
+  if (cw == CACHE_SCRATCH) return norm(f->p);
+  return ((cw & 0x40) << 1) | (cw & 0x3f);
+}
+
+
+static bool reads(u8 op) {
+  return op >= OP_LVPI && op <= OP_LVA;
+}
+
+
+static bool writes(u8 op) {
+  return op >= OP_SVPI && op <= OP_SVA;
+}
+
+
+// the address a memory op goes to
+static u16 target(const f18a *f, u8 op) {
+  switch (op) {
+    case OP_LVPI: case OP_SVPI: return norm(f->p);
+    case OP_LVB: case OP_SVB: return norm(f->b);
+    default: return norm(f->a);
+  }
+}
+
+
+// rebuild the decode cache, and any translations, around the current points
+static void remark(f18a *f) {
+  if (f->breaks && !f->breaks->n) {
+    free(f->breaks);
+    f->breaks = NULL;
+  }
+  f18a_latch(f);
+}
+
+
+static int add(f18a *f, breakpoint point) {
+  breaks_t *b = f->breaks;
+  if (!b) {
+    b = f->breaks = calloc(1, sizeof(breaks_t));
+    if (!b) return 0;
+  }
+  if (b->n == MAX_POINTS) return 0;
+  point.id = ++b->nextid;
+  b->points[b->n++] = point;
+  remark(f);
+  return point.id;
+}
+
+
+// break before the given slots (a bit each) of the word at addr. returns the
+// id of the new point, or 0 if it can't be set.
+int f18a_break(f18a *f, u32 addr, u8 slots) {
+  return add(f, (breakpoint){0, 0, slots & 0xf, norm(addr)});
+}
+
+
+// break before any op that reads (W_READ) or writes (W_WRITE) addr
+int f18a_watch(f18a *f, u32 addr, u8 watch) {
+  return add(f, (breakpoint){0, watch & (W_READ | W_WRITE), 0, norm(addr)});
+}
+
+
+bool f18a_unbreak(f18a *f, int id) {
+  breaks_t *b = f->breaks;
+  if (!b) return false;
+  for (int i = 0; i < b->n; i++) {
+    if (b->points[i].id != id) continue;
+    b->points[i] = b->points[--b->n];
+    remark(f);
+    return true;
+  }
+  return false;
+}
+
+
+const breakpoint *f18a_points(const f18a *f, int *n) {
+  *n = f->breaks ? f->breaks->n : 0;
+  return f->breaks ? f->breaks->points : NULL;
+}
+
+
+// the point the node last stopped at, if it's still set
+const breakpoint *f18a_breakhit(const f18a *f) {
+  breaks_t *b = f->breaks;
+  for (int i = 0; b && i < b->n; i++)
+    if (b->points[i].id == b->hit) return &b->points[i];
+  return NULL;
+}
+
+
+// mark the ops of d, decoded from addr, that some point might stop at
+void f18a_mark(f18a *f, decoded_t *d, u32 addr) {
+  breaks_t *b = f->breaks;
+  u8 watch = 0, slots = 0;
+  for (int i = 0; i < b->n; i++) {
+    const breakpoint *point = &b->points[i];
+    watch |= point->watch;
+    if (!point->watch && point->addr == norm(addr)) slots |= point->slots;
+  }
+  for (u8 slot = 0; slot < 4; slot++) {
+    u8 op = d->ops[slot];
+    if (slots & (1 << slot) || (watch & W_READ && reads(op))
+        || (watch & W_WRITE && writes(op))) {
+      d->ops[slot] = OP_TRAP;
+      d->loop = L_NONE;
+    }
+  }
+}
+
+
+// the op that the trap in slot slot of cache entry cw stands for
+u8 f18a_untrap(const f18a *f, u8 cw, u8 slot) {
+  decoded_t d;
+  f18a_decode(&d, cw, f->dcache[cw].word);
+  return d.ops[slot];
+}
+
+
+// whether the trapped op, about to run from the given slot, should stop the
+// node. if so, it's recorded as the hit.
+bool f18a_hits(f18a *f, u8 op, u8 slot) {
+  breaks_t *b = f->breaks;
+  if (!b) return false; // the traps of a fork, say, before a refetch
+  if (b->resume) {
+    b->resume = false;
+    return false;
+  }
+  for (int i = 0; i < b->n; i++) {
+    const breakpoint *point = &b->points[i];
+    bool hit = point->watch
+      ? ((point->watch & W_READ && reads(op))
+          || (point->watch & W_WRITE && writes(op)))
+        && point->addr == target(f, op)
+      : point->slots & (1 << slot) && point->addr == wordaddr(f, f->cw);
+    if (hit) {
+      b->hit = point->id;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+// take one step, even if a point would stop it. this is how to go on from a
+// point once it's been hit.
+action_t f18a_stepover(f18a *f) {
+  if (!f->breaks) return f18a_step(f);
+  f->breaks->resume = true;
+  action_t action = f18a_step(f);
+  if (f->breaks) f->breaks->resume = false;
+  return action;
+}
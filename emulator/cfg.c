@@ -0,0 +1,714 @@
+/*
+ * Copyright (c) 2013, Matt Hellige
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above copyright 
+ *   notice, this list of conditions and the following disclaimer in the 
+ *   documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT 
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// a static analysis of the code in a node's ram and rom: which words run, the
+// basic blocks and routines they make up, and how long each routine can take
+// at worst. it's for checking an image against a timing budget before it
+// runs, and the graph is there for engines to use as well.
+//
+// words are decoded as the emulator does (see f18a_decode), and run from the
+// node's current p and registers, which for a fresh node are those it boots
+// with. there's no telling in general what a word will do with values it
+// reads, so the analysis only follows literals: through @p, the stack ops,
+// push and pop, as far as r. that's enough to bound a for ... next or an
+// unext loop whose count is a literal, and to follow a ; to a known address,
+// like the one a node boots into. a ; whose r is the return address of the
+// routine it's in is a return, and a call is assumed to come back with the
+// return stack as it left it, and nothing known about the data stack.
+//
+// a routine's worst case is the longest path through its blocks, calls
+// included, with each next loop taken as many times as it can be. anything
+// else that loops, or a transfer the analysis can't follow, or recursion,
+// leaves it unbounded. times are simulated, from optimes and T_FETCH, and
+// steps are ops run, as the engines count them.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "f18a.h"
+#include "opcodes.h"
+
+#define V_UNKNOWN 0xffffffff
+#define V_RETURN 0xfffffffe // the return address of the routine being run
+
+#define NO_ADDR 0xffff
+
+// what's known of the registers at some point, with V_UNKNOWN for the rest
+typedef struct {
+  bool seen;
+  u32 t, s, r;
+  u32 stack[STACK_WORDS];
+  u32 rstack[RSTACK_WORDS];
+  u8 sp, rsp;
+} astate_t;
+
+// what a word does, run from the state known on entry to it
+typedef struct {
+  u8 exit;
+  u16 on, to; // addresses, or NO_ADDR
+  u32 onr, tor; // r along each way out
+  u64 steps;
+  tstamp_t time;
+} aword_t;
+
+typedef struct {
+  const f18a *f;
+  astate_t in[CACHE_WORDS];
+  aword_t words[CACHE_WORDS];
+  bool dirty[CACHE_WORDS];
+  bool entry[CACHE_WORDS]; // of a routine
+  u8 root;
+} analysis_t;
+
+typedef struct {
+  u64 steps;
+  tstamp_t time;
+} cost_t;
+
+static const cost_t UNBOUNDED = {CFG_UNBOUNDED, CFG_UNBOUNDED};
+
+static const u32 dmasks[] = {0x3ff, 0xff, 0x7};
+
+
+static bool known(u32 v) {
+  return v <= MAX_VAL;
+}
+
+
+static u16 wordaddr(u8 cw) {
+  return ((cw & 0x40) << 1) | (cw & 0x3f);
+}
+
+
+static u32 load(const f18a *f, u32 addr) {
+  if (addr & 0x100) return V_UNKNOWN; // a port, or io
+  u8 cw = CACHE_INDEX(addr);
+  return cw < RAM_WORDS ? f->ram[cw] : f->rom[cw - RAM_WORDS];
+}
+
+
+static void push(astate_t *st, u32 v) {
+  st->sp = (st->sp + 1) % STACK_WORDS;
+  st->stack[st->sp] = st->s;
+  st->s = st->t;
+  st->t = v;
+}
+
+
+static u32 pop(astate_t *st) {
+  u32 t = st->t;
+  st->t = st->s;
+  st->s = st->stack[st->sp];
+  st->sp = (st->sp + STACK_WORDS - 1) % STACK_WORDS;
+  return t;
+}
+
+
+static void pushr(astate_t *st, u32 v) {
+  st->rsp = (st->rsp + 1) % RSTACK_WORDS;
+  st->rstack[st->rsp] = st->r;
+  st->r = v;
+}
+
+
+static u32 popr(astate_t *st) {
+  u32 r = st->r;
+  st->r = st->rstack[st->rsp];
+  st->rsp = (st->rsp + RSTACK_WORDS - 1) % RSTACK_WORDS;
+  return r;
+}
+
+
+// nothing known of the data stack
+static void forget(astate_t *st) {
+  st->t = st->s = V_UNKNOWN;
+  for (int i = 0; i < STACK_WORDS; i++) st->stack[i] = V_UNKNOWN;
+}
+
+
+static u64 plus(u64 a, u64 b) {
+  return a > CFG_UNBOUNDED - b ? CFG_UNBOUNDED : a + b;
+}
+
+
+static u64 times(u64 a, u64 n) {
+  return n && a > CFG_UNBOUNDED / n ? CFG_UNBOUNDED : a * n;
+}
+
+
+// run the word at cw from st, leaving the state along each way out in on and
+// to. a call's to is left for the caller to fill in.
+static void run(analysis_t *an, u8 cw, astate_t st, aword_t *w, astate_t *on,
+    astate_t *to) {
+  decoded_t d;
+  f18a_decode(&d, cw, load(an->f, wordaddr(cw)));
+  u32 p = f18a_inc(wordaddr(cw));
+  *w = (aword_t){E_FALL, NO_ADDR, NO_ADDR, V_UNKNOWN, V_UNKNOWN, 0, T_FETCH};
+  u64 bodysteps = 0, bodytime = 0; // from slot 0, for unext
+  bool pure = true; // the body leaves the data stack alone
+  for (u8 slot = 0; slot < 4; slot++) {
+    u8 op = d.ops[slot];
+    if (op == OP_HALT) {
+      w->exit = E_HALT;
+      return;
+    }
+    w->steps++;
+    w->time += optimes[op];
+    bodysteps++;
+    bodytime += optimes[op];
+    u32 dest = slot < 3 ? (p & ~(dmasks[slot] | 0x100)) | d.dest[slot] : 0;
+    switch (op) {
+      case OP_RET:
+        if (st.r == V_RETURN) {
+          w->exit = E_RETURN;
+        } else if (known(st.r)) {
+          w->exit = E_JUMP;
+          w->to = st.r & MAX_P;
+          popr(&st);
+          *to = st;
+        } else {
+          w->exit = E_UNKNOWN;
+        }
+        return;
+      case OP_EXEC:
+        if (!known(st.r)) {
+          w->exit = E_UNKNOWN;
+          return;
+        }
+        w->exit = E_JUMP;
+        w->to = st.r & MAX_P;
+        st.r = p;
+        *to = st;
+        return;
+      case OP_JUMP:
+        w->exit = E_JUMP;
+        w->to = dest;
+        *to = st;
+        return;
+      case OP_CALL:
+        w->exit = E_CALL;
+        w->to = dest;
+        w->on = p;
+        forget(&st);
+        *on = st;
+        return;
+      case OP_UNXT:
+        if (!known(st.r)) {
+          w->steps = w->time = CFG_UNBOUNDED;
+        } else {
+          w->steps = plus(w->steps, times(bodysteps, st.r));
+          w->time = plus(w->time, times(bodytime, st.r));
+        }
+        popr(&st);
+        if (!pure) forget(&st);
+        break;
+      case OP_NEXT:
+        w->exit = E_NEXT;
+        w->to = dest;
+        w->on = p;
+        *to = st;
+        if (known(st.r) && st.r) to->r--;
+        else to->r = V_UNKNOWN;
+        popr(&st);
+        *on = st;
+        return;
+      case OP_IF: case OP_IFG:
+        w->exit = E_BRANCH;
+        w->to = dest;
+        w->on = p;
+        *to = *on = st;
+        return;
+      case OP_LVPI:
+        push(&st, load(an->f, p));
+        p = f18a_inc(p);
+        break;
+      case OP_SVPI:
+        pop(&st);
+        p = f18a_inc(p);
+        break;
+      case OP_LVAI: case OP_LVB: case OP_LVA: case OP_A: push(&st, V_UNKNOWN);
+        break;
+      case OP_SVAI: case OP_SVB: case OP_SVA: case OP_DROP: case OP_SB:
+      case OP_SA:
+        pop(&st);
+        break;
+      case OP_MULS: case OP_SHL: case OP_SHR: case OP_INV: st.t = V_UNKNOWN;
+        break;
+      case OP_ADD: case OP_AND: case OP_OR:
+        pop(&st);
+        st.t = V_UNKNOWN;
+        break;
+      case OP_DUP: push(&st, st.t); break;
+      case OP_OVER: push(&st, st.s); break;
+      case OP_POP: push(&st, popr(&st)); break;
+      case OP_PUSH: pushr(&st, pop(&st)); break;
+      case OP_NOP: break;
+    }
+    if (op != OP_NOP && op != OP_UNXT) pure = false;
+  }
+  w->on = p;
+  *on = st;
+}
+
+
+static bool joinval(u32 *into, u32 v) {
+  if (*into == v || *into == V_UNKNOWN) return false;
+  *into = V_UNKNOWN;
+  return true;
+}
+
+
+// merge st into what's known on entry to cw. returns whether that changed.
+static bool join(analysis_t *an, u16 addr, const astate_t *st) {
+  if (addr & 0x100) return false;
+  u8 cw = CACHE_INDEX(addr);
+  astate_t *in = &an->in[cw];
+  if (!in->seen) {
+    *in = *st;
+    in->seen = an->dirty[cw] = true;
+    return true;
+  }
+  bool changed = joinval(&in->t, st->t) | joinval(&in->s, st->s)
+    | joinval(&in->r, st->r);
+  // stacks that don't line up say nothing
+  for (int i = 0; i < STACK_WORDS; i++)
+    changed |= joinval(&in->stack[i],
+        in->sp == st->sp ? st->stack[i] : V_UNKNOWN);
+  for (int i = 0; i < RSTACK_WORDS; i++)
+    changed |= joinval(&in->rstack[i],
+        in->rsp == st->rsp ? st->rstack[i] : V_UNKNOWN);
+  if (changed) an->dirty[cw] = true;
+  return changed;
+}
+
+
+// find what's known on entry to every word that runs
+static void propagate(analysis_t *an) {
+  astate_t fresh; // on entry to a routine
+  memset(&fresh, 0, sizeof(fresh));
+  forget(&fresh);
+  fresh.r = V_RETURN;
+  for (int i = 0; i < RSTACK_WORDS; i++) fresh.rstack[i] = V_UNKNOWN;
+  for (bool again = true; again; ) {
+    again = false;
+    for (u8 cw = 0; cw < CACHE_WORDS; cw++) {
+      if (!an->dirty[cw]) continue;
+      an->dirty[cw] = false;
+      again = true;
+      aword_t w;
+      astate_t on, to;
+      run(an, cw, an->in[cw], &w, &on, &to);
+      if (w.exit == E_CALL && !(w.to & 0x100)) {
+        an->entry[CACHE_INDEX(w.to)] = true;
+        to = fresh;
+      }
+      if (w.on != NO_ADDR) join(an, w.on, &on);
+      if (w.to != NO_ADDR) join(an, w.to, &to);
+    }
+  }
+}
+
+
+static u8 blockof(const f18a_cfg *cfg, u16 addr) {
+  return addr == NO_ADDR || addr & 0x100 ? CFG_NONE
+    : cfg->block[CACHE_INDEX(addr)];
+}
+
+
+// cut the words that run into blocks, each starting at a word that's entered
+// other than by running on from the one before
+static void blocks(analysis_t *an, f18a_cfg *cfg) {
+  u8 preds[CACHE_WORDS] = {0};
+  bool leader[CACHE_WORDS] = {false};
+  for (u8 cw = 0; cw < CACHE_WORDS; cw++) {
+    if (!an->in[cw].seen) continue;
+    astate_t on, to;
+    aword_t *w = &an->words[cw];
+    run(an, cw, an->in[cw], w, &on, &to);
+    w->onr = on.r;
+    w->tor = to.r;
+    // an edge to io can't be followed
+    if ((w->to != NO_ADDR && w->to & 0x100)
+        || (w->on != NO_ADDR && w->on & 0x100)) {
+      w->exit = E_UNKNOWN;
+      w->on = w->to = NO_ADDR;
+    }
+    if (w->on != NO_ADDR) {
+      preds[CACHE_INDEX(w->on)]++;
+      if (w->exit != E_FALL) leader[CACHE_INDEX(w->on)] = true;
+    }
+    if (w->to != NO_ADDR) leader[CACHE_INDEX(w->to)] = true;
+  }
+  leader[an->root] = true;
+  memset(cfg->block, CFG_NONE, sizeof(cfg->block));
+  cfg->nblocks = 0;
+  for (u8 cw = 0; cw < CACHE_WORDS; cw++) {
+    if (!an->in[cw].seen || !(leader[cw] || preds[cw] != 1)) continue;
+    cfgblock_t *b = &cfg->blocks[cfg->nblocks];
+    *b = (cfgblock_t){.addr = wordaddr(cw), .callee = CFG_NONE};
+    u8 at = cw;
+    for (;;) {
+      const aword_t *w = &an->words[at];
+      cfg->block[at] = cfg->nblocks;
+      b->words++;
+      b->steps = plus(b->steps, w->steps);
+      b->time = plus(b->time, w->time);
+      if (w->exit != E_FALL) break;
+      u8 next = CACHE_INDEX(w->on);
+      if (leader[next] || preds[next] != 1 || cfg->block[next] != CFG_NONE)
+        break;
+      at = next;
+    }
+    b->last = at;
+    b->exit = an->words[at].exit;
+    cfg->nblocks++;
+  }
+  for (int i = 0; i < cfg->nblocks; i++) {
+    cfgblock_t *b = &cfg->blocks[i];
+    const aword_t *w = &an->words[b->last];
+    b->on = blockof(cfg, w->on);
+    b->to = b->exit == E_CALL ? CFG_NONE : blockof(cfg, w->to);
+  }
+}
+
+
+static void routines(analysis_t *an, f18a_cfg *cfg) {
+  u8 routine[CACHE_WORDS];
+  memset(routine, CFG_NONE, sizeof(routine));
+  cfg->nroutines = 0;
+  for (int pass = 0; pass < 2; pass++) {
+    for (u8 cw = 0; cw < CACHE_WORDS; cw++) {
+      if (pass ? !an->entry[cw] || cw == an->root : cw != an->root) continue;
+      if (!an->in[cw].seen) continue;
+      routine[cw] = cfg->nroutines;
+      cfg->routines[cfg->nroutines++] = (cfgroutine_t){wordaddr(cw),
+        cfg->block[cw], 0, 0, NULL};
+    }
+  }
+  for (int i = 0; i < cfg->nblocks; i++) {
+    cfgblock_t *b = &cfg->blocks[i];
+    const aword_t *w = &an->words[b->last];
+    if (b->exit == E_CALL) b->callee = routine[CACHE_INDEX(w->to)];
+  }
+}
+
+
+// the worst cases of the routines, as far as they've been worked out
+typedef struct {
+  f18a_cfg *cfg;
+  const analysis_t *an;
+  cost_t cost[CACHE_WORDS];
+  const char *why[CACHE_WORDS];
+  u8 state[CACHE_WORDS]; // 0 to do, 1 under way, 2 done
+} costing_t;
+
+// the blocks of a routine, with each loop costed so far standing in for its
+// body
+typedef struct {
+  costing_t *c;
+  bool in[CACHE_WORDS]; // of the routine
+  const bool *within; // the part of it being costed
+  u8 rep[CACHE_WORDS]; // the header of the outermost loop costed around it
+  bool looped[CACHE_WORDS]; // by header
+  cost_t loop[CACHE_WORDS]; // by header, for all its passes
+  u8 header; // of the loop being costed, whose back edges don't count
+  cost_t memo[CACHE_WORDS];
+  u8 state[CACHE_WORDS]; // 0 to do, 1 under way, 2 done
+  bool found[CACHE_WORDS];
+  const char *why;
+} region_t;
+
+static cost_t routinecost(costing_t *c, int r);
+
+
+static cost_t sum(cost_t a, cost_t b) {
+  return (cost_t){plus(a.steps, b.steps), plus(a.time, b.time)};
+}
+
+
+static cost_t most(cost_t a, cost_t b) {
+  return (cost_t){a.steps > b.steps ? a.steps : b.steps,
+    a.time > b.time ? a.time : b.time};
+}
+
+
+static cost_t unbounded(region_t *g, const char *why) {
+  if (!g->why) g->why = why;
+  return UNBOUNDED;
+}
+
+
+// one run through block b, calls included
+static cost_t blockcost(region_t *g, u8 b) {
+  const cfgblock_t *block = &g->c->cfg->blocks[b];
+  cost_t cost = {block->steps, block->time};
+  if (cost.steps == CFG_UNBOUNDED)
+    return unbounded(g, "a micro-loop it can't bound");
+  if (block->exit == E_UNKNOWN) return unbounded(g, "an indirect transfer");
+  if (block->exit != E_CALL) return cost;
+  if (block->callee == CFG_NONE) return unbounded(g, "an indirect transfer");
+  if (g->c->state[block->callee] == 1) return unbounded(g, "recursion");
+  cost_t callee = routinecost(g->c, block->callee);
+  if (callee.steps == CFG_UNBOUNDED)
+    return unbounded(g, "a call to a routine it can't bound");
+  return sum(cost, callee);
+}
+
+
+// the longest path through the region from the node x stands for, to target
+// or, if target is CFG_NONE, to wherever it ends. returns false if there's
+// no way to target.
+static bool longest(region_t *g, u8 x, u8 target, cost_t *out) {
+  const f18a_cfg *cfg = g->c->cfg;
+  if (g->state[x] == 1) {
+    *out = unbounded(g, "a loop it can't bound");
+    return true;
+  }
+  if (g->state[x] == 2) {
+    *out = g->memo[x];
+    return g->found[x];
+  }
+  g->state[x] = 1;
+  bool found = target == CFG_NONE || x == target;
+  cost_t best = {0, 0};
+  for (int b = 0; x != target && b < cfg->nblocks; b++) {
+    if (!g->within[b] || g->rep[b] != x) continue;
+    u8 succ[2] = {cfg->blocks[b].on, cfg->blocks[b].to};
+    for (int k = 0; k < 2; k++) {
+      u8 s = succ[k];
+      if (s == CFG_NONE || !g->within[s] || s == g->header
+          || g->rep[s] == x)
+        continue;
+      cost_t cost;
+      if (!longest(g, g->rep[s], target, &cost)) continue;
+      best = found ? most(best, cost) : cost;
+      found = true;
+    }
+  }
+  g->memo[x] = sum(g->looped[x] ? g->loop[x] : blockcost(g, x), best);
+  g->found[x] = found;
+  g->state[x] = 2;
+  *out = g->memo[x];
+  return found;
+}
+
+
+static void restart(region_t *g, const bool *within, u8 header) {
+  g->within = within;
+  g->header = header;
+  memset(g->state, 0, sizeof(g->state));
+}
+
+
+// depth first from b, noting the edges back to a block on the path to it
+static void dfs(region_t *g, u8 b, u8 *state, bool back[][2]) {
+  const cfgblock_t *block = &g->c->cfg->blocks[b];
+  g->in[b] = true;
+  state[b] = 1;
+  u8 succ[2] = {block->on, block->to};
+  for (int k = 0; k < 2; k++) {
+    if (succ[k] == CFG_NONE) continue;
+    if (state[succ[k]] == 1) back[b][k] = true;
+    else if (!state[succ[k]]) dfs(g, succ[k], state, back);
+  }
+  state[b] = 2;
+}
+
+
+// the natural loop of the back edge from latch to header: the blocks that
+// reach the latch without going through the header
+static int body(const region_t *g, u8 latch, u8 header, bool *loop) {
+  const f18a_cfg *cfg = g->c->cfg;
+  memset(loop, 0, CACHE_WORDS * sizeof(bool));
+  loop[header] = loop[latch] = true;
+  int n = latch == header ? 1 : 2;
+  for (bool again = true; again; ) {
+    again = false;
+    for (int b = 0; b < cfg->nblocks; b++) {
+      const cfgblock_t *block = &cfg->blocks[b];
+      if (!g->in[b] || loop[b]) continue;
+      if ((block->on != CFG_NONE && block->on != header && loop[block->on])
+          || (block->to != CFG_NONE && block->to != header
+            && loop[block->to])) {
+        loop[b] = again = true;
+        n++;
+      }
+    }
+  }
+  return n;
+}
+
+
+// r on the ways into header other than its back edges, if it's the same on
+// all of them
+static u32 entryr(const region_t *g, u8 header, bool back[][2]) {
+  const f18a_cfg *cfg = g->c->cfg;
+  u32 r = V_UNKNOWN;
+  bool any = false;
+  for (int b = 0; b < cfg->nblocks; b++) {
+    if (!g->in[b]) continue;
+    const cfgblock_t *block = &cfg->blocks[b];
+    const aword_t *w = &g->c->an->words[block->last];
+    u32 rs[2] = {w->onr, w->tor};
+    u8 succ[2] = {block->on, block->to};
+    for (int k = 0; k < 2; k++) {
+      if (succ[k] != header || back[b][k]) continue;
+      if (any && rs[k] != r) return V_UNKNOWN;
+      r = rs[k];
+      any = true;
+    }
+  }
+  return any ? r : V_UNKNOWN;
+}
+
+
+// cost the loop closed by the back edge from latch, if it's a next whose
+// count is known and it holds any loop already costed whole. the loop then
+// stands for its body from here on.
+static void loop(region_t *g, u8 latch, bool back[][2]) {
+  cfgblock_t *l = &g->c->cfg->blocks[latch];
+  u8 header = l->to;
+  if (l->exit != E_NEXT || !back[latch][1] || g->looped[header]) return;
+  for (int b = 0; b < g->c->cfg->nblocks; b++) {
+    const cfgblock_t *block = &g->c->cfg->blocks[b];
+    if (b != latch && ((back[b][0] && block->on == header)
+          || (back[b][1] && block->to == header)))
+      return; // another way round it
+  }
+  u32 r = entryr(g, header, back);
+  if (!known(r)) return;
+  bool within[CACHE_WORDS];
+  body(g, latch, header, within);
+  for (int b = 0; b < g->c->cfg->nblocks; b++)
+    if (g->in[b] && within[b] != within[g->rep[b]]) return; // overlaps
+  restart(g, within, header);
+  cost_t pass;
+  if (!longest(g, g->rep[header], g->rep[latch], &pass)) return;
+  l->passes = r + 1;
+  g->loop[header] = (cost_t){times(pass.steps, l->passes),
+    times(pass.time, l->passes)};
+  g->looped[header] = true;
+  for (int b = 0; b < g->c->cfg->nblocks; b++)
+    if (within[g->rep[b]]) g->rep[b] = header;
+}
+
+
+static int loopsize(region_t *g, u8 latch) {
+  bool within[CACHE_WORDS];
+  return body(g, latch, g->c->cfg->blocks[latch].to, within);
+}
+
+
+static cost_t routinecost(costing_t *c, int r) {
+  if (c->state[r] == 2) return c->cost[r];
+  c->state[r] = 1;
+  region_t *g = calloc(1, sizeof(region_t));
+  if (!g) {
+    c->why[r] = "no memory to work it out";
+    c->cost[r] = UNBOUNDED;
+    c->state[r] = 2;
+    return c->cost[r];
+  }
+  g->c = c;
+  for (int b = 0; b < CACHE_WORDS; b++) g->rep[b] = b;
+  u8 state[CACHE_WORDS] = {0};
+  bool back[CACHE_WORDS][2];
+  memset(back, 0, sizeof(back));
+  u8 entry = c->cfg->routines[r].entry;
+  dfs(g, entry, state, back);
+
+  // the loops, innermost first
+  u8 latches[CACHE_WORDS];
+  int sizes[CACHE_WORDS], n = 0;
+  for (int b = 0; b < c->cfg->nblocks; b++) {
+    if (!g->in[b] || !back[b][1]) continue;
+    int size = loopsize(g, b), i = n++;
+    for (; i > 0 && sizes[i - 1] > size; i--) {
+      latches[i] = latches[i - 1];
+      sizes[i] = sizes[i - 1];
+    }
+    latches[i] = b;
+    sizes[i] = size;
+  }
+  for (int i = 0; i < n; i++) loop(g, latches[i], back);
+
+  restart(g, g->in, CFG_NONE);
+  cost_t cost;
+  longest(g, g->rep[entry], CFG_NONE, &cost);
+  if (g->why || cost.steps == CFG_UNBOUNDED) {
+    c->why[r] = g->why ? g->why : "more steps than it can count";
+    cost = UNBOUNDED;
+  }
+  free(g);
+  c->cost[r] = cost;
+  c->state[r] = 2;
+  return cost;
+}
+
+
+// a register's value, as the analysis knows it
+static u32 entry(u32 v) {
+  return v <= MAX_VAL ? v : V_UNKNOWN;
+}
+
+
+void f18a_analyze(const f18a *f, f18a_cfg *cfg) {
+  analysis_t *an = calloc(1, sizeof(analysis_t));
+  costing_t *c = calloc(1, sizeof(costing_t));
+  memset(cfg, 0, sizeof(*cfg));
+  memset(cfg->block, CFG_NONE, sizeof(cfg->block));
+  if (!an || !c || f->p & 0x100) {
+    // nothing to go on: a node running from io runs what it's sent
+    free(an);
+    free(c);
+    return;
+  }
+  an->f = f;
+  an->root = CACHE_INDEX(f->p);
+  astate_t *in = &an->in[an->root];
+  in->seen = an->dirty[an->root] = true;
+  in->t = entry(f->t);
+  in->s = entry(f->s);
+  in->r = entry(f->r);
+  in->sp = f->sp;
+  in->rsp = f->rsp;
+  for (int i = 0; i < STACK_WORDS; i++) in->stack[i] = entry(f->stack[i]);
+  for (int i = 0; i < RSTACK_WORDS; i++) in->rstack[i] = entry(f->rstack[i]);
+  propagate(an);
+  blocks(an, cfg);
+  routines(an, cfg);
+  c->cfg = cfg;
+  c->an = an;
+  for (int r = 0; r < cfg->nroutines; r++) {
+    routinecost(c, r);
+    cfg->routines[r].steps = c->cost[r].steps;
+    cfg->routines[r].time = c->cost[r].time;
+    cfg->routines[r].why = c->why[r];
+  }
+  free(an);
+  free(c);
+}
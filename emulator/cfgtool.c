@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2013, Matt Hellige
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above copyright 
+ *   notice, this list of conditions and the following disclaimer in the 
+ *   documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT 
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// f18a-cfg: prints the blocks and routines of a node's code, as f18a_analyze
+// finds them, with the worst case of each routine. given budgets, it checks
+// routines against them and exits 1 if any might take longer, so it can stand
+// in a build.
+
+#include <getopt.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "f18a.h"
+
+#define MAX_BUDGETS 64
+
+typedef struct {
+  u32 addr;
+  u64 ns;
+} budget_t;
+
+static const char *exits[] = {"fall", "jump", "branch", "next", "call",
+  "return", "halt", "unknown"};
+
+static void error(f18a_host *host, const char *fmt, va_list args) {
+  (void)host;
+  vfprintf(stderr, fmt, args);
+}
+
+static f18a_host host = {.error = error};
+
+static void usage(char **argv) {
+  fprintf(stderr, "usage: %s [options] <image>\n", argv[0]);
+  fprintf(stderr, "   -h, --help           display this message\n");
+  fprintf(stderr, "   -v, --verbose        list the words of each block\n");
+  fprintf(stderr, "   -b, --budget <a>=<ns>\n");
+  fprintf(stderr, "                        fail if the routine at address a "
+      "(hex) might take\n");
+  fprintf(stderr, "                        longer than ns nanoseconds\n");
+}
+
+static void block(const f18a_cfg *cfg, int i) {
+  const cfgblock_t *b = &cfg->blocks[i];
+  printf("%4d %03x %5d %-7s", i, b->addr, b->words, exits[b->exit]);
+  if (b->on != CFG_NONE) printf(" %4d", b->on);
+  else printf("    -");
+  if (b->exit == E_CALL && b->callee != CFG_NONE)
+    printf("  r%-2d", b->callee);
+  else if (b->to != CFG_NONE) printf(" %4d", b->to);
+  else printf("    -");
+  if (b->passes) printf(" %7u", b->passes);
+  else printf("       -");
+  if (b->steps == CFG_UNBOUNDED) printf("          -           -\n");
+  else printf(" %10llu %11.1f\n", (unsigned long long)b->steps,
+      b->time / 1000.0);
+}
+
+static void words(const f18a *f, const f18a_cfg *cfg, int i) {
+  const cfgblock_t *b = &cfg->blocks[i];
+  u32 addr = b->addr;
+  for (int n = 0; n < RAM_WORDS; n++, addr = f18a_inc(addr)) {
+    u8 cw = CACHE_INDEX(addr);
+    u32 word = (cw < RAM_WORDS ? f->ram : f->rom)[cw % RAM_WORDS];
+    char code[DISASM_CHARS];
+    // the words between that aren't in the block are literals
+    if (cfg->block[cw] == i) f18a_disassemble(word, f18a_inc(addr), code);
+    else strcpy(code, "(literal)");
+    printf("%18s%03x %05x  %s\n", "", addr, word, code);
+    if (cw == b->last) break;
+  }
+}
+
+static void routine(const f18a_cfg *cfg, int r) {
+  const cfgroutine_t *rt = &cfg->routines[r];
+  printf("r%-3d %03x %5d", r, rt->addr, rt->entry);
+  if (rt->steps == CFG_UNBOUNDED)
+    printf("  unbounded (%s)", rt->why ? rt->why : "?");
+  else printf(" %10llu %11.1f", (unsigned long long)rt->steps,
+      rt->time / 1000.0);
+  // the routines it calls, each once, by walking its blocks
+  bool seen[CACHE_WORDS] = {false}, called[CACHE_WORDS] = {false};
+  u8 todo[CACHE_WORDS];
+  int n = 0;
+  todo[n++] = rt->entry;
+  seen[rt->entry] = true;
+  while (n) {
+    const cfgblock_t *b = &cfg->blocks[todo[--n]];
+    if (b->exit == E_CALL && b->callee != CFG_NONE) called[b->callee] = true;
+    u8 succ[2] = {b->on, b->to};
+    for (int k = 0; k < 2; k++) {
+      if (succ[k] == CFG_NONE || seen[succ[k]]) continue;
+      seen[succ[k]] = true;
+      todo[n++] = succ[k];
+    }
+  }
+  const char *sep = "  calls";
+  for (int i = 0; i < cfg->nroutines; i++) {
+    if (!called[i]) continue;
+    printf("%s r%d", sep, i);
+    sep = ",";
+  }
+  printf("\n");
+}
+
+static bool budget(const char *arg, budget_t *b) {
+  char *endptr;
+  b->addr = strtoul(arg, &endptr, 16);
+  if (endptr == arg || *endptr != '=' || b->addr > MAX_P) return false;
+  arg = endptr + 1;
+  b->ns = strtoull(arg, &endptr, 10);
+  return endptr != arg && !*endptr;
+}
+
+// check the routine at each budget's address against it
+static int check(const f18a_cfg *cfg, const budget_t *budgets, int n) {
+  int over = 0;
+  for (int i = 0; i < n; i++) {
+    const budget_t *b = &budgets[i];
+    int r = 0;
+    while (r < cfg->nroutines && cfg->routines[r].addr != b->addr) r++;
+    if (r == cfg->nroutines) {
+      fprintf(stderr, "no routine at %03x\n", b->addr);
+      over++;
+    } else if (cfg->routines[r].steps == CFG_UNBOUNDED) {
+      fprintf(stderr, "routine at %03x is unbounded (%s), over its budget of "
+          "%llu ns\n", b->addr, cfg->routines[r].why,
+          (unsigned long long)b->ns);
+      over++;
+    } else if (cfg->routines[r].time > b->ns * 1000) {
+      fprintf(stderr, "routine at %03x might take %.1f ns, over its budget "
+          "of %llu ns\n", b->addr, cfg->routines[r].time / 1000.0,
+          (unsigned long long)b->ns);
+      over++;
+    }
+  }
+  return over ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+  static budget_t budgets[MAX_BUDGETS];
+  int nbudgets = 0;
+  bool verbose = false;
+
+  for (;;) {
+    static struct option long_options[] = {
+      {"help", 0, 0, 'h'},
+      {"verbose", 0, 0, 'v'},
+      {"budget", 1, 0, 'b'},
+      {0, 0, 0, 0},
+    };
+
+    int c = getopt_long(argc, argv, "hvb:", long_options, NULL);
+    if (c == -1) break;
+
+    switch (c) {
+      case 'h':
+        usage(argv);
+        return 0;
+      case 'v':
+        verbose = true;
+        break;
+      case 'b':
+        if (nbudgets == MAX_BUDGETS) {
+          fprintf(stderr, "too many budgets, at most %d\n", MAX_BUDGETS);
+          return 1;
+        }
+        if (!budget(optarg, &budgets[nbudgets++])) {
+          fprintf(stderr, "argument to --budget must be <hex addr>=<ns>\n");
+          return 1;
+        }
+        break;
+      default:
+        usage(argv);
+        return 1;
+    }
+  }
+
+  if (argc - optind != 1) {
+    usage(argv);
+    return 1;
+  }
+  static f18a f;
+  static f18a_cfg cfg;
+  f18a_init(&f, &host);
+  if (!f18a_loadcore(&f, argv[optind])) return 1;
+  f18a_analyze(&f, &cfg);
+
+  printf("block addr words exit      on   to  passes      steps   time (ns)\n");
+  for (int i = 0; i < cfg.nblocks; i++) {
+    block(&cfg, i);
+    if (verbose) words(&f, &cfg, i);
+  }
+  printf("\nroutine addr block      steps   time (ns)\n");
+  for (int r = 0; r < cfg.nroutines; r++) routine(&cfg, r);
+  return check(&cfg, budgets, nbudgets);
+}
@@ -25,6 +25,7 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -32,6 +33,8 @@
 #include "f18a.h"
 #include "opcodes.h"
 
+#define RUN_SLICE 0x10000
+
 static bool prefix(char *pre, char *full) {
   return !strncasecmp(pre, full, strlen(pre));
 }
@@ -47,7 +50,7 @@ static void dumpram(f18a *f18a, u32 addr, int len) {
     int pad = addr % 8;
     f18a_msg("%*s", 5 * pad, "");
     do {
-      if (f18a_present(addr))
+      if (f18a_present(f18a, addr))
         f18a_msg(" %05x", f18a_load(f18a, addr));
       else
         f18a_msg("      ");
@@ -76,6 +79,136 @@ static void dumpstate(f18a *f) {
   for (int i = 0; i < RSTACK_WORDS; i++)
     f18a_msg(" %05x", f->rstack[(f->rsp + RSTACK_WORDS - i) % RSTACK_WORDS]);
   f18a_msg("\n");
+  if (f->p & P9) f18a_msg("   carry: %d\n", f->carry);
+  f18a_msg("    time: %.1f ns\n", f->time / 1000.0);
+}
+
+static void describe(const breakpoint *point) {
+  if (point->watch) {
+    f18a_msg("%d: watch %s%s %03x\n", point->id,
+        point->watch & W_READ ? "r" : "", point->watch & W_WRITE ? "w" : "",
+        point->addr);
+  } else {
+    f18a_msg("%d: break %03x", point->id, point->addr);
+    if (point->slots != 0xf)
+      for (int slot = 0; slot < 4; slot++)
+        if (point->slots & (1 << slot)) f18a_msg(".%d", slot);
+    f18a_msg("\n");
+  }
+}
+
+static void listpoints(f18a *f18a) {
+  int n;
+  const breakpoint *points = f18a_points(f18a, &n);
+  if (!n) f18a_msg("no breakpoints or watchpoints\n");
+  for (int i = 0; i < n; i++) describe(&points[i]);
+}
+
+static void added(f18a *f18a, int id) {
+  int n;
+  const breakpoint *points = f18a_points(f18a, &n);
+  for (int i = 0; i < n; i++)
+    if (points[i].id == id) describe(&points[i]);
+  if (!id) f18a_msg("unable to add another point\n");
+}
+
+// addr[.slot], both hex
+static bool parsebreak(char *tok, u32 *addr, u8 *slots) {
+  char *endptr;
+  *addr = strtoul(tok, &endptr, 16);
+  *slots = 0xf;
+  if (endptr == tok || *addr > ADDR_MASK) return false;
+  if (*endptr == '.') {
+    char *slot = endptr + 1;
+    u32 n = strtoul(slot, &endptr, 16);
+    if (endptr == slot || n > 3) return false;
+    *slots = 1 << n;
+  }
+  return !*endptr;
+}
+
+// step until pred holds, without touching the terminal between steps
+static void until(f18a *f18a, const predicate *pred) {
+  u64 steps = 0;
+  f18a_runterm();
+  action_t action = f18a_advance(f18a, true);
+  while (action == A_CONTINUE) {
+    steps++;
+    if (f18a_test(pred, f18a)) break;
+    if (steps % RUN_SLICE == 0 && f18a_stopped(f18a->host)) break;
+    action = f18a_advance(f18a, false);
+  }
+  f18a_dbgterm();
+  if (action == A_HALT) f18a_msg("node halted.\n");
+  if (action == A_BLOCK) f18a_msg("node blocked on a port.\n");
+  if (action == A_BREAK && f18a_breakhit(f18a)) {
+    f18a_msg("stopped at ");
+    describe(f18a_breakhit(f18a));
+  }
+  if (action == A_CONTINUE && f18a_stopped(f18a->host)) {
+    f18a_msg("interrupted.\n");
+    f18a->host->interrupt = false;
+  }
+  f18a_msg("%llu steps\n", (unsigned long long)steps);
+  dumpheader();
+  dumpstate(f18a);
+}
+
+static void history(f18a *f18a) {
+  char *tok = strtok(NULL, " \t\n");
+  if (!tok) {
+    u64 first, now, last;
+    size_t bytes;
+    if (!f18a->history) {
+      f18a_msg("no history\n");
+      return;
+    }
+    f18a_histinfo(f18a, &first, &now, &last, &bytes);
+    f18a_msg("history from step %llu to %llu, now at %llu, in %.1f mb\n",
+        (unsigned long long)first, (unsigned long long)last,
+        (unsigned long long)now, bytes / 1048576.0);
+    return;
+  }
+  if (!strcasecmp(tok, "off")) {
+    f18a_histoff(f18a);
+    return;
+  }
+  u64 interval = HISTORY_INTERVAL, mb = HISTORY_MB;
+  char *arg = strtok(NULL, " \t\n"), *endptr = NULL;
+  if (arg) interval = strtoull(arg, &endptr, 10);
+  if (arg && !*endptr && (arg = strtok(NULL, " \t\n")))
+    mb = strtoull(arg, &endptr, 10);
+  if (strcasecmp(tok, "on") || (endptr && *endptr) || !interval || !mb) {
+    f18a_msg("usage: history [on [n [mb]] | off]\n");
+    return;
+  }
+  if (f18a_histon(f18a, interval, mb << 20))
+    f18a_msg("history started at step 0\n");
+}
+
+static void dumpjsonstack(FILE *out, const char *name, u32 *words, int n,
+    int top) {
+  fprintf(out, ", \"%s\": [", name);
+  for (int i = 0; i < n; i++)
+    fprintf(out, "%s%u", i ? ", " : "", words[(top + n - i) % n]);
+  fprintf(out, "]");
+}
+
+void f18a_dumpjson(f18a *f, FILE *out) {
+  // stacks are listed from the top down, as in dumpstate. time is simulated
+  // picoseconds.
+  fprintf(out,
+      "{\"p\": %u, \"r\": %u, \"t\": %u, \"s\": %u, \"a\": %u, \"b\": %u, "
+      "\"io\": %u, \"i\": %u, \"slot\": %u, \"sp\": %u, \"rsp\": %u, "
+      "\"carry\": %u, \"time\": %llu",
+      f->p, f->r, f->t, f->s, f->a, f->b, f->io, f->i, f->slot, f->sp, f->rsp,
+      f->carry, (unsigned long long)f->time);
+  dumpjsonstack(out, "stack", f->stack, STACK_WORDS, f->sp);
+  dumpjsonstack(out, "rstack", f->rstack, RSTACK_WORDS, f->rsp);
+  fprintf(out, ", \"ram\": [");
+  for (int i = 0; i < RAM_WORDS; i++)
+    fprintf(out, "%s%u", i ? ", " : "", f->ram[i]);
+  fprintf(out, "]}");
 }
 
 bool f18a_debug(f18a *f18a) {
@@ -96,14 +229,32 @@ bool f18a_debug(f18a *f18a) {
           "  help, ?: show this message\n"
           "  continue: resume running\n"
           "  step [n]: execute a single instruction (or n instructions)\n"
+          "  reverse-step, rs [n]: go back one instruction (or n)\n"
+          "  reverse-continue, rc: go back to the last point that stopped, or\n"
+          "      would have stopped, the node\n"
+          "  history [on [n [mb]] | off]: show the history that reverse\n"
+          "      execution needs, start one afresh (a checkpoint every n\n"
+          "      instructions, in at most mb megabytes), or stop it\n"
+          "  until expr: step until expr holds (e.g., t == 0 && p == 0xb2)\n"
+          "      over registers, stack[n], rstack[n], ram[n], rom[n] and\n"
+          "      mem[addr], with the operators of c\n"
           "  dump: display the state of the cpu\n"
           "  print addr [len]: display memory contents in hex\n"
           "      (addr is hex, len decimal)\n"
+          "  break [addr[.slot]]: stop before the word at addr (hex), or just\n"
+          "      the given slot of it. with no argument, list all points\n"
+          "  watch [r|w] addr: stop before a read or a write of addr (hex),\n"
+          "      or either\n"
+          "  delete id: remove a breakpoint or watchpoint\n"
           "  exit, quit: exit emulator\n"
           "unambiguous abbreviations are recognized "
             "(e.g., s for step or con for continue).\n"
           );
     } else if (matches(tok, "con", "continue")) {
+      // past the point that stopped us, if any
+      f18a_runterm();
+      f18a_advance(f18a, true);
+      f18a_dbgterm();
       return true;
     } else if (matches(tok, "s", "step")) {
       uint32_t steps = 1;
@@ -118,10 +269,64 @@ bool f18a_debug(f18a *f18a) {
       }
       for (uint32_t i = 0; i < steps; i++) {
         f18a_runterm();
-        f18a_step(f18a);
+        action_t action = f18a_advance(f18a, true);
         f18a_dbgterm();
+        if (action == A_HALT) {
+          f18a_msg("node halted.\n");
+          break;
+        }
+        if (action == A_BLOCK) {
+          f18a_msg("node blocked on a port.\n");
+          break;
+        }
         dumpstate(f18a);
       }
+    } else if (matches(tok, "reverse-s", "reverse-step")
+        || matches(tok, "rs", "rs")) {
+      u64 steps = 1;
+      tok = strtok(NULL, delim);
+      if (tok) {
+        char *endptr;
+        steps = strtoull(tok, &endptr, 10);
+        if (*endptr) {
+          f18a_msg("argument to 'reverse-step' must be a decimal number\n");
+          continue;
+        }
+      }
+      if (!f18a->history) {
+        f18a_msg("no history to go back through; see 'history'\n");
+        continue;
+      }
+      u64 back = f18a_rewind(f18a, steps);
+      if (back < steps) f18a_msg("back at the start of the history.\n");
+      f18a_msg("%llu steps back\n", (unsigned long long)back);
+      dumpheader();
+      dumpstate(f18a);
+    } else if (matches(tok, "reverse-c", "reverse-continue")
+        || matches(tok, "rc", "rc")) {
+      if (!f18a->history) {
+        f18a_msg("no history to go back through; see 'history'\n");
+        continue;
+      }
+      if (f18a_reverse(f18a) == A_BREAK && f18a_breakhit(f18a)) {
+        f18a_msg("stopped at ");
+        describe(f18a_breakhit(f18a));
+      } else {
+        f18a_msg("back at the start of the history.\n");
+      }
+      dumpheader();
+      dumpstate(f18a);
+    } else if (matches(tok, "hi", "history")) {
+      history(f18a);
+    } else if (matches(tok, "u", "until")) {
+      char *src = strtok(NULL, "\n");
+      if (!src) {
+        f18a_msg("until requires an expression\n");
+        continue;
+      }
+      predicate pred;
+      if (!f18a_compile(f18a->host, src, &pred)) continue;
+      until(f18a, &pred);
     } else if (matches(tok, "d", "dump")) {
       dumpheader();
       dumpstate(f18a);
@@ -147,6 +352,48 @@ bool f18a_debug(f18a *f18a) {
         }
       }
       dumpram(f18a, addr, length);
+    } else if (matches(tok, "b", "break")) {
+      tok = strtok(NULL, delim);
+      if (!tok) {
+        listpoints(f18a);
+        continue;
+      }
+      u32 addr;
+      u8 slots;
+      if (!parsebreak(tok, &addr, &slots)) {
+        f18a_msg("argument to 'break' must be a hex address, and maybe "
+            "a slot: %s\n", tok);
+        continue;
+      }
+      added(f18a, f18a_break(f18a, addr, slots));
+    } else if (matches(tok, "w", "watch")) {
+      tok = strtok(NULL, delim);
+      u8 watch = W_READ | W_WRITE;
+      if (tok && (!strcasecmp(tok, "r") || !strcasecmp(tok, "w"))) {
+        watch = tolower(*tok) == 'r' ? W_READ : W_WRITE;
+        tok = strtok(NULL, delim);
+      }
+      if (!tok) {
+        f18a_msg("watch requires an address\n");
+        continue;
+      }
+      char *endptr;
+      u32 addr = strtoul(tok, &endptr, 16);
+      if (*endptr || addr > ADDR_MASK) {
+        f18a_msg("addr argument to 'watch' must be a hex address: %s\n", tok);
+        continue;
+      }
+      added(f18a, f18a_watch(f18a, addr, watch));
+    } else if (matches(tok, "del", "delete")) {
+      tok = strtok(NULL, delim);
+      if (!tok) {
+        f18a_msg("delete requires an argument\n");
+        continue;
+      }
+      char *endptr;
+      int id = strtol(tok, &endptr, 10);
+      if (*endptr || !f18a_unbreak(f18a, id))
+        f18a_msg("no such breakpoint or watchpoint: %s\n", tok);
     } else if (matches(tok, "e", "exit")
         || matches(tok, "q", "quit")) {
       return false;
@@ -156,3 +403,35 @@ bool f18a_debug(f18a *f18a) {
   }
 }
 
+
+// run interactively on the terminal, entering the debugger on a break, ctrl-c
+// (an interrupt on f18a's host) or a halt
+void f18a_run(f18a *f18a, engine_t engine, bool debugboot) {
+  bool running = true;
+  u64 none = 0;
+  f18a_stepn(f18a, &none); // just to fetch
+  if (debugboot) running = f18a_debug(f18a);
+  f18a_msg("running...\n");
+  f18a_runterm();
+  while (running && !(f18a->host && f18a->host->quit)) {
+    // run in slices, so that signals are noticed promptly...
+    u64 budget = RUN_SLICE;
+    action_t action = f18a_forward(f18a, engine, &budget);
+    if (action == A_EXIT) running = false;
+    if (action == A_HALT) f18a_msg("node halted.\n");
+    if (action == A_BLOCK) f18a_msg("node blocked on a port, forever.\n");
+    if (action == A_BREAK && f18a_breakhit(f18a)) {
+      f18a_msg("stopped at ");
+      describe(f18a_breakhit(f18a));
+    }
+    if (action == A_BREAK || action == A_HALT || action == A_BLOCK
+        || (f18a->host && f18a->host->interrupt)) {
+      if (f18a->host) f18a->host->interrupt = false;
+      f18a_dbgterm();
+      running = f18a_debug(f18a);
+      if (running) f18a_msg("running...\n");
+      f18a_runterm();
+    }
+  }
+  f18a_dbgterm();
+}
@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2013, Matt Hellige
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above copyright 
+ *   notice, this list of conditions and the following disclaimer in the 
+ *   documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT 
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// stock devices, for modelling the boards around a chip (see iomap.c). each
+// is allocated and attached to a node by its constructor, which returns NULL
+// if that fails, having undone whatever it had done. f18a_devfree detaches
+// one and frees it.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "f18a.h"
+
+// a value that steps through a schedule: values[k] from when[k] on, and 0
+// before when[0]. each step is an event, which schedules the next.
+typedef struct {
+  int n;
+  tstamp_t *when;
+  u32 *values;
+  u32 value;
+} schedule_t;
+
+static bool setschedule(schedule_t *s, int n, const tstamp_t *when,
+    const u32 *values) {
+  s->n = n;
+  s->value = 0;
+  s->when = malloc(n * sizeof(tstamp_t) + 1);
+  s->values = malloc(n * sizeof(u32) + 1);
+  if (!s->when || !s->values) return false;
+  memcpy(s->when, when, n * sizeof(tstamp_t));
+  memcpy(s->values, values, n * sizeof(u32));
+  return true;
+}
+
+static void freeschedule(schedule_t *s) {
+  free(s->when);
+  free(s->values);
+}
+
+static bool startschedule(f18a *f, f18a_device *dev, schedule_t *s) {
+  return !s->n || f18a_schedule(f, dev, s->when[0], 0);
+}
+
+static void step(f18a *f, f18a_device *dev, schedule_t *s, u64 k) {
+  s->value = s->values[k];
+  if (++k < (u64)s->n) f18a_schedule(f, dev, s->when[k], k);
+}
+
+
+void f18a_devfree(f18a *f, f18a_device *dev) {
+  f18a_detach(f, dev);
+  if (dev->free) dev->free(dev);
+}
+
+
+// for a constructor that fails after allocating its device
+static f18a_device *discard(f18a *f, f18a_device *dev) {
+  f18a_devfree(f, dev);
+  return NULL;
+}
+
+
+// a gpio pin, reported in the given bit of the io register, and controlled by
+// that bit and the one below it in writes: 11 drives it high, 10 low, and
+// anything else leaves it to its input, which follows the schedule.
+typedef struct {
+  f18a_device dev;
+  u8 bit;
+  int drive; // -1 if not driven
+  schedule_t input;
+} gpio_t;
+
+static u32 gpiostatus(f18a_device *dev, f18a *f, u32 io) {
+  (void)f;
+  gpio_t *g = dev->data;
+  u32 level = g->drive >= 0 ? (u32)g->drive : g->input.value & 1;
+  return (io & ~(1u << g->bit)) | level << g->bit;
+}
+
+static void gpiowrite(f18a_device *dev, f18a *f, u32 addr, u32 val) {
+  (void)addr;
+  gpio_t *g = dev->data;
+  u32 ctl = (val >> (g->bit - 1)) & 3;
+  int drive = ctl == 3 ? 1 : ctl == 2 ? 0 : -1;
+  if (drive == g->drive) return;
+  g->drive = drive;
+  f18a_hostmsg(f->host, "pin %d %s at %.1f ns\n", g->bit,
+      drive < 0 ? "released" : drive ? "driven high" : "driven low",
+      f->time / 1000.0);
+}
+
+static void gpioevent(f18a_device *dev, f18a *f, tstamp_t when, u64 k) {
+  (void)when;
+  gpio_t *g = dev->data;
+  step(f, dev, &g->input, k);
+}
+
+static void gpiofree(f18a_device *dev) {
+  gpio_t *g = dev->data;
+  freeschedule(&g->input);
+  free(g);
+}
+
+f18a_device *f18a_gpio(f18a *f, u8 bit, int n, const tstamp_t *when,
+    const u32 *levels) {
+  gpio_t *g = calloc(1, sizeof(gpio_t));
+  if (!g) {
+    f18a_hosterr(f->host, "unable to make a gpio pin at bit %d\n", bit);
+    return NULL;
+  }
+  g->dev = (f18a_device){.status = gpiostatus, .write = gpiowrite,
+    .event = gpioevent, .free = gpiofree, .data = g};
+  g->bit = bit;
+  g->drive = -1;
+  if (!bit || bit > 17 || !setschedule(&g->input, n, when, levels)) {
+    f18a_hosterr(f->host, "unable to make a gpio pin at bit %d\n", bit);
+    return discard(f, &g->dev);
+  }
+  if (!f18a_attach(f, &g->dev, IO_ADDR, 1)
+      || !startschedule(f, &g->dev, &g->input))
+    return discard(f, &g->dev);
+  return &g->dev;
+}
+
+
+// a uart, at 8n1. bytes from in arrive one frame apart, and each waits in a
+// one-byte buffer, where the next overwrites it if it hasn't been read. a
+// read returns the byte with bit 8 set if there is one (and takes it), and
+// bit 9 set while a byte is still being sent. a write sends a byte to out,
+// unless one is still being sent, in which case it's lost.
+typedef struct {
+  f18a_device dev;
+  tstamp_t frame; // picoseconds per byte, with start and stop bits
+  FILE *in;
+  FILE *out;
+  int rx; // -1 if empty
+  tstamp_t sent; // when the byte being sent is done
+} serial_t;
+
+static u32 serialread(f18a_device *dev, f18a *f, u32 addr) {
+  (void)addr;
+  serial_t *u = dev->data;
+  u32 val = f->time < u->sent ? 0x200 : 0;
+  if (u->rx >= 0) val |= 0x100 | u->rx;
+  u->rx = -1;
+  return val;
+}
+
+static void serialwrite(f18a_device *dev, f18a *f, u32 addr, u32 val) {
+  (void)addr;
+  serial_t *u = dev->data;
+  if (f->time < u->sent) return;
+  u->sent = f->time + u->frame;
+  if (u->out) {
+    fputc(val & 0xff, u->out);
+    fflush(u->out);
+  }
+}
+
+static void serialevent(f18a_device *dev, f18a *f, tstamp_t when, u64 arg) {
+  (void)arg;
+  serial_t *u = dev->data;
+  int c = fgetc(u->in);
+  if (c == EOF) return;
+  u->rx = c;
+  f18a_schedule(f, dev, when + u->frame, 0);
+}
+
+// in and out belong to the caller, and are left open
+static void serialfree(f18a_device *dev) {
+  free(dev->data);
+}
+
+f18a_device *f18a_serial(f18a *f, u32 addr, u32 baud, FILE *in, FILE *out) {
+  serial_t *u = baud ? calloc(1, sizeof(serial_t)) : NULL;
+  if (!u) {
+    f18a_hosterr(f->host, "unable to make a serial port\n");
+    return NULL;
+  }
+  u->dev = (f18a_device){.read = serialread, .write = serialwrite,
+    .event = serialevent, .free = serialfree, .data = u};
+  u->frame = 10 * 1000000000000ull / baud;
+  u->in = in;
+  u->out = out;
+  u->rx = -1;
+  if (!f18a_attach(f, &u->dev, addr, 1)
+      || (in && !f18a_schedule(f, &u->dev, f->time + u->frame, 0)))
+    return discard(f, &u->dev);
+  return &u->dev;
+}
+
+
+// an analog input, which reads as the value its schedule gives
+typedef struct {
+  f18a_device dev;
+  schedule_t input;
+} analog_t;
+
+static u32 analogread(f18a_device *dev, f18a *f, u32 addr) {
+  (void)f, (void)addr;
+  analog_t *a = dev->data;
+  return a->input.value;
+}
+
+static void analogevent(f18a_device *dev, f18a *f, tstamp_t when, u64 k) {
+  (void)when;
+  analog_t *a = dev->data;
+  step(f, dev, &a->input, k);
+}
+
+static void analogfree(f18a_device *dev) {
+  analog_t *a = dev->data;
+  freeschedule(&a->input);
+  free(a);
+}
+
+f18a_device *f18a_analog(f18a *f, u32 addr, int n, const tstamp_t *when,
+    const u32 *values) {
+  analog_t *a = calloc(1, sizeof(analog_t));
+  if (!a) {
+    f18a_hosterr(f->host, "unable to make an analog input\n");
+    return NULL;
+  }
+  a->dev = (f18a_device){.read = analogread, .event = analogevent,
+    .free = analogfree, .data = a};
+  if (!setschedule(&a->input, n, when, values)) {
+    f18a_hosterr(f->host, "unable to make an analog input\n");
+    return discard(f, &a->dev);
+  }
+  if (!f18a_attach(f, &a->dev, addr, 1)
+      || !startschedule(f, &a->dev, &a->input))
+    return discard(f, &a->dev);
+  return &a->dev;
+}
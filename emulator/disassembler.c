@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2013, Matt Hellige
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above copyright 
+ *   notice, this list of conditions and the following disclaimer in the 
+ *   documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT 
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// a disassembler for single instruction words, for listings (see profile.c)
+
+#include <stdio.h>
+
+#include "f18a.h"
+#include "opcodes.h"
+
+
+static const u32 dmasks[] = {0x3ff, 0xff, 0x7};
+
+
+// write the ops of word to out, which must hold DISASM_CHARS, as the word
+// would run with p just past the address it was fetched from. a jump is
+// followed by its destination, in hex, and nothing after a transfer that
+// always leaves the word is shown.
+void f18a_disassemble(u32 word, u32 p, char *out) {
+  decoded_t d;
+  // as if fetched from io, so that a jump to itself isn't taken for a halt
+  f18a_decode(&d, CACHE_SCRATCH, word);
+  char *o = out;
+  *o = '\0';
+  for (u8 slot = 0; slot < d.slots; slot++) {
+    u8 op = d.ops[slot];
+    o += sprintf(o, "%s%s", slot ? " " : "", opnames[op]);
+    if (slot < 3 && (op == OP_JUMP || op == OP_CALL || op == OP_NEXT
+          || op == OP_IF || op == OP_IFG)) {
+      // the rest of the word is the destination
+      sprintf(o, " %03x", (p & ~(dmasks[slot] | 0x100)) | d.dest[slot]);
+      return;
+    }
+  }
+}
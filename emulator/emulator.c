@@ -29,14 +29,21 @@
 #include <assert.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "f18a.h"
 #include "opcodes.h"
 
+#define RUN_SLICE 0x10000
 
-void f18a_init(f18a *f18a) {
-  f18a->p = BOOT_ADDR; // or multiport execute, depending on node config
+
+// a node as it comes out of reset. init takes no ownership of anything the
+// node held before, and frees none of it: a node that has run should be
+// given to f18a_release first.
+void f18a_init(f18a *f18a, f18a_host *host) {
+  f18a->p = BOOT_ADDR; // or MULTIPORT_ADDR, for a node booted by a stream
   f18a->slot = 4; // force instruction fetch on boot
   f18a->io = 0x15555;
   f18a->b = IO_ADDR;
@@ -45,35 +52,88 @@ void f18a_init(f18a *f18a) {
   // everything else is "not directly affected by reset," but we might as well
   // initialize it to something sensible.
   f18a->r = f18a->t = f18a->s = f18a->i = f18a->a = 0;
+  f18a->carry = false;
   for (int i = 0; i < STACK_WORDS; i++) f18a->stack[i] = 0;
   for (int i = 0; i < RSTACK_WORDS; i++) f18a->rstack[i] = 0;
   for (int i = 0; i < RAM_WORDS; i++) f18a->ram[i] = 0;
   for (int i = 0; i < ROM_WORDS; i++) f18a->rom[i] = 0;
+  for (int i = 0; i < 4; i++) f18a->ports[i] = NULL;
+  f18a->rports = f18a->wports = 0;
+  f18a->done = false;
+  f18a->pval = 0;
+  for (int i = 0; i < 4; i++) f18a->when[i] = 0;
+  f18a->time = 0;
+  f18a->cw = CACHE_SCRATCH;
+  f18a->jit = NULL;
+  f18a->prof = NULL;
+  f18a->tracer = NULL;
+  f18a->breaks = NULL;
+  f18a->iolog = NULL;
+  f18a->history = NULL;
+  f18a->host = host;
+  f18a_mapinit(f18a);
+  f18a_flushcache(f18a);
+}
+
+
+// free everything a node has picked up since f18a_init: translated code, any
+// profile, trace, breakpoints, history and io log, and its devices. the node
+// must be initialized again before it runs. returns false if the trace or io
+// log couldn't be finished.
+bool f18a_release(f18a *f18a) {
+  bool ok = f18a_traceclose(f18a);
+  ok = f18a_iologclose(f18a) && ok;
+  f18a_histoff(f18a);
+  f18a_mapfree(f18a);
+  f18a_jitfree(f18a);
+  free(f18a->prof);
+  f18a->prof = NULL;
+  free(f18a->breaks);
+  f18a->breaks = NULL;
+  return ok;
+}
+
+
+// a container holding a single node, as f18a-pack writes, boots from the
+// registers it gives. anything else is a flat image, as ffas writes.
+static bool loadcontainer(f18a *f18a, const char *image) {
+  struct image_t *img = f18a_openimage(f18a->host, image);
+  if (!img) return false;
+  int n = f18a_imagenodes(img);
+  bool ok = n == 1;
+  if (!ok)
+    f18a_hosterr(f18a->host, "image container '%s' holds %d nodes, not one\n",
+        image, n);
+  if (ok && (ok = f18a_materialize(f18a, img, 0)))
+    f18a_hostmsg(f18a->host, "loaded node %03d from %s\n",
+        f18a_imageid(img, 0), image);
+  f18a_closeimage(img);
+  return ok;
 }
 
 
 bool f18a_loadcore(f18a *f18a, const char *image) {
+  if (f18a_isimage(image)) return loadcontainer(f18a, image);
   FILE *img = fopen(image, "r");
   if (!img) {
-    f18a_exitmsg("error reading image '%s': %s\n", image, strerror(errno));
+    f18a_hosterr(f18a->host, "error reading image '%s': %s\n", image,
+        strerror(errno));
     return false;
   }
 
   int img_size = fread(f18a->ram, 4, RAM_WORDS, img);
+  if (!ferror(img)) img_size += fread(f18a->rom, 4, ROM_WORDS, img);
   if (ferror(img)) {
-    f18a_exitmsg("error reading image '%s': %s\n", image, strerror(errno));
-    return false;
-  }
-  img_size += fread(f18a->rom, 4, ROM_WORDS, img);
-  if (ferror(img)) {
-    f18a_exitmsg("error reading image '%s': %s\n", image, strerror(errno));
+    f18a_hosterr(f18a->host, "error reading image '%s': %s\n", image,
+        strerror(errno));
+    fclose(img);
     return false;
   }
 
   for (int i = 0; i < RAM_WORDS; i++) {
     f18a->ram[i] = ntohl(f18a->ram[i]);
     if (f18a->ram[i] & ~MAX_VAL) {
-      f18a_msg(
+      f18a_hostmsg(f18a->host,
           "ram word at 0x%02x (0x%08x) has high bits set! clipping to range!\n",
           i, f18a->ram[i]);
       f18a->ram[i] &= MAX_VAL;
@@ -82,57 +142,103 @@ bool f18a_loadcore(f18a *f18a, const char *image) {
   for (int i = 0; i < ROM_WORDS; i++) {
     f18a->rom[i] = ntohl(f18a->rom[i]);
     if (f18a->rom[i] & ~MAX_VAL) {
-      f18a_msg(
+      f18a_hostmsg(f18a->host,
           "rom word at 0x%02x (0x%08x) has high bits set! clipping to range!\n",
           i, f18a->rom[i]);
       f18a->rom[i] &= MAX_VAL;
     }
   }
 
-  f18a_msg("loaded image from %s: 0x%05x words\n", image, img_size);
+  f18a_flushcache(f18a);
+  f18a_hostmsg(f18a->host, "loaded image from %s: 0x%05x words\n", image,
+      img_size);
   fclose(img);
   return true;
 }
 
 
-bool f18a_present(u32 addr) {
-  addr &= ADDR_MASK;
-  if (addr < 0x100) return true;
+void f18a_flushcache(f18a *f18a) {
+  for (int i = 0; i <= CACHE_WORDS; i++) f18a->dcache[i].valid = false;
+  f18a_jitflush(f18a);
+}
 
-  if (addr == IO_ADDR) return true;
 
-  // TODO other io addresses...
-  return false;
+bool f18a_present(const f18a *f18a, u32 addr) {
+  u8 kind = f18a->map[addr & ADDR_MASK] & 0xf;
+  return kind == M_RAM || kind == M_ROM || kind == M_IO;
 }
 
 
+// the word at addr, without side effects
 u32 f18a_load(f18a *f18a, u32 addr) {
   addr &= ADDR_MASK;
-  if (addr < 0x080)
-    return f18a->ram[addr & 0x3f];
-  if (addr < 0x100)
-    return f18a->rom[addr & 0x3f];
+  switch (f18a->map[addr] & 0xf) {
+    case M_RAM: return f18a->ram[addr & 0x3f];
+    case M_ROM: return f18a->rom[addr & 0x3f];
+    case M_IO: return f18a->io;
+  }
+  return 0;
+}
 
-  if (addr == IO_ADDR) return f18a->io;
 
-  // TODO other io addresses...
-  return 0;
+// a port read or write completes only once a neighbour has taken part. until
+// then the node is blocked: the step is abandoned, to be retried after the
+// fabric has resolved the transfer and set done (see fabric.c).
+static bool portread(f18a *f18a, u8 ports, u32 *val) {
+  if (f18a->done) {
+    f18a->done = false;
+    *val = f18a->pval;
+    return true;
+  }
+  f18a->rports = ports;
+  return false;
 }
 
 
-static void store(f18a *f18a, u32 addr, u32 val) {
+static bool portwrite(f18a *f18a, u8 ports, u32 val) {
+  if (f18a->done) {
+    f18a->done = false;
+    return true;
+  }
+  f18a->wports = ports;
+  f18a->pval = val;
+  return false;
+}
+
+
+bool f18a_read(f18a *f18a, u32 addr, u32 *val) {
   addr &= ADDR_MASK;
-  if (addr < 0x080)
-    f18a->ram[addr & 0x3f] = val;
-  if (addr < 0x100) {
-    f18a_msg("attempt to write 0x%05x to rom address 0x%02x!\n", val, addr);
-    return;
+  u8 m = f18a->map[addr];
+  switch (m & 0xf) {
+    case M_RAM: *val = f18a->ram[addr & 0x3f]; return true;
+    case M_ROM: *val = f18a->rom[addr & 0x3f]; return true;
+    case M_IO: *val = f18a_ioread(f18a); return true;
+    case M_PORT: return portread(f18a, m >> 4, val);
+    case M_DEVICE: return f18a_devread(f18a, m >> 4, addr, val);
   }
+  *val = 0;
+  return true;
+}
 
-  // TODO is this right?
-  if (addr == IO_ADDR) f18a->io = val;
 
-  // TODO other io addresses...
+bool f18a_write(f18a *f18a, u32 addr, u32 val) {
+  addr &= ADDR_MASK;
+  u8 m = f18a->map[addr];
+  switch (m & 0xf) {
+    case M_RAM:
+      f18a->ram[addr & 0x3f] = val;
+      f18a->dcache[addr & 0x3f].valid = false;
+      if (f18a->jitted & (1ull << (addr & 0x3f))) f18a_jitflush(f18a);
+      return true;
+    case M_ROM:
+      f18a_hostmsg(f18a->host,
+          "attempt to write 0x%05x to rom address 0x%02x!\n", val, addr);
+      return true;
+    case M_IO: f18a_iowrite(f18a, val); return true;
+    case M_PORT: return portwrite(f18a, m >> 4, val);
+    case M_DEVICE: return f18a_devwrite(f18a, m >> 4, addr, val);
+  }
+  return true;
 }
 
 
@@ -141,14 +247,7 @@ static void inc(u32 *addr) {
   // however, it's not clear what we should do when bits higher than 10 are
   // set. so what i do is rather arbitrary, but i think it's quite plausible.
   
-  u32 a = *addr;
-
-  // do nothing at all for io range...
-  if (a & 0x100) return;
-
-  // else increment bottom 7 bits without carry...
-  u8 l7 = (a+1) & 0x7f;
-  *addr = (a & ~0x7f) | l7;
+  *addr = f18a_inc(*addr);
 }
 
 
@@ -177,6 +276,67 @@ u8 f18a_decode_op(f18a *f18a) {
 
 static const u32 dmasks[] = {0x3ff, 0xff, 0x7};
 
+static const struct {
+  u8 ops[2];
+  u8 loop;
+} pairs[] = {
+  {{OP_OVER, OP_ADD}, L_OVERADD},
+  {{OP_DUP, OP_ADD}, L_DUPADD},
+  {{OP_LVAI, OP_ADD}, L_SUM},
+  {{OP_DUP, OP_SVAI}, L_FILL},
+  {{OP_LVAI, OP_SVB}, L_MOVEA},
+  {{OP_LVB, OP_SVAI}, L_MOVEB},
+};
+
+// recognize a word that loops back with unext, or with a next that may turn
+// out to target the word itself, over a body f18a_bulk knows. nops in the
+// body don't matter, except to the step count.
+static void classify(decoded_t *d) {
+  u8 body[4];
+  int n = 0;
+  d->loop = L_NONE;
+  for (u8 slot = 0; slot < 4; slot++) {
+    u8 op = d->ops[slot];
+    if (op == OP_UNXT || op == OP_NEXT) {
+      d->pass = slot + 1;
+      d->reps = n;
+      if (!n) {
+        d->loop = L_DELAY;
+        return;
+      }
+      bool same = true;
+      for (int k = 1; k < n; k++) same &= body[k] == body[0];
+      if (same && body[0] == OP_SHL) d->loop = L_SHL;
+      if (same && body[0] == OP_SHR) d->loop = L_SHR;
+      if (same && body[0] == OP_INV) d->loop = L_INV;
+      if (same && body[0] == OP_MULS) d->loop = L_MULS;
+      for (u32 k = 0; n == 2 && k < sizeof(pairs) / sizeof(pairs[0]); k++)
+        if (body[0] == pairs[k].ops[0] && body[1] == pairs[k].ops[1])
+          d->loop = pairs[k].loop;
+      // a next refetches the word each pass, and a store may change it
+      if (op == OP_NEXT && d->loop >= L_FILL) d->loop = L_NONE;
+      return;
+    }
+    if (op != OP_NOP) body[n++] = op;
+  }
+}
+
+
+static void decode(decoded_t *d, u32 i) {
+  u32 word = i ^ OP_XOR_MASK;
+  d->word = i;
+  d->slots = 4;
+  for (u8 slot = 0; slot < 4; slot++) {
+    u8 op = ((word >> rshifts[slot]) & masks[slot]) << lshifts[slot];
+    d->ops[slot] = op;
+    if (slot < 3) d->dest[slot] = i & dmasks[slot];
+    // ;, ex, jump and call always leave the word
+    if (op <= OP_CALL && d->slots == 4) d->slots = slot + 1;
+  }
+  classify(d);
+}
+
+
 static void jump(f18a *f) {
   // slot has already been incremented... correct it.
   u8 slot = f->slot - 1;
@@ -187,20 +347,85 @@ static void jump(f18a *f) {
   // we can always safely force p8 to 0. either it's a slot 1/2 jump,
   // in which case it should be forced, or it's a slot 0 jump, in which
   // case it'll be overwritten anyway.
-  f->p &= ~0x100;
-  u32 dest = f->i & dmasks[slot];
-  f->p = (f->p & ~dmasks[slot]) | dest;
+  f->p = (f->p & ~(dmasks[slot] | 0x100)) | f->dcache[f->cw].dest[slot];
 
   // and we're done with this instruction word...
   skip(f);
 }
 
 
-static void next(f18a *f18a) {
+// decode word i as fetched into cache entry cw. the entry is left invalid.
+void f18a_decode(decoded_t *d, u8 cw, u32 i) {
+  decode(d, i);
+  d->valid = false;
+
+  // a word that starts by jumping to itself will never do anything else...
+  if (cw != CACHE_SCRATCH && d->ops[0] == OP_JUMP
+      && CACHE_INDEX(d->dest[0]) == cw)
+    d->ops[0] = OP_HALT;
+}
+
+
+// a word fetched from a comm port isn't there to load until a neighbour
+// writes it, so fetching one decodes to a single OP_PFETCH, which reads the
+// port and puts the word it gets in its own place (see portfetch).
+static void pfetch(decoded_t *d) {
+  d->word = I_PORTFETCH;
+  d->slots = 1;
+  for (u8 slot = 0; slot < 4; slot++) d->ops[slot] = OP_NOP;
+  d->ops[0] = OP_PFETCH;
+  d->loop = L_NONE;
+  d->valid = false;
+}
+
+
+void f18a_fill(f18a *f18a, u8 cw) {
+  decoded_t *d = &f18a->dcache[cw];
+  u32 addr = f18a->p;
+  if ((f18a->map[addr & ADDR_MASK] & 0xf) == M_PORT) {
+    f18a->i = I_PORTFETCH;
+    pfetch(d);
+    return;
+  }
+  f18a->i = loadinc(f18a, &f18a->p);
+  f18a_decode(d, cw, f18a->i);
+  if (f18a->breaks) f18a_mark(f18a, d, addr);
+  d->valid = cw != CACHE_SCRATCH;
+}
+
+
+// rebuild the decode cache around the word in i, after the state of a node
+// has been set from outside (see batch.c, breaks.c and snapshot.c).
+void f18a_latch(f18a *f18a) {
+  f18a_flushcache(f18a);
+  if (f18a->slot > 3) return;
+  decoded_t *d = &f18a->dcache[f18a->cw];
+  if (f18a->i == I_PORTFETCH) {
+    pfetch(d);
+    return;
+  }
+  f18a_decode(d, f18a->cw, f18a->i);
+  // stores since the fetch would have invalidated the entry...
+  u32 addr = ((f18a->cw & 0x40) << 1) | (f18a->cw & 0x3f);
+  if (f18a->breaks)
+    f18a_mark(f18a, d, f18a->cw == CACHE_SCRATCH ? f18a->p : addr);
+  d->valid = f18a->cw != CACHE_SCRATCH && f18a_load(f18a, addr) == f18a->i;
+}
+
+
+static inline void next(f18a *f18a) {
   if (f18a->slot > 3) {
-    // fetch next instruction word
-    f18a->i = loadinc(f18a, &f18a->p);
+    // fetch next instruction word, decoding it unless it's already cached
+    u8 cw = CACHE_INDEX(f18a->p);
+    if (f18a->dcache[cw].valid) {
+      f18a->i = f18a->dcache[cw].word;
+      inc(&f18a->p);
+    } else {
+      f18a_fill(f18a, cw);
+    }
+    f18a->cw = cw;
     f18a->slot = 0;
+    f18a->time += T_FETCH;
   }
 }
 
@@ -245,6 +470,38 @@ static u32 popr(f18a *f) {
 }
 
 
+static bool pushload(f18a *f, u32 addr) {
+  u32 val;
+  if (!f18a_read(f, addr, &val)) return false;
+  push(f, val);
+  return true;
+}
+
+
+static bool popstore(f18a *f, u32 addr) {
+  if (!f18a_write(f, addr, f->t)) return false;
+  pop(f);
+  return true;
+}
+
+
+static action_t trap(f18a *f);
+
+// the word from the port runs in place of the fetch, from slot 0, without
+// being charged for a second fetch. a node that has to wait for its word
+// blocks at slot 0, so retrying the step reads the port again.
+static action_t portfetch(f18a *f) {
+  u32 val;
+  if (!f18a_read(f, f->p, &val)) return A_BLOCK;
+  decoded_t *d = &f->dcache[CACHE_SCRATCH];
+  f->i = val & MAX_VAL;
+  f18a_decode(d, CACHE_SCRATCH, f->i);
+  if (f->breaks) f18a_mark(f, d, f->p);
+  f->cw = CACHE_SCRATCH;
+  f->slot = 0;
+  return A_CONTINUE;
+}
+
 static action_t execute(f18a *f, u8 op) {
   switch (op) {
     case OP_RET: f->p = f->r & MAX_P; popr(f); skip(f); break;
@@ -257,21 +514,25 @@ static action_t execute(f18a *f, u8 op) {
                     else { popr(f); skip(f); } break;
     case OP_IF: if (f->t) skip(f); else jump(f); break;
     case OP_IFG: if (f->t & 0x20000) skip(f); else jump(f); break;
-    case OP_LVPI: push(f, loadinc(f, &f->p)); break;
-    case OP_LVAI: push(f, loadinc(f, &f->a)); break;
-    case OP_LVB: push(f, f18a_load(f, f->b)); break;
-    case OP_LVA: push(f, f18a_load(f, f->a)); break;
-    case OP_SVPI: store(f, f->p, pop(f)); inc(&f->p); break;
-    case OP_SVAI: store(f, f->a, pop(f)); inc(&f->a); break;
-    case OP_SVB: store(f, f->b, pop(f)); break;
-    case OP_SVA: store(f, f->a, pop(f)); break;
-    case OP_MULS: /* TODO */ break;
+    case OP_LVPI: if (!pushload(f, f->p)) return A_BLOCK; inc(&f->p); break;
+    case OP_LVAI: if (!pushload(f, f->a)) return A_BLOCK; inc(&f->a); break;
+    case OP_LVB: if (!pushload(f, f->b)) return A_BLOCK; break;
+    case OP_LVA: if (!pushload(f, f->a)) return A_BLOCK; break;
+    case OP_SVPI: if (!popstore(f, f->p)) return A_BLOCK; inc(&f->p); break;
+    case OP_SVAI: if (!popstore(f, f->a)) return A_BLOCK; inc(&f->a); break;
+    case OP_SVB: if (!popstore(f, f->b)) return A_BLOCK; break;
+    case OP_SVA: if (!popstore(f, f->a)) return A_BLOCK; break;
+    case OP_MULS:
+      f18a_muls(&f->t, f->s, &f->a, f->p & P9 ? &f->carry : NULL);
+      break;
     case OP_SHL: f->t <<= 1; break;
     // implementation-defined, correct on gcc/x86
     case OP_SHR: f->t = ((int32_t)f->t) >> 1; break;
     case OP_INV: f->t = ~f->t; break;
-    // TODO add with carry in case of p9
-    case OP_ADD: f->t += pops(f); break;
+    case OP_ADD:
+      if (f->p & P9) f->t = f18a_addc(f->t, pops(f), &f->carry);
+      else f->t += pops(f);
+      break;
     // spec says "boolean" but surely means "bitwise"
     case OP_AND: f->t = f->t & pops(f); break;
     case OP_OR: f->t = f->t ^ pops(f); break;
@@ -284,38 +545,231 @@ static action_t execute(f18a *f, u8 op) {
     case OP_PUSH: pushr(f, pop(f)); break;
     case OP_SB: f->b = pop(f) & MAX_B; break;
     case OP_SA: f->a = pop(f); break;
+    case OP_HALT: return A_HALT;
+    case OP_TRAP: return trap(f);
+    case OP_PFETCH: return portfetch(f);
   }
 
   return A_CONTINUE; // TODO make some use of this or refactor it all away...
 }
 
 
+// run the op a trap stands for, unless a point stops the node first. the
+// trap itself costs nothing, so the op is charged here.
+static action_t trap(f18a *f) {
+  u8 slot = f->slot - 1;
+  u8 op = f18a_untrap(f, f->cw, slot);
+  if (f18a_hits(f, op, slot)) return A_BREAK;
+  action_t result = execute(f, op);
+  if (result == A_CONTINUE) f->time += optimes[op];
+  return result;
+}
+
+
 action_t f18a_step(f18a *f18a) {
-  u8 op = f18a_decode_op(f18a);
+  u8 op = f18a->dcache[f18a->cw].ops[f18a->slot];
   // increment must occur prior to execute, so ops can reset slot as needed
   f18a->slot++;
   action_t result = execute(f18a, op);
+  if (result != A_CONTINUE) {
+    // ...and be undone if the step didn't happen after all.
+    f18a->slot--;
+    return result;
+  }
+  f18a->time += optimes[op];
   next(f18a);
   return result;
 }
 
 
-void f18a_run(f18a *f18a, bool debugboot) {
-  bool running = true;
+action_t f18a_stepn(f18a *f18a, u64 *budget) {
+  action_t result = A_CONTINUE;
+  u64 n = *budget;
+  next(f18a);
+  while (n) {
+    result = f18a_step(f18a);
+    if (result != A_CONTINUE) break;
+    n--;
+    if (f18a->slot == 0) n -= f18a_bulk(f18a, &f18a->dcache[f18a->cw], n);
+  }
+  *budget = n;
+  return result;
+}
+
+
+// p and a wrap within their bottom 7 bits, so 128 increments are a cycle
+static u32 advance(u32 addr, u64 count) {
+  return (addr & ~0x7f) | ((addr + count) & 0x7f);
+}
+
+
+static void fill(f18a *f, u32 addr, u64 count, u32 val) {
+  if (count > 0x80) count = 0x80;
+  for (u32 i = 0; i < count; i++) f18a_write(f, advance(addr, i), val);
+}
+
+
+static bool small(u32 v) {
+  return ((v + 0x10000) & MAX_VAL) < 0x20000;
+}
+
+
+// n +* steps at once. up to 18 of them, a's low bits say which add s, and
+// the adds land too high to change those bits on the way, so t:a ends up as
+// (t:a + s * a) >> n, with a cut to n bits. that holds as long as no add
+// overflows, which it can't while t and s both fit in 17 bits, signed. t
+// stays that small, so once s is, it's 18 steps at a time from there.
+static void mulsteps(f18a *f, u64 n) {
+  u32 t = f->t & MAX_VAL, s = f->s & MAX_VAL, a = f->a & MAX_VAL;
+  for (; n && !(small(t) && small(s)); n--) f18a_muls(&t, s, &a, NULL);
+  int64_t ss = ((int32_t)(s << 14)) >> 14;
+  for (u32 k; n; n -= k) {
+    k = n < 18 ? n : 18;
+    int64_t ts = ((int32_t)(t << 14)) >> 14;
+    // implementation-defined, correct on gcc/x86
+    int64_t x = (ts * 0x40000 + a + ss * (a & ((1u << k) - 1)) * 0x40000)
+      >> k;
+    a = x & MAX_VAL;
+    t = (x >> 18) & MAX_VAL;
+  }
+  f->t = t;
+  f->a = a;
+}
+
+
+// run as many whole passes of a micro-loop as the budget and r allow, given
+// that d is the word at slot 0, leaving exactly the state those passes would
+// have. each pass must see a non-zero r at the unext or next to loop back, so
+// there can be up to r of them. returns the steps taken, which may be none if the
+// loop's addresses aren't plain memory.
+u64 f18a_bulk(f18a *f, const decoded_t *d, u64 budget) {
+  if (!d->loop || !f->r) return 0;
+  if (d->ops[d->pass - 1] == OP_NEXT) {
+    // a next must jump back to the word itself, unchanged in memory, and so
+    // to the same p after the fetch
+    u8 slot = d->pass - 1;
+    u32 dest = (f->p & ~(dmasks[slot] | 0x100)) | d->dest[slot];
+    if (f18a_inc(dest) != f->p || f18a_load(f, dest) != d->word) return 0;
+  }
+  // extended arithmetic carries from one add to the next
+  if ((f->p & P9) && (d->loop == L_MULS || d->loop == L_OVERADD
+        || d->loop == L_DUPADD || d->loop == L_SUM)) return 0;
+  u64 passes = budget / d->pass;
+  if (passes > f->r) passes = f->r;
+  if (!passes) return 0;
+  // a next fetches the word again on every pass
+  tstamp_t pass = d->ops[d->pass - 1] == OP_NEXT ? T_FETCH : 0;
+  for (int slot = 0; slot < d->pass; slot++) pass += optimes[d->ops[slot]];
+
+  u64 shift = passes * d->reps;
+  switch (d->loop) {
+    case L_DELAY:
+      break;
+    case L_SHL:
+      f->t = shift >= 32 ? 0 : f->t << shift;
+      break;
+    case L_SHR:
+      // implementation-defined, correct on gcc/x86
+      f->t = ((int32_t)f->t) >> (shift >= 31 ? 31 : shift);
+      break;
+    case L_INV:
+      if (shift & 1) f->t = ~f->t;
+      break;
+    case L_MULS:
+      mulsteps(f, shift);
+      break;
+    case L_OVERADD:
+      f->t += (u32)passes * f->s;
+      break;
+    case L_DUPADD:
+      f->t = passes >= 32 ? 0 : f->t << passes;
+      break;
+    case L_SUM: {
+      if (f->a & 0x100) return 0;
+      u32 cycle = 0, rest = 0;
+      for (u32 i = 0; i < 0x80; i++) {
+        u32 val = f18a_load(f, advance(f->a, i));
+        cycle += val;
+        if (i < passes % 0x80) rest += val;
+      }
+      f->t += (u32)(passes / 0x80) * cycle + rest;
+      f->a = advance(f->a, passes);
+      break;
+    }
+    case L_FILL:
+      if (f->a & 0x180) return 0;
+      fill(f, f->a, passes, f->t);
+      f->a = advance(f->a, passes);
+      break;
+    case L_MOVEA:
+      if ((f->a & 0x100) || (f->b & 0x180)) return 0;
+      // only b is written, and no two passes in a row read it, so the last
+      // two passes decide what it ends up holding
+      for (u64 i = passes < 2 ? 0 : passes - 2; i < passes; i++)
+        f18a_write(f, f->b, f18a_load(f, advance(f->a, i)));
+      f->a = advance(f->a, passes);
+      break;
+    case L_MOVEB:
+      if ((f->b & 0x100) || (f->a & 0x180)) return 0;
+      // if a passes over b, it writes back what it read, so b never changes
+      fill(f, f->a, passes, f18a_load(f, f->b));
+      f->a = advance(f->a, passes);
+      break;
+  }
+
+  // every loop with a push and a pop per pass leaves s in the slot above sp
+  if (d->loop >= L_OVERADD)
+    f->stack[(f->sp + 1) % STACK_WORDS] = f->s;
+  f->r -= passes;
+  f->time += passes * pass;
+  return passes * d->pass;
+}
+
+
+static double elapsed(struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+
+// the part of budget that can safely be run without passing the deadline (a
+// zero deadline means none): at least one step while there's any time left,
+// so a run stops at the first step that reaches it.
+u64 f18a_until(const f18a *f18a, tstamp_t deadline, u64 budget) {
+  if (!deadline) return budget;
+  if (f18a->time >= deadline) return 0;
+  u64 safe = (deadline - f18a->time) / T_STEP_MAX;
+  if (!safe) safe = 1;
+  return safe < budget ? safe : budget;
+}
+
+
+stop_t f18a_runheadless(f18a *f18a, engine_t engine, u64 max_steps,
+    double max_secs, tstamp_t deadline, u64 *steps) {
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  *steps = 0;
   next(f18a);
-  if (debugboot) running = f18a_debug(f18a);
-  f18a_msg("running...\n");
-  f18a_runterm();
-  while (running && !f18a_die) {
-    action_t action = f18a_step(f18a);
-    if (action == A_EXIT) running = false;
-    if (action == A_BREAK || f18a_break) {
-      f18a_break = false;
-      f18a_dbgterm();
-      running = f18a_debug(f18a);
-      if (running) f18a_msg("running...\n");
-      f18a_runterm();
+  for (;;) {
+    if (f18a_stopped(f18a->host)) return S_BREAK;
+
+    // a zero limit means no limit...
+    u64 slice = RUN_SLICE;
+    if (max_steps) {
+      if (*steps == max_steps) return S_BUDGET;
+      if (max_steps - *steps < slice) slice = max_steps - *steps;
     }
+    slice = f18a_until(f18a, deadline, slice);
+    if (!slice) return S_DEADLINE;
+
+    u64 budget = slice;
+    action_t action = engine(f18a, &budget);
+    *steps += slice - budget;
+    // a lone node has no neighbours to unblock it...
+    if (action == A_HALT || action == A_BLOCK || action == A_EXIT)
+      return S_HALT;
+    if (action == A_BREAK) return S_BREAK;
+    if (max_secs > 0 && elapsed(&start) >= max_secs) return S_TIMEOUT;
   }
-  f18a_dbgterm();
 }
@@ -33,32 +33,103 @@
 #include <stdlib.h>
 #include <string.h>
 #include <termios.h>
+#include <time.h>
 
 #include "f18a.h"
 #include "opcodes.h"
 
-volatile bool f18a_break = false;
-volatile bool f18a_die = false;
 static struct termios old_termios;
 
 static void usage(char **argv) {
   fprintf(stderr, "usage: %s [options] <image>\n", argv[0]);
+  fprintf(stderr, "       %s --headless [options] --node <yxx>=<image> ...\n",
+      argv[0]);
+  fprintf(stderr, "       %s --headless [options] --image <container> ...\n",
+      argv[0]);
+  fprintf(stderr, "       %s --headless [options] --boot [<yxx>=]<stream>\n",
+      argv[0]);
+  fprintf(stderr, "       %s --headless [options] --resume <snapshot>\n",
+      argv[0]);
   fprintf(stderr, "   -h, --help           display this message\n");
   fprintf(stderr, "   -v, --version        display the version and exit\n");
   fprintf(stderr, "   -d, --debug-boot     enter debugger on boot\n");
+  fprintf(stderr, "   -e, --engine <name>  execution engine: switch (default), "
+      "threaded or jit\n");
+  fprintf(stderr, "   -D, --device <spec>  attach a device to the node; "
+      "repeatable. spec is one of\n"
+      "                        gpio:<bit>[:<ns>=<level>...],\n"
+      "                        analog:<addr>[:<ns>=<value>...] or\n"
+      "                        serial:<addr>:<baud>[:<in>[:<out>]], "
+      "with addr in hex\n"
+      "                        and - for no file\n");
+  fprintf(stderr, "   -k, --history <n>    keep a history for the debugger to "
+      "step back through,\n"
+      "                        with a checkpoint every n steps; n:mb to bound "
+      "it to mb\n"
+      "                        megabytes (default %d)\n", HISTORY_MB);
+  fprintf(stderr, "   -H, --headless       run without a terminal, then dump "
+      "state as json\n");
+  fprintf(stderr, "headless options:\n");
+  fprintf(stderr, "   -n, --max-steps <n>  stop after n steps\n");
+  fprintf(stderr, "   -t, --time-limit <s> stop after s seconds\n");
+  fprintf(stderr, "   -T, --sim-time <ns>  stop once a node has run for ns "
+      "simulated nanoseconds\n");
+  fprintf(stderr, "   -l, --log <file>     write messages to file, not stdout\n");
+  fprintf(stderr, "   -o, --dump <file>    write final state to file, not "
+      "stdout\n");
+  fprintf(stderr, "   -N, --node <id=img>  load img into node id (yxx) of a "
+      "fabric; repeatable\n");
+  fprintf(stderr, "   -I, --image <f>      load every node in image container "
+      "f (see f18a-pack)\n"
+      "                        into a fabric, each when it first runs\n");
+  fprintf(stderr, "   -b, --boot <id=f>    boot a whole fabric, as the chip "
+      "boots, from the stream\n"
+      "                        of boot frames in f (see f18a-pack), fed "
+      "through node id\n"
+      "                        (yxx; %03d if just f is given)\n", BOOT_NODE);
+  fprintf(stderr, "   -E, --epoch <n>      fabric steps per node between port "
+      "transfers\n");
+  fprintf(stderr, "   -j, --threads <n>    run a fabric on n threads; results "
+      "don't depend on n\n");
+  fprintf(stderr, "   -S, --snapshot <f>   save the final state to f\n");
+  fprintf(stderr, "   -R, --resume <f>     start from snapshot f, of a node "
+      "or a fabric, not\n"
+      "                        an image\n");
+  fprintf(stderr, "   -p, --profile        count every step, and list the "
+      "counts to the log\n"
+      "                        when done (always on the switch engine)\n");
+  fprintf(stderr, "   -C, --callgrind <f>  profile, and write the profile to f "
+      "in callgrind format\n");
+  fprintf(stderr, "   -x, --trace <f>      write every step to f, in binary; "
+      "see f18a-trace\n"
+      "                        (always on the switch engine)\n");
+  fprintf(stderr, "   -r, --record <f>     write every value the node reads "
+      "from outside itself\n"
+      "                        (the io register, when driven, and devices) "
+      "to f\n");
+  fprintf(stderr, "   -P, --replay <f>     feed the node the values recorded "
+      "in f, in place of\n"
+      "                        its inputs\n");
+  fprintf(stderr, "   -B, --batch <file>   run the image once per line of file, "
+      "in lockstep,\n"
+      "                        with the numbers on the line pushed on the "
+      "stack\n");
+  fprintf(stderr, "headless exit status: 0 halted, 2 step limit, "
+      "3 time limit, 4 break,\n"
+      "                      5 simulated time limit\n");
 } 
 
 static void int_handler(int signum) {
   (void)signum;
-  f18a_break = true;
+  f18a_termhost.interrupt = true;
 }
 
 static void quit_handler(int signum) {
   (void)signum;
-  f18a_die = true;
+  f18a_termhost.quit = true;
 }
 
-static void block_signals() {
+static void catch_signals() {
   struct sigaction sa;
   sa.sa_handler = int_handler;
   sigemptyset(&sa.sa_mask);
@@ -73,6 +144,10 @@ static void block_signals() {
     fprintf(stderr, "error setting signal handler: %s\n", strerror(errno));
     fprintf(stderr, "continuing without signal support...");
   }
+}
+
+static void block_signals() {
+  catch_signals();
 
   struct termios new_termios;
   tcgetattr(0, &old_termios);
@@ -81,8 +156,404 @@ static void block_signals() {
   tcsetattr(0, TCSANOW, &new_termios);
 }
 
+#define MAX_DEVSPECS 16
+#define MAX_CHANGES 64
+
+// a device to attach (see devices.c)
+typedef struct {
+  char kind; // g, a or s
+  u32 addr; // or bit, for gpio
+  u32 baud;
+  const char *in;
+  const char *out;
+  int n;
+  tstamp_t when[MAX_CHANGES];
+  u32 values[MAX_CHANGES];
+} devspec;
+
+// options for a headless run...
+typedef struct {
+  engine_t engine;
+  u64 max_steps;
+  double max_secs;
+  tstamp_t deadline; // simulated, in picoseconds
+  const char *logpath;
+  const char *dumppath;
+  u64 epoch;
+  int threads;
+  const char *inputs; // for a batch run
+  const char *snapshot; // to save when done
+  const char *resume; // to start from
+  bool profile;
+  const char *callgrind; // to write the profile to
+  const char *trace; // to write every step to
+  const char *record; // to write the node's inputs to
+  const char *replay; // to read them from
+  u64 history; // steps between checkpoints, if the debugger keeps a history
+  u64 historymb;
+  int nodes; // non-zero for a fabric run, as is container
+  const char *container;
+  const char *boot; // boot stream for a fabric
+  int bootnode; // fed the stream
+  int ids[FABRIC_NODES];
+  const char *images[FABRIC_NODES];
+  int ndevices;
+  devspec devices[MAX_DEVSPECS];
+} options;
+
+static const char *stops[] = {
+  [S_HALT] = "halt",
+  [S_BUDGET] = "budget",
+  [S_TIMEOUT] = "timeout",
+  [S_BREAK] = "break",
+  [S_DEADLINE] = "deadline"
+};
+
+static FILE *openout(const char *path) {
+  if (!path) return stdout;
+  FILE *out = fopen(path, "w");
+  if (!out) fprintf(stderr, "error opening '%s': %s\n", path, strerror(errno));
+  return out;
+}
+
+// write the profiles of the given nodes, named as they are
+static bool profiles(f18a **nodes, const char **names, int n, options *opts) {
+  if (!opts->profile) return true;
+  for (int i = 0; i < n; i++) f18a_listing(nodes[i], names[i]);
+  if (!opts->callgrind) return true;
+  FILE *out = fopen(opts->callgrind, "w");
+  if (!out) {
+    f18a_exitmsg("error writing '%s': %s\n", opts->callgrind, strerror(errno));
+    return false;
+  }
+  f18a_callgrindhead(out);
+  for (int i = 0; i < n; i++) f18a_callgrind(nodes[i], names[i], out);
+  fclose(out);
+  return true;
+}
+
+static FILE *openfile(const char *path, const char *mode) {
+  if (!path) return NULL;
+  FILE *file = fopen(path, mode);
+  if (!file)
+    f18a_exitmsg("error opening '%s': %s\n", path, strerror(errno));
+  return file;
+}
+
+static bool attach(f18a *f18a, options *opts) {
+  for (int i = 0; i < opts->ndevices; i++) {
+    devspec *d = &opts->devices[i];
+    f18a_device *dev = NULL;
+    if (d->kind == 'g') {
+      dev = f18a_gpio(f18a, d->addr, d->n, d->when, d->values);
+    } else if (d->kind == 'a') {
+      dev = f18a_analog(f18a, d->addr, d->n, d->when, d->values);
+    } else {
+      FILE *in = openfile(d->in, "r");
+      FILE *out = openfile(d->out, "w");
+      if ((d->in && !in) || (d->out && !out)) return false;
+      dev = f18a_serial(f18a, d->addr, d->baud, in, out);
+    }
+    if (!dev) return false;
+  }
+  return true;
+}
+
+static bool load(f18a *f18a, const char *image, options *opts) {
+  if (opts->resume) {
+    if (!f18a_restore(f18a, opts->resume)) return false;
+  } else if (!f18a_loadcore(f18a, image)) {
+    return false;
+  }
+  return attach(f18a, opts);
+}
+
+
+static int headless(f18a *f18a, const char *image, options *opts) {
+  FILE *log = openout(opts->logpath);
+  FILE *dump = openout(opts->dumppath);
+  if (!log || !dump) return 1;
+
+  // no terminal changes at all, but ctrl-c still stops the run...
+  catch_signals();
+  f18a_init(f18a, &f18a_termhost);
+  f18a_initlog(log);
+  if (!load(f18a, image, opts)) return 1;
+  if (opts->trace && !f18a_traceopen(f18a, opts->trace)) return 1;
+  if (opts->record && !f18a_record(f18a, opts->record)) return 1;
+  if (opts->replay && !f18a_replay(f18a, opts->replay)) return 1;
+
+  u64 steps;
+  stop_t stop = f18a_runheadless(f18a, opts->engine, opts->max_steps,
+      opts->max_secs, opts->deadline, &steps);
+  if (!f18a_traceclose(f18a)) return 1;
+  if (!f18a_iologclose(f18a)) return 1;
+  if (opts->snapshot && !f18a_save(f18a, opts->snapshot)) return 1;
+  const char *name = image ? image : opts->resume;
+  if (!profiles(&f18a, &name, 1, opts)) return 1;
+  f18a_killterm();
+
+  fprintf(dump, "{\"status\": \"%s\", \"steps\": %llu, \"node\": ",
+      stops[stop], (unsigned long long)steps);
+  f18a_dumpjson(f18a, dump);
+  fprintf(dump, "}\n");
+  fflush(dump);
+  return stop;
+}
+
+static int headlessfabric(options *opts) {
+  static fabric fab;
+
+  FILE *log = openout(opts->logpath);
+  FILE *dump = openout(opts->dumppath);
+  if (!log || !dump) return 1;
+
+  catch_signals();
+  f18a_initlog(log);
+  fabric_init(&fab, &f18a_termhost);
+  if (opts->resume && !fabric_restore(&fab, opts->resume)) return 1;
+  if (opts->container && !fabric_loadimage(&fab, opts->container)) return 1;
+  if (opts->epoch) fab.epoch = opts->epoch;
+  if (opts->threads) fab.threads = opts->threads;
+  fab.deadline = opts->deadline;
+  for (int i = 0; i < opts->nodes; i++)
+    if (!fabric_load(&fab, opts->ids[i], opts->images[i])) return 1;
+  if (opts->boot && !fabric_boot(&fab, opts->boot, opts->bootnode)) return 1;
+
+  u64 steps;
+  stop_t stop = fabric_runheadless(&fab, opts->engine, opts->max_steps,
+      opts->max_secs, &steps);
+  if (!fabric_settle(&fab)) return 1;
+  if (opts->snapshot && !fabric_save(&fab, opts->snapshot)) return 1;
+  static f18a *nodes[FABRIC_NODES];
+  static char ids[FABRIC_NODES][4];
+  static const char *names[FABRIC_NODES];
+  int n = 0;
+  for (int i = 0; i < FABRIC_NODES; i++) {
+    if (fab.state[i] == N_OFF) continue;
+    snprintf(ids[n], sizeof(ids[n]), "%03d", fabric_id(i));
+    nodes[n] = &fab.nodes[i];
+    names[n] = ids[n];
+    n++;
+  }
+  if (!profiles(nodes, names, n, opts)) return 1;
+  f18a_killterm();
+
+  fprintf(dump, "{\"status\": \"%s\", \"steps\": %llu, \"nodes\": {",
+      stops[stop], (unsigned long long)steps);
+  bool first = true;
+  for (int i = 0; i < FABRIC_NODES; i++) {
+    if (fab.state[i] == N_OFF) continue;
+    fprintf(dump, "%s\"%03d\": ", first ? "" : ", ", fabric_id(i));
+    f18a_dumpjson(&fab.nodes[i], dump);
+    first = false;
+  }
+  fprintf(dump, "}}\n");
+  fflush(dump);
+  return stop;
+}
+
+// one instance per line of the inputs, each a list of numbers to push...
+static f18a *readbatch(const f18a *proto, const char *path, int *n) {
+  FILE *in = fopen(path, "r");
+  if (!in) {
+    fprintf(stderr, "error opening '%s': %s\n", path, strerror(errno));
+    return NULL;
+  }
+  f18a *nodes = NULL;
+  int size = 0, line = 0;
+  char buf[4096];
+  *n = 0;
+  while (fgets(buf, sizeof(buf), in)) {
+    line++;
+    char *pos = buf;
+    while (isspace(*pos)) pos++;
+    if (!*pos || *pos == '#') continue;
+    if (*n == size) {
+      size = size ? 2 * size : 64;
+      f18a *more = realloc(nodes, size * sizeof(f18a));
+      if (!more) {
+        fprintf(stderr, "too many batch inputs\n");
+        free(nodes);
+        fclose(in);
+        return NULL;
+      }
+      nodes = more;
+    }
+    f18a *f = &nodes[(*n)++];
+    *f = *proto;
+    while (*pos) {
+      char *endptr;
+      unsigned long val = strtoul(pos, &endptr, 0);
+      if (endptr == pos || val > MAX_VAL) {
+        fprintf(stderr, "%s:%d: bad input: %s", path, line, pos);
+        free(nodes);
+        fclose(in);
+        return NULL;
+      }
+      f->sp = (f->sp + 1) % STACK_WORDS;
+      f->stack[f->sp] = f->s;
+      f->s = f->t;
+      f->t = val;
+      pos = endptr;
+      while (isspace(*pos)) pos++;
+    }
+  }
+  fclose(in);
+  if (!*n) fprintf(stderr, "no inputs in '%s'\n", path);
+  return nodes;
+}
+
+
+static int headlessbatch(const char *image, options *opts) {
+  static f18a proto;
+
+  FILE *log = openout(opts->logpath);
+  FILE *dump = openout(opts->dumppath);
+  if (!log || !dump) return 1;
+
+  catch_signals();
+  f18a_init(&proto, &f18a_termhost);
+  f18a_initlog(log);
+  if (!load(&proto, image, opts)) return 1;
+  int n;
+  f18a *nodes = readbatch(&proto, opts->inputs, &n);
+  if (!nodes || !n) return 1;
+  stop_t *why = malloc(n * sizeof(stop_t));
+  u64 *steps = malloc(n * sizeof(u64));
+  if (!why || !steps) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  stop_t stop = f18a_batch(nodes, n, opts->engine, opts->max_steps,
+      opts->max_secs, opts->deadline, why, steps);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  u64 total = 0;
+  for (int i = 0; i < n; i++) total += steps[i];
+  double rate = secs > 0 ? total / secs : 0;
+  f18a_msg("ran %d instances for %llu instructions in %.3fs: "
+      "%.0f instance-instructions/s\n",
+      n, (unsigned long long)total, secs, rate);
+  f18a_killterm();
+
+  fprintf(dump, "{\"status\": \"%s\", \"steps\": %llu, \"seconds\": %.6f, "
+      "\"rate\": %.0f, \"instances\": [", stops[stop],
+      (unsigned long long)total, secs, rate);
+  for (int i = 0; i < n; i++) {
+    fprintf(dump, "%s{\"status\": \"%s\", \"steps\": %llu, \"node\": ",
+        i ? ", " : "", stops[why[i]], (unsigned long long)steps[i]);
+    f18a_dumpjson(&nodes[i], dump);
+    fprintf(dump, "}");
+  }
+  fprintf(dump, "]}\n");
+  fflush(dump);
+  return stop;
+}
+
+
+static bool parsenode(char *spec, options *opts) {
+  char *endptr;
+  long id = strtol(spec, &endptr, 10);
+  if (endptr == spec || *endptr != '=' || fabric_index(id) < 0) {
+    fprintf(stderr, "bad node: %s (expected yxx=image, e.g. 708=a.img)\n",
+        spec);
+    return false;
+  }
+  for (int k = 0; k < opts->nodes; k++) {
+    if (opts->ids[k] == id) {
+      fprintf(stderr, "node %03ld is given twice\n", id);
+      return false;
+    }
+  }
+  if (opts->nodes == FABRIC_NODES) {
+    fprintf(stderr, "too many nodes\n");
+    return false;
+  }
+  opts->ids[opts->nodes] = id;
+  opts->images[opts->nodes] = endptr + 1;
+  opts->nodes++;
+  return true;
+}
+
+// [yxx=]stream, the boot node defaulting to BOOT_NODE
+static bool parseboot(char *spec, options *opts) {
+  char *endptr;
+  long id = strtol(spec, &endptr, 10);
+  opts->boot = spec;
+  opts->bootnode = BOOT_NODE;
+  if (endptr == spec || *endptr != '=') return true;
+  if (fabric_index(id) < 0) {
+    fprintf(stderr, "bad boot node: %s (expected [yxx=]stream, e.g. "
+        "705=a.boot)\n", spec);
+    return false;
+  }
+  opts->boot = endptr + 1;
+  opts->bootnode = id;
+  return true;
+}
+
+// put back the colons strtok cut spec at, to show it as it was given
+static bool baddevice(char *spec, size_t len) {
+  for (size_t k = 0; k < len; k++) if (!spec[k]) spec[k] = ':';
+  fprintf(stderr, "bad device: %s (expected gpio:<bit>[:<ns>=<level>...], "
+      "analog:<addr>[:<ns>=<value>...] or "
+      "serial:<addr>:<baud>[:<in>[:<out>]])\n", spec);
+  return false;
+}
+
+// spec is split in place, as in parsenode, and d->in and d->out point into it
+static bool parsedevice(char *spec, options *opts) {
+  if (opts->ndevices == MAX_DEVSPECS) {
+    fprintf(stderr, "too many devices\n");
+    return false;
+  }
+  devspec *d = &opts->devices[opts->ndevices];
+  size_t len = strlen(spec);
+  char *kind = strtok(spec, ":");
+  char *arg = strtok(NULL, ":");
+  char *endptr = "";
+  if (!kind || !arg) return baddevice(spec, len);
+  d->kind = kind[0];
+  if (!strcmp(kind, "gpio")) {
+    d->addr = strtoul(arg, &endptr, 10);
+  } else if (!strcmp(kind, "analog")) {
+    d->addr = strtoul(arg, &endptr, 16);
+  } else if (!strcmp(kind, "serial")) {
+    d->addr = strtoul(arg, &endptr, 16);
+    arg = strtok(NULL, ":");
+    if (!*endptr && arg) d->baud = strtoul(arg, &endptr, 10);
+    if (!arg || !d->baud) endptr = "bad";
+    d->in = strtok(NULL, ":");
+    d->out = strtok(NULL, ":");
+    if (d->in && !strcmp(d->in, "-")) d->in = NULL;
+    if (d->out && !strcmp(d->out, "-")) d->out = NULL;
+  } else {
+    endptr = "bad";
+  }
+  // and a schedule of changes, for gpio and analog
+  while (!*endptr && d->kind != 's' && (arg = strtok(NULL, ":"))) {
+    if (d->n == MAX_CHANGES) {
+      endptr = "bad";
+      break;
+    }
+    d->when[d->n] = strtoull(arg, &endptr, 10) * 1000;
+    if (*endptr != '=') break;
+    d->values[d->n++] = strtoul(endptr + 1, &endptr, 0);
+  }
+  if (*endptr) return baddevice(spec, len);
+  opts->ndevices++;
+  return true;
+}
+
 int main(int argc, char **argv) {
   bool debug = false;
+  bool batch = false;
+  static options opts = { .engine = f18a_stepn };
+  char *endptr;
   f18a f18a;
 
   for (;;) {
@@ -92,10 +563,32 @@ int main(int argc, char **argv) {
       {"help", 0, 0, 'h'},
       {"version", 0, 0, 'v'},
       {"debug-boot", 0, 0, 'd'},
+      {"engine", 1, 0, 'e'},
+      {"device", 1, 0, 'D'},
+      {"headless", 0, 0, 'H'},
+      {"max-steps", 1, 0, 'n'},
+      {"time-limit", 1, 0, 't'},
+      {"sim-time", 1, 0, 'T'},
+      {"log", 1, 0, 'l'},
+      {"dump", 1, 0, 'o'},
+      {"node", 1, 0, 'N'},
+      {"image", 1, 0, 'I'},
+      {"boot", 1, 0, 'b'},
+      {"epoch", 1, 0, 'E'},
+      {"threads", 1, 0, 'j'},
+      {"batch", 1, 0, 'B'},
+      {"snapshot", 1, 0, 'S'},
+      {"resume", 1, 0, 'R'},
+      {"profile", 0, 0, 'p'},
+      {"callgrind", 1, 0, 'C'},
+      {"trace", 1, 0, 'x'},
+      {"record", 1, 0, 'r'},
+      {"replay", 1, 0, 'P'},
+      {"history", 1, 0, 'k'},
       {0, 0, 0, 0},
     };
 
-    c = getopt_long(argc, argv, "hvd", long_options, NULL);
+    c = getopt_long(argc, argv, "hvde:D:Hn:t:T:l:o:N:I:b:E:j:B:S:R:pC:x:r:P:k:", long_options, NULL);
 
     if (c == -1) break;
 
@@ -109,31 +602,206 @@ int main(int argc, char **argv) {
       case 'd':
         debug = true;
         break;
+      case 'e':
+        if (!strcmp(optarg, "switch")) {
+          opts.engine = f18a_stepn;
+        } else if (!strcmp(optarg, "threaded")) {
+          opts.engine = f18a_threaded;
+        } else if (!strcmp(optarg, "jit")) {
+          opts.engine = f18a_jit;
+        } else {
+          fprintf(stderr, "unknown engine: %s\n", optarg);
+          usage(argv);
+          return 1;
+        }
+        break;
+      case 'D':
+        if (!parsedevice(optarg, &opts)) return 1;
+        break;
+      case 'H':
+        batch = true;
+        break;
+      case 'n':
+        opts.max_steps = strtoull(optarg, &endptr, 10);
+        if (*endptr) {
+          fprintf(stderr, "argument to --max-steps must be a decimal number\n");
+          return 1;
+        }
+        break;
+      case 't':
+        opts.max_secs = strtod(optarg, &endptr);
+        if (*endptr) {
+          fprintf(stderr, "argument to --time-limit must be a number\n");
+          return 1;
+        }
+        break;
+      case 'T':
+        opts.deadline = strtoull(optarg, &endptr, 10) * 1000;
+        if (*endptr) {
+          fprintf(stderr, "argument to --sim-time must be a decimal number\n");
+          return 1;
+        }
+        break;
+      case 'l':
+        opts.logpath = optarg;
+        break;
+      case 'o':
+        opts.dumppath = optarg;
+        break;
+      case 'N':
+        if (!parsenode(optarg, &opts)) return 1;
+        break;
+      case 'I':
+        opts.container = optarg;
+        break;
+      case 'b':
+        if (!parseboot(optarg, &opts)) return 1;
+        break;
+      case 'E':
+        opts.epoch = strtoull(optarg, &endptr, 10);
+        if (*endptr || !opts.epoch) {
+          fprintf(stderr, "argument to --epoch must be a positive number\n");
+          return 1;
+        }
+        break;
+      case 'j':
+        opts.threads = strtol(optarg, &endptr, 10);
+        if (*endptr || opts.threads <= 0) {
+          fprintf(stderr, "argument to --threads must be a positive number\n");
+          return 1;
+        }
+        break;
+      case 'B':
+        opts.inputs = optarg;
+        break;
+      case 'S':
+        opts.snapshot = optarg;
+        break;
+      case 'R':
+        opts.resume = optarg;
+        break;
+      case 'p':
+        opts.profile = true;
+        break;
+      case 'C':
+        opts.profile = true;
+        opts.callgrind = optarg;
+        break;
+      case 'x':
+        opts.trace = optarg;
+        break;
+      case 'r':
+        opts.record = optarg;
+        break;
+      case 'P':
+        opts.replay = optarg;
+        break;
+      case 'k':
+        opts.history = strtoull(optarg, &endptr, 10);
+        opts.historymb = HISTORY_MB;
+        if (*endptr == ':') opts.historymb = strtoull(endptr + 1, &endptr, 10);
+        if (*endptr || !opts.history || !opts.historymb) {
+          fprintf(stderr, "argument to --history must be a number of steps, "
+              "and maybe :mb\n");
+          return 1;
+        }
+        break;
       default:
         usage(argv);
         return 1;
     }
   }
 
-  if (argc - optind != 1) {
+  bool fabricrun = opts.nodes || opts.container || opts.boot;
+
+  if (opts.inputs && !batch) {
+    fprintf(stderr, "--batch only makes sense with --headless\n");
+    return 1;
+  }
+
+  if ((opts.snapshot || opts.resume) && !batch) {
+    fprintf(stderr, "--snapshot and --resume only make sense with "
+        "--headless\n");
+    return 1;
+  }
+  if (opts.profile && (!batch || opts.inputs)) {
+    fprintf(stderr, "--profile only makes sense with --headless, and not with "
+        "--batch\n");
+    return 1;
+  }
+  // every step must be seen, so the profile is an engine of its own
+  if (opts.profile) opts.engine = f18a_profiled;
+
+  if (opts.trace && (!batch || opts.inputs || fabricrun || opts.profile)) {
+    fprintf(stderr, "--trace only makes sense with --headless, for a single "
+        "node, and not with\n--batch or --profile\n");
+    return 1;
+  }
+  // as is the trace
+  if (opts.trace) opts.engine = f18a_traced;
+
+  if ((opts.record || opts.replay)
+      && (!batch || opts.inputs || fabricrun || (opts.ndevices && opts.replay)
+        || (opts.record && opts.replay))) {
+    fprintf(stderr, "--record and --replay only make sense with --headless, "
+        "for a single node,\nand not with --batch, each other, or (for "
+        "--replay) --device\n");
+    return 1;
+  }
+
+  if (opts.ndevices && (fabricrun || opts.inputs)) {
+    fprintf(stderr, "--device only works for a single node, and not with "
+        "--batch\n");
+    return 1;
+  }
+
+  if (opts.snapshot && opts.inputs) {
+    fprintf(stderr, "--snapshot doesn't work with --batch\n");
+    return 1;
+  }
+
+  if (fabricrun || (opts.resume && f18a_snapkind(opts.resume) == 1)) {
+    if (!batch || debug || argc != optind || opts.inputs || opts.trace) {
+      usage(argv);
+      return 1;
+    }
+    return headlessfabric(&opts);
+  }
+
+  if (argc - optind != (opts.resume ? 0 : 1)) {
     usage(argv);
     return 1;
   }
   
   const char *image = argv[optind];
 
+  if (batch) {
+    if (opts.history) {
+      fprintf(stderr, "--history makes no sense with --headless\n");
+      return 1;
+    }
+    if (debug) {
+      fprintf(stderr, "--debug-boot makes no sense with --headless\n");
+      return 1;
+    }
+    if (opts.inputs) return headlessbatch(image, &opts);
+    return headless(&f18a, image, &opts);
+  }
+
   // init term first so that image load status is visible...
   block_signals();
-  f18a_init(&f18a);
+  f18a_init(&f18a, &f18a_termhost);
   f18a_initterm();
-  if (!f18a_loadcore(&f18a, image)) {
+  if (!f18a_loadcore(&f18a, image) || !attach(&f18a, &opts)
+      || (opts.history
+        && !f18a_histon(&f18a, opts.history, opts.historymb << 20))) {
     tcsetattr(0, TCSANOW, &old_termios);
     return -1;
   }
 
   f18a_msg("welcome to f18a, version " F18A_VERSION "\n");
   f18a_msg("press ctrl-c or send SIGINT for debugger, ctrl-d to exit.\n");
-  f18a_run(&f18a, debug);
+  f18a_run(&f18a, opts.engine, debug);
 
   f18a_killterm();
   puts(" * f18a halted.");
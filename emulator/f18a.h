@@ -28,14 +28,17 @@
 #ifndef f18a_h
 #define f18a_h
 
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
 
 
 typedef uint8_t u8;
 typedef uint16_t u16;
 typedef uint32_t u32;
-typedef uint64_t tstamp_t;
+typedef uint64_t u64;
+typedef uint64_t tstamp_t; // simulated time, in picoseconds
 
 #define F18A_VERSION  "1.0-mh"
 
@@ -45,13 +48,112 @@ typedef uint64_t tstamp_t;
 #define RSTACK_WORDS 8
 #define IO_ADDR 0x15d
 #define BOOT_ADDR 0x0aa
+#define MULTIPORT_ADDR 0x1a5 // rdlu: executes words from any neighbour
 #define OP_XOR_MASK 0x15555
 #define ADDR_MASK 0x1ff
 #define MAX_VAL 0x3ffff
+#define I_PORTFETCH 0x40000 // in i, while a fetch waits on a port
 #define MAX_P 0x3ff
+#define P9 0x200 // extended arithmetic: + and +* use and set the carry
 #define MAX_B 0x1ff
+#define PORT_R 0x1
+#define PORT_D 0x2
+#define PORT_L 0x4
+#define PORT_U 0x8
+#define CACHE_WORDS (RAM_WORDS + ROM_WORDS)
+#define CACHE_SCRATCH CACHE_WORDS
+#define CACHE_INDEX(addr) \
+  (((addr) & 0x100) ? CACHE_SCRATCH : (((addr) & 0x80) >> 1) | ((addr) & 0x3f))
+
+#define FABRIC_ROWS 8
+#define FABRIC_COLS 18
+#define FABRIC_NODES (FABRIC_ROWS * FABRIC_COLS)
+#define FABRIC_EPOCH 256
+#define BOOT_NODE 708 // boots the chip from its async serial pins
+
+#define HISTORY_INTERVAL 1000000 // steps between checkpoints (see history.c)
+#define HISTORY_MB 64
+
+// simulated time: each op costs optimes[op] (see opcodes.c), and fetching an
+// instruction word costs T_FETCH on top of the op that leaves the word.
+#define T_FETCH 3500
+#define T_STEP_MAX (5100 + T_FETCH) // the most any one step can cost
 
 #define SCR_HEIGHT 1
+#define DISASM_CHARS 32 // enough for any word, see f18a_disassemble
+
+// micro-loops: words that loop with unext over a body simple enough for
+// f18a_bulk to run any number of passes at once.
+typedef enum {
+  L_NONE,
+  L_DELAY, // nops only
+  L_SHL, // 2*, reps times per pass
+  L_SHR, // 2/, reps times
+  L_INV, // -, reps times
+  L_MULS, // +*, reps times: a multiply
+  L_OVERADD, // over +
+  L_DUPADD, // dup +
+  L_SUM, // @+ +
+  // the rest store to memory
+  L_FILL, // dup !+
+  L_MOVEA, // @+ !b
+  L_MOVEB // @b !+
+} loop_t;
+
+// an instruction word, decoded once when first fetched. entries for ram words
+// are invalidated by stores; the scratch entry holds words fetched from io
+// addresses, which are never cached.
+typedef struct {
+  u32 word;
+  u8 ops[4];
+  u8 slots; // slots up to and including the first unconditional transfer
+  bool valid;
+  u16 dest[3]; // jump destination bits for a transfer in slots 0-2
+  u8 loop; // loop_t
+  u8 pass; // steps per pass of a micro-loop
+  u8 reps;
+} decoded_t;
+
+struct f18a_t;
+
+// whatever a node or fabric is running in: where its messages go, what its io
+// register is wired to, and a way to stop it. the core keeps no state of its
+// own outside of these and the nodes, so instances with different hosts can
+// run on different threads. any callback may be NULL, as may the host itself,
+// in which case messages are dropped and only a budget stops a run.
+typedef struct f18a_host_t {
+  void (*msg)(struct f18a_host_t *host, const char *fmt, va_list args);
+  void (*error)(struct f18a_host_t *host, const char *fmt, va_list args);
+  u32 (*ioread)(struct f18a_host_t *host, struct f18a_t *f18a);
+  void (*iowrite)(struct f18a_host_t *host, struct f18a_t *f18a, u32 val);
+  // set from anywhere, even a signal handler, to stop runs at the next slice.
+  // the debugger treats an interrupt as a break and quit as the end.
+  volatile bool interrupt;
+  volatile bool quit;
+  void *data; // for the callbacks
+} f18a_host;
+
+// something wired to a node's io addresses (see iomap.c). a device attached
+// at IO_ADDR shares the io register: it sees every write to it, and status
+// sets its own bits in every read. a device attached elsewhere owns those
+// addresses, and read and write handle them. event runs for each event the
+// device schedules, once the node's clock has passed it. free releases the
+// device, once it's detached (see f18a_devfree). any callback may be NULL.
+typedef struct f18a_device_t {
+  u32 (*read)(struct f18a_device_t *dev, struct f18a_t *f18a, u32 addr);
+  void (*write)(struct f18a_device_t *dev, struct f18a_t *f18a, u32 addr,
+      u32 val);
+  u32 (*status)(struct f18a_device_t *dev, struct f18a_t *f18a, u32 io);
+  void (*event)(struct f18a_device_t *dev, struct f18a_t *f18a, tstamp_t when,
+      u64 arg);
+  void (*free)(struct f18a_device_t *dev);
+  void *data; // for the callbacks
+} f18a_device;
+
+// what each address of a node goes to: an M_* kind in the low four bits and,
+// for a port, the PORT_* bits it addresses or, for a device, its index in the
+// high four.
+enum { M_NONE, M_RAM, M_ROM, M_IO, M_PORT, M_DEVICE };
 
 typedef struct f18a_t {
   u32 p; // 10 bits
@@ -65,36 +167,452 @@ typedef struct f18a_t {
   u8 sp;
   u8 rsp;
   u8 slot;
+  bool carry; // latched by + and +* while p9 is set
   u32 stack[STACK_WORDS];
   u32 rstack[RSTACK_WORDS];
   u32 ram[RAM_WORDS];
   u32 rom[ROM_WORDS];
+  u8 map[ADDR_MASK + 1];
+  struct devices_t *devices; // attached devices and their events, if any
+  u8 cw; // decode cache entry for i
+  decoded_t dcache[CACHE_WORDS + 1];
+  tstamp_t time; // simulated time taken so far
+  struct jit_t *jit; // translated code, if any (see jit.c)
+  u64 jitted; // ram words that have been translated, which stores must check
+  struct profile_t *prof; // counts for f18a_profiled, if any (see profile.c)
+  struct tracer_t *tracer; // ring buffer for f18a_traced, if any (see trace.c)
+  struct breaks_t *breaks; // breakpoints and watchpoints, if any (see breaks.c)
+  struct iolog_t *iolog; // io being recorded or replayed, if any (see iolog.c)
+  struct history_t *history; // to step back through, if any (see history.c)
+  f18a_host *host;
+
+  // comm ports. a blocked read or write records the ports it's waiting on,
+  // and the fabric sets done once a neighbour has completed the transfer.
+  struct f18a_t *ports[4]; // neighbour sharing each port (r, d, l, u)
+  u8 rports;
+  u8 wports;
+  bool taken[4]; // set by the neighbour on that port, if it took our write
+  tstamp_t when[4]; // and the simulated time at which it did
+  bool done;
+  u32 pval; // value being written, or value read once done
 } f18a;
 
 typedef enum {
   A_CONTINUE,
   A_BREAK,
-  A_EXIT
+  A_EXIT,
+  A_HALT, // the node can make no further progress
+  A_BLOCK // the node is waiting on a port
 } action_t;
 
+// an execution engine runs up to *budget steps and leaves the unused part of
+// the budget in *budget. any action other than A_CONTINUE stops the engine
+// *before* the step that raised it, which is neither executed nor counted.
+typedef action_t (*engine_t)(f18a *f18a, u64 *budget);
+
+typedef enum {
+  N_OFF, // no image loaded, never runs
+  N_RUN,
+  N_HALT
+} nodestate_t;
+
+// runnable and parked nodes of some part of a fabric, by index (see fabric.c)
+typedef struct {
+  int nready, nreaders, nwriters;
+  int nlate; // ready nodes that didn't run, being past the deadline
+  u8 ready[FABRIC_NODES];
+  u8 readers[FABRIC_NODES]; // blocked reading a port
+  u8 writers[FABRIC_NODES]; // blocked writing a port
+} queue_t;
+
+#define DAMAGED 0xff // a node whose code in its image container was bad
+
+typedef struct {
+  f18a nodes[FABRIC_NODES]; // row-major, row 0 at the bottom
+  u8 state[FABRIC_NODES];
+  u64 epoch; // steps each node may run between port resolutions
+  int threads; // threads used by fabric_runheadless
+  tstamp_t deadline; // simulated time at which nodes stop, or 0 for none
+  queue_t queue; // for fabric_step
+  bool queued; // false if queue must be rebuilt from the node states
+  u64 transfers; // port reads completed
+  struct image_t *image; // container nodes are still to be loaded from
+  u8 pending[FABRIC_NODES]; // 1 + the node's index in image, 0 or DAMAGED
+  u32 *feed; // boot stream for the boot node (see fabric_boot), or NULL
+  u32 nfeed, fed; // words in the stream, and those fed so far
+  int boot, bootport; // index of the boot node, or -1, and its port off chip
+  f18a_host *host; // shared by all its nodes
+} fabric;
+
+// why a headless run stopped. these double as the process exit status.
+typedef enum {
+  S_HALT = 0,
+  S_BUDGET = 2,
+  S_TIMEOUT = 3,
+  S_BREAK = 4,
+  S_DEADLINE = 5 // simulated time ran out
+} stop_t;
+
+// one step of a binary trace (see trace.c): the op, and t and s as they were
+// before it ran. addr is what the op read or wrote, if anything.
+#define TRACE_MAGIC 0x66313874 // "f18t"
+#define TRACE_VERSION 1
+#define TRACE_NONE 0xffff
+
+typedef struct {
+  u16 p; // address of the word the op is in
+  u8 slot;
+  u8 op;
+  u32 t;
+  u32 s;
+  u16 addr; // memory or port address, or TRACE_NONE
+  u16 unused;
+} trace_t;
+
+// a trace file is a header, then blocks of delta-encoded records, each block
+// decoding alone from a zeroed record. a record is a byte of op | slot << 5,
+// a byte of TR_* flags, then for each flag set in that order a varint: the
+// zigzag difference of p, t or s from the record before, or addr itself.
+#define TR_P 0x1
+#define TR_T 0x2
+#define TR_S 0x4
+#define TR_ADDR 0x8
+
+typedef struct {
+  u32 magic;
+  u32 version;
+  u32 unused[2];
+  u64 records; // filled in when the trace is closed, else zero
+  u64 blocks;
+} traceheader_t;
+
+typedef struct {
+  u64 first; // index of the first record in the block
+  u32 count;
+  u32 bytes; // of encoded records, which follow
+} traceblock_t;
+
+// an io log (see iolog.c) is a header, then for each value a node read from
+// outside itself a varint of the simulated time since the value before (or
+// since the log was started) << 1, with the low bit set if the address isn't
+// the one before (or 0). if so, a varint of the address follows. then a
+// varint of the value.
+#define IOLOG_MAGIC 0x66313869 // "f18i"
+#define IOLOG_VERSION 1
+
+typedef struct {
+  u32 magic;
+  u32 version;
+  u64 records; // filled in when the log is closed, else zero
+} iologheader_t;
+
+static inline bool f18a_stopped(const f18a_host *host) {
+  return host && (host->interrupt || host->quit);
+}
+
+// a breakpoint stops a node before it runs the given slots of the word at
+// addr. a watchpoint stops it before an op that reads or writes addr. ram and
+// rom addresses are kept without the bits that only mirror them.
+typedef struct {
+  int id;
+  u8 watch; // W_READ | W_WRITE for a watchpoint, 0 for a breakpoint
+  u8 slots; // bit per slot, for a breakpoint
+  u16 addr;
+} breakpoint;
+
+enum { W_READ = 1, W_WRITE = 2 };
+
+// an expression over the state of a node, compiled for f18a_test (see
+// predicate.c)
+#define PRED_CODE 128
+typedef struct {
+  int n;
+  struct {
+    u8 op;
+    u32 arg;
+  } code[PRED_CODE];
+} predicate;
+
+// a static analysis of the code in a node's ram and rom (see cfg.c). words
+// are numbered by cache index, as in the decode cache, and so are blocks and
+// routines, which can't outnumber words.
+#define CFG_NONE 0xff
+#define CFG_UNBOUNDED UINT64_MAX
+
+// how a block's last word leaves it. on is where control goes on to (the
+// next word, or the branch not taken, or the return from a call) and to is a
+// transfer's destination.
+typedef enum {
+  E_FALL, // on into a word that starts another block
+  E_JUMP, // to to
+  E_BRANCH, // if or -if: to to if taken, else on
+  E_NEXT, // back to to while r is non-zero, then on
+  E_CALL, // to the routine callee, then on
+  E_RETURN,
+  E_HALT,
+  E_UNKNOWN // ex, a ; to an address that can't be known, or a jump to io
+} cfgexit_t;
+
+typedef struct {
+  u16 addr; // of the first word
+  u8 words; // each running on into the next, past any literals
+  u8 last; // cache index of the last word
+  u8 exit; // cfgexit_t
+  u8 on, to; // blocks, or CFG_NONE
+  u8 callee; // routine, for E_CALL
+  u32 passes; // most passes of the loop an E_NEXT closes, 0 if unknown
+  u64 steps; // worst case for one run through the block, calls aside
+  tstamp_t time;
+} cfgblock_t;
+
+typedef struct {
+  u16 addr;
+  u8 entry; // block
+  u64 steps; // worst case, calls included, or CFG_UNBOUNDED
+  tstamp_t time;
+  const char *why; // if unbounded
+} cfgroutine_t;
+
+typedef struct {
+  int nblocks;
+  int nroutines; // the first is the one the node starts in
+  cfgblock_t blocks[CACHE_WORDS];
+  cfgroutine_t routines[CACHE_WORDS];
+  u8 block[CACHE_WORDS]; // of each word, or CFG_NONE if it never runs
+} f18a_cfg;
+
+// a search for sequences of ops that do what a reference sequence does (see
+// superopt.c). ops are opcodes, and ops is a set of them, one bit each.
+#define SOPT_MAX 8 // longest sequence
+#define SOPT_FOUND 64 // sequences kept
+
+typedef struct {
+  u8 ops[SOPT_MAX];
+  u8 n;
+  u8 words; // instruction words it packs into
+  bool proved; // for every input, not just every one tried
+  tstamp_t time;
+} soptseq_t;
+
+typedef struct {
+  u8 ref[SOPT_MAX];
+  int nref;
+  u32 ops; // that candidates may use, of those in f18a_soptops
+  int maxlen; // longest candidate; on return, the longest searched
+  int depth; // data stack cells, from t down, that must agree
+  int rdepth; // return stack cells, from r down
+  bool deada, deadb; // a and b needn't agree
+  bool all; // go on past the shortest length with any hits
+  int threads;
+  // results, cheapest first
+  int nfound;
+  soptseq_t found[SOPT_FOUND];
+  u64 hits; // found, including any not kept
+  u64 candidates; // run, by length in counts
+  u64 counts[SOPT_MAX + 1];
+  double secs;
+} f18a_sopt;
+
+// + with p9 set: 18 bits, plus the carry, which it sets from the sum
+static inline u32 f18a_addc(u32 t, u32 s, bool *carry) {
+  u32 sum = (t & MAX_VAL) + (s & MAX_VAL) + *carry;
+  *carry = sum >> 18;
+  return sum & MAX_VAL;
+}
+
+
+// +*, one step of a multiply: if a0 is set, s is added to t (with the carry,
+// which is NULL unless p9 is set), then t and a shift right together as a
+// 36-bit register, keeping t17.
+static inline void f18a_muls(u32 *t, u32 s, u32 *a, bool *carry) {
+  u32 sum = *t & MAX_VAL;
+  if (*a & 1) {
+    sum += (s & MAX_VAL) + (carry ? *carry : 0);
+    if (carry) *carry = sum >> 18;
+    sum &= MAX_VAL;
+  }
+  *a = (*a & MAX_VAL) >> 1 | (sum & 1) << 17;
+  *t = sum >> 1 | (sum & 0x20000);
+}
+
+
+// p and a increment only within their bottom 7 bits, and not at all in the io
+// range. see inc() in emulator.c.
+static inline u32 f18a_inc(u32 addr) {
+  if (addr & 0x100) return addr;
+  return (addr & ~0x7f) | ((addr + 1) & 0x7f);
+}
+
+
+// batch.c
+extern stop_t f18a_batch(f18a *nodes, int n, engine_t engine, u64 max_steps,
+    double max_secs, tstamp_t deadline, stop_t *stops, u64 *steps);
+
+// boot.c
+extern u32 *f18a_readboot(f18a_host *host, const char *path, u32 home,
+    u32 *n);
+extern bool f18a_writeboot(f18a_host *host, const char *path,
+    const f18a *const *nodes, const int *ids, int n, int boot);
+
+// breaks.c
+extern int f18a_break(f18a *f18a, u32 addr, u8 slots);
+extern int f18a_watch(f18a *f18a, u32 addr, u8 watch);
+extern bool f18a_unbreak(f18a *f18a, int id);
+extern const breakpoint *f18a_points(const f18a *f18a, int *n);
+extern const breakpoint *f18a_breakhit(const f18a *f18a);
+extern void f18a_mark(f18a *f18a, decoded_t *d, u32 addr);
+extern u8 f18a_untrap(const f18a *f18a, u8 cw, u8 slot);
+extern bool f18a_hits(f18a *f18a, u8 op, u8 slot);
+extern action_t f18a_stepover(f18a *f18a);
+
+// cfg.c
+extern void f18a_analyze(const f18a *f18a, f18a_cfg *cfg);
+
+// devices.c
+extern f18a_device *f18a_gpio(f18a *f18a, u8 bit, int n,
+    const tstamp_t *when, const u32 *levels);
+extern f18a_device *f18a_serial(f18a *f18a, u32 addr, u32 baud, FILE *in,
+    FILE *out);
+extern f18a_device *f18a_analog(f18a *f18a, u32 addr, int n,
+    const tstamp_t *when, const u32 *values);
+extern void f18a_devfree(f18a *f18a, f18a_device *dev);
 
 // disassembler.c
-extern u16 *f18a_disassemble(u16 *pc, char *out);
+extern void f18a_disassemble(u32 word, u32 p, char *out);
 
 // emulator.c
-extern void f18a_init(f18a *f18a);
+extern void f18a_init(f18a *f18a, f18a_host *host);
+extern bool f18a_release(f18a *f18a);
 extern bool f18a_loadcore(f18a *f18a, const char *image);
-extern bool f18a_present(u32 addr);
+extern void f18a_flushcache(f18a *f18a);
+extern bool f18a_present(const f18a *f18a, u32 addr);
 extern u32 f18a_load(f18a *f18a, u32 addr);
+extern bool f18a_read(f18a *f18a, u32 addr, u32 *val);
+extern bool f18a_write(f18a *f18a, u32 addr, u32 val);
 extern u8 f18a_decode_op(f18a *f18a);
-extern void f18a_run(f18a *f18a, bool debugboot);
+extern void f18a_decode(decoded_t *d, u8 cw, u32 i);
+extern void f18a_fill(f18a *f18a, u8 cw);
+extern void f18a_latch(f18a *f18a);
+extern u64 f18a_until(const f18a *f18a, tstamp_t deadline, u64 budget);
+extern stop_t f18a_runheadless(f18a *f18a, engine_t engine, u64 max_steps,
+    double max_secs, tstamp_t deadline, u64 *steps);
 extern action_t f18a_step(f18a *f18a);
+extern action_t f18a_stepn(f18a *f18a, u64 *budget);
+extern u64 f18a_bulk(f18a *f18a, const decoded_t *d, u64 budget);
+
+// fabric.c
+extern void fabric_init(fabric *fab, f18a_host *host);
+extern bool fabric_release(fabric *fab);
+extern int fabric_index(int id);
+extern int fabric_id(int index);
+extern bool fabric_load(fabric *fab, int id, const char *image);
+extern bool fabric_loadimage(fabric *fab, const char *path);
+extern bool fabric_settle(fabric *fab);
+extern bool fabric_boot(fabric *fab, const char *path, int id);
+extern int fabric_port(int i, int j);
+extern u64 fabric_step(fabric *fab, engine_t engine);
+extern stop_t fabric_runheadless(fabric *fab, engine_t engine, u64 max_steps,
+    double max_secs, u64 *steps);
+
+// host.c
+extern void f18a_hostmsg(f18a_host *host, const char *fmt, ...)
+  __attribute__ ((format (printf, 2, 3)));
+extern void f18a_hosterr(f18a_host *host, const char *fmt, ...)
+  __attribute__ ((format (printf, 2, 3)));
+
+// image.c
+extern bool f18a_isimage(const char *path);
+extern struct image_t *f18a_openimage(f18a_host *host, const char *path);
+extern void f18a_closeimage(struct image_t *img);
+extern int f18a_imagenodes(const struct image_t *img);
+extern int f18a_imageid(const struct image_t *img, int k);
+extern bool f18a_materialize(f18a *f18a, const struct image_t *img, int k);
+extern bool f18a_writeimage(f18a_host *host, const char *path,
+    const f18a *const *nodes, const int *ids, int n);
+
+// iolog.c
+extern bool f18a_record(f18a *f18a, const char *path);
+extern bool f18a_replay(f18a *f18a, const char *path);
+extern void f18a_logio(f18a *f18a, u32 addr, u32 val);
+extern bool f18a_iologclose(f18a *f18a);
+
+// iomap.c
+extern void f18a_mapinit(f18a *f18a);
+extern void f18a_mapfree(f18a *f18a);
+extern u32 f18a_portaddr(u8 ports);
+extern bool f18a_attach(f18a *f18a, f18a_device *dev, u32 addr, u32 count);
+extern void f18a_detach(f18a *f18a, f18a_device *dev);
+extern bool f18a_schedule(f18a *f18a, f18a_device *dev, tstamp_t when,
+    u64 arg);
+extern u32 f18a_ioread(f18a *f18a);
+extern void f18a_iowrite(f18a *f18a, u32 val);
+extern bool f18a_devread(f18a *f18a, u8 k, u32 addr, u32 *val);
+extern bool f18a_devwrite(f18a *f18a, u8 k, u32 addr, u32 val);
+
+// jit.c
+extern action_t f18a_jit(f18a *f18a, u64 *budget);
+extern void f18a_jitflush(f18a *f18a);
+extern void f18a_jitfree(f18a *f18a);
+
+// predicate.c
+extern bool f18a_compile(f18a_host *host, const char *src, predicate *pred);
+extern bool f18a_test(const predicate *pred, f18a *f18a);
+
+// profile.c
+extern action_t f18a_profiled(f18a *f18a, u64 *budget);
+extern void f18a_listing(const f18a *f18a, const char *name);
+extern void f18a_callgrindhead(FILE *out);
+extern void f18a_callgrind(const f18a *f18a, const char *name, FILE *out);
+
+// trace.c
+extern action_t f18a_traced(f18a *f18a, u64 *budget);
+extern bool f18a_traceopen(f18a *f18a, const char *path);
+extern bool f18a_traceclose(f18a *f18a);
+
+// threaded.c
+extern action_t f18a_threaded(f18a *f18a, u64 *budget);
+
+// snapshot.c
+extern int f18a_snapkind(const char *path);
+extern bool f18a_save(const f18a *f18a, const char *path);
+extern bool f18a_restore(f18a *f18a, const char *path);
+extern bool fabric_save(const fabric *fab, const char *path);
+extern bool fabric_restore(fabric *fab, const char *path);
+extern void f18a_fork(f18a *child, const f18a *parent);
+extern void fabric_fork(fabric *child, const fabric *parent);
+extern const u32 f18a_statewords;
+extern void f18a_savestate(const f18a *f18a, u32 *state);
+extern bool f18a_loadstate(f18a *f18a, const u32 *state);
+
+// superopt.c
+extern const u32 f18a_soptops;
+extern bool f18a_soptable(u8 op);
+extern bool f18a_superopt(f18a_sopt *opt);
+
+// history.c
+extern bool f18a_histon(f18a *f18a, u64 interval, size_t limit);
+extern void f18a_histoff(f18a *f18a);
+extern action_t f18a_forward(f18a *f18a, engine_t engine, u64 *budget);
+extern action_t f18a_advance(f18a *f18a, bool over);
+extern u64 f18a_rewind(f18a *f18a, u64 steps);
+extern action_t f18a_reverse(f18a *f18a);
+extern u32 f18a_recall(f18a *f18a);
+extern void f18a_remember(f18a *f18a, u32 val);
+extern bool f18a_rerunning(const f18a *f18a);
+extern void f18a_histinfo(const f18a *f18a, u64 *first, u64 *now, u64 *last,
+    size_t *bytes);
+
+// everything above is libf18a. the rest is the f18a program's own, and uses
+// the terminal.
 
 // debugger.c
+extern void f18a_run(f18a *f18a, engine_t engine, bool debugboot);
 extern bool f18a_debug(f18a *f18a);
+extern void f18a_dumpjson(f18a *f18a, FILE *out);
 
 // terminal.c
 extern void f18a_initterm(void);
+extern void f18a_initlog(FILE *log);
 extern void f18a_msg(char *fmt, ...)
   __attribute__ ((format (printf, 1, 2)));
 extern int f18a_getch(void);
@@ -103,8 +621,7 @@ extern void f18a_runterm(void);
 extern void f18a_dbgterm(void);
 extern void f18a_killterm(void);
 extern void f18a_exitmsg(char *fmt, ...);
-extern volatile bool f18a_break;
-extern volatile bool f18a_die;
+extern f18a_host f18a_termhost;
 
 
 #endif
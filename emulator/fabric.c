@@ -0,0 +1,541 @@
+/*
+ * Copyright (c) 2013, Matt Hellige
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above copyright 
+ *   notice, this list of conditions and the following disclaimer in the 
+ *   documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT 
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// a grid of nodes, wired together through their comm ports, as on the ga144.
+//
+// nodes never touch each other while they run. time advances in epochs, in
+// each of which every node runs for up to fab->epoch steps, or until it halts
+// or blocks on a port. blocked transfers are then resolved all at once, and
+// the nodes involved run again in the next epoch. so results depend only on
+// the epoch length, never on the order in which nodes are run.
+//
+// each node keeps its own simulated time. a transfer happens once both ends
+// are ready, so it brings both up to the later of their times: that's how
+// long the earlier one waited.
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "f18a.h"
+
+
+// port bits in the order of f18a.ports: r, d, l, u
+static const u8 portbits[] = {PORT_R, PORT_D, PORT_L, PORT_U};
+
+
+// the index of the node on the other side of node i's port, or -1 at the
+// edge. ports are named so that both ends of a link agree: right faces east
+// in even columns and west in odd ones, and up faces north in even rows and
+// south in odd ones. row 0 is at the bottom.
+static int across(int i, int port) {
+  int row = i / FABRIC_COLS, col = i % FABRIC_COLS;
+  int east = col % 2 ? -1 : 1;
+  int north = row % 2 ? -1 : 1;
+  switch (port) {
+    case 0: col += east; break;
+    case 1: row -= north; break;
+    case 2: col -= east; break;
+    case 3: row += north; break;
+  }
+  if (row < 0 || row >= FABRIC_ROWS || col < 0 || col >= FABRIC_COLS)
+    return -1;
+  return row * FABRIC_COLS + col;
+}
+
+
+// as for f18a_init, whatever the fabric held before isn't freed (see
+// fabric_release)
+void fabric_init(fabric *fab, f18a_host *host) {
+  fab->epoch = FABRIC_EPOCH;
+  fab->threads = 1;
+  fab->deadline = 0;
+  fab->transfers = 0;
+  fab->queued = false;
+  fab->image = NULL;
+  fab->feed = NULL;
+  fab->nfeed = fab->fed = 0;
+  fab->boot = -1;
+  fab->host = host;
+  for (int i = 0; i < FABRIC_NODES; i++) {
+    f18a *node = &fab->nodes[i];
+    f18a_init(node, host);
+    fab->state[i] = N_OFF;
+    fab->pending[i] = 0;
+    for (int port = 0; port < 4; port++) {
+      int j = across(i, port);
+      node->ports[port] = j < 0 ? NULL : &fab->nodes[j];
+    }
+  }
+}
+
+
+// release every node (see f18a_release), the container and any boot stream
+bool fabric_release(fabric *fab) {
+  bool ok = true;
+  for (int i = 0; i < FABRIC_NODES; i++)
+    ok = f18a_release(&fab->nodes[i]) && ok;
+  if (fab->image) f18a_closeimage(fab->image);
+  fab->image = NULL;
+  free(fab->feed);
+  fab->feed = NULL;
+  fab->nfeed = fab->fed = 0;
+  return ok;
+}
+
+
+// the index in f18a.ports of node i's port to node j, or -1 if they aren't
+// neighbours
+int fabric_port(int i, int j) {
+  for (int port = 0; port < 4; port++)
+    if (j >= 0 && across(i, port) == j) return port;
+  return -1;
+}
+
+
+int fabric_index(int id) {
+  int row = id / 100;
+  int col = id % 100;
+  if (id < 0 || row >= FABRIC_ROWS || col >= FABRIC_COLS) return -1;
+  return row * FABRIC_COLS + col;
+}
+
+
+int fabric_id(int index) {
+  return index / FABRIC_COLS * 100 + index % FABRIC_COLS;
+}
+
+
+bool fabric_load(fabric *fab, int id, const char *image) {
+  int i = fabric_index(id);
+  if (i < 0) {
+    f18a_hosterr(fab->host, "no such node: %03d\n", id);
+    return false;
+  }
+  if (!f18a_loadcore(&fab->nodes[i], image)) return false;
+  fab->state[i] = N_RUN;
+  fab->pending[i] = 0;
+  fab->queued = false;
+  return true;
+}
+
+
+// the nodes of a container are marked to run straight away, but nothing is
+// copied out of it until a node is first run (see runqueue), so this takes
+// much the same time for one node as for a whole fabric. a fabric keeps one
+// container at a time, until the next is loaded.
+bool fabric_loadimage(fabric *fab, const char *path) {
+  struct image_t *img = f18a_openimage(fab->host, path);
+  if (!img) return false;
+  int n = f18a_imagenodes(img);
+  bool seen[FABRIC_NODES] = {false};
+  for (int k = 0; k < n; k++) {
+    int i = fabric_index(f18a_imageid(img, k));
+    if (seen[i] || fab->state[i] != N_OFF) {
+      f18a_hosterr(fab->host, "node %03d is loaded twice, by '%s'\n",
+          fabric_id(i), path);
+      f18a_closeimage(img);
+      return false;
+    }
+    seen[i] = true;
+  }
+  if (fab->image) {
+    fabric_settle(fab);
+    f18a_closeimage(fab->image);
+  }
+  fab->image = img;
+  for (int k = 0; k < n; k++) {
+    int i = fabric_index(f18a_imageid(img, k));
+    fab->state[i] = N_RUN;
+    fab->pending[i] = k + 1;
+  }
+  fab->queued = false;
+  f18a_hostmsg(fab->host, "loaded %d nodes from %s\n", n, path);
+  return true;
+}
+
+
+// a node whose code turns out to be damaged is turned off, and never runs.
+// only ever touches node i, so it's safe from any thread running it.
+static bool materialize(fabric *fab, int i) {
+  bool ok = f18a_materialize(&fab->nodes[i], fab->image, fab->pending[i] - 1);
+  fab->pending[i] = ok ? 0 : DAMAGED;
+  if (!ok) fab->state[i] = N_OFF;
+  return ok;
+}
+
+
+// loads every node still waiting on the fabric's container, as before
+// looking at the nodes from outside. false if any node was damaged, now or
+// when it was first run.
+bool fabric_settle(fabric *fab) {
+  bool ok = true;
+  for (int i = 0; i < FABRIC_NODES; i++) {
+    if (fab->pending[i] && fab->pending[i] != DAMAGED) materialize(fab, i);
+    if (fab->pending[i] == DAMAGED) ok = false;
+  }
+  return ok;
+}
+
+
+// a fabric boots as the chip does: every node starts in multiport execute,
+// running whatever words its neighbours write to it, and the boot node is fed
+// the stream of instruction words its boot rom would run for the frames in
+// path (see boot.c), executing them from the port it has facing off the chip,
+// one each time it reads it. id is the boot node, in yxx. a snapshot keeps
+// none of the stream still to be fed.
+bool fabric_boot(fabric *fab, const char *path, int id) {
+  int boot = fabric_index(id);
+  int port = -1;
+  for (int k = 0; boot >= 0 && k < 4 && port < 0; k++)
+    if (!fab->nodes[boot].ports[k]) port = k;
+  if (port < 0) {
+    f18a_hosterr(fab->host, "node %03d can't boot a fabric: it isn't on the "
+        "edge\n", id);
+    return false;
+  }
+  for (int i = 0; i < FABRIC_NODES; i++) {
+    if (fab->state[i] != N_OFF) {
+      f18a_hosterr(fab->host, "can't boot a fabric with node %03d already "
+          "loaded\n", fabric_id(i));
+      return false;
+    }
+  }
+  u32 n, home = f18a_portaddr(portbits[port]);
+  u32 *feed = f18a_readboot(fab->host, path, home, &n);
+  if (!feed) return false;
+  for (int i = 0; i < FABRIC_NODES; i++) {
+    fab->nodes[i].p = i == boot ? home : MULTIPORT_ADDR;
+    fab->state[i] = N_RUN;
+  }
+  fab->feed = feed;
+  fab->nfeed = n;
+  fab->fed = 0;
+  fab->boot = boot;
+  fab->bootport = port;
+  fab->queued = false;
+  f18a_hostmsg(fab->host, "booting through node %03d from %s (%u words)\n",
+      id, path, n);
+  return true;
+}
+
+
+// each range of nodes has a run queue, and only nodes on it are run. a node
+// that blocks on a port is parked on the readers or writers list, where it
+// costs nothing but a look from the resolution passes, and goes back on the
+// run queue once its transfer completes. halted nodes drop off altogether.
+
+static void enqueue(fabric *fab, queue_t *q, int from, int to) {
+  q->nready = q->nreaders = q->nwriters = q->nlate = 0;
+  for (int i = from; i < to; i++) {
+    f18a *node = &fab->nodes[i];
+    if (fab->state[i] != N_RUN) continue;
+    if (node->rports) q->readers[q->nreaders++] = i;
+    else if (node->wports) q->writers[q->nwriters++] = i;
+    else q->ready[q->nready++] = i;
+  }
+}
+
+
+// nodes past the deadline stay on the run queue, but don't run
+static u64 runqueue(fabric *fab, engine_t engine, queue_t *q) {
+  u64 steps = 0;
+  int n = 0;
+  q->nlate = 0;
+  for (int k = 0; k < q->nready; k++) {
+    int i = q->ready[k];
+    f18a *node = &fab->nodes[i];
+    if (fab->pending[i] && !materialize(fab, i)) continue;
+    u64 slice = f18a_until(node, fab->deadline, fab->epoch);
+    if (!slice) {
+      q->nlate++;
+      q->ready[n++] = i;
+      continue;
+    }
+    u64 budget = slice;
+    action_t action = engine(node, &budget);
+    steps += slice - budget;
+    if (action == A_HALT || action == A_EXIT) fab->state[i] = N_HALT;
+    else if (node->rports) q->readers[q->nreaders++] = i;
+    else if (node->wports) q->writers[q->nwriters++] = i;
+    else q->ready[n++] = i;
+  }
+  q->nready = n;
+  return steps;
+}
+
+
+// transfers are resolved in two passes over the parked nodes, each of which
+// only writes to the nodes it visits (and, in the first, to the taken flags
+// of their neighbours, each of which has exactly one writer). so each pass
+// can be split across threads, as long as no node starts the second pass
+// before every node has finished the first.
+
+static u64 takewrites(fabric *fab, queue_t *q) {
+  // each blocked reader takes the first write on offer to it, in port order.
+  // this only looks at writers' offers, which don't change until the second
+  // pass, so the order in which readers are visited doesn't matter. a write
+  // on several ports may be taken by several readers at once.
+  u64 transfers = 0;
+  int n = 0;
+  for (int k = 0; k < q->nreaders; k++) {
+    int i = q->readers[k];
+    f18a *node = &fab->nodes[i];
+    for (int port = 0; port < 4; port++) {
+      f18a *other = node->ports[port];
+      u8 bit = portbits[port];
+      if ((node->rports & bit) && other && (other->wports & bit)) {
+        node->pval = other->pval;
+        node->rports = 0;
+        node->done = true;
+        if (node->time < other->time) node->time = other->time;
+        other->taken[port] = true;
+        other->when[port] = node->time;
+        transfers++;
+        break;
+      }
+    }
+    // the boot stream comes from off the chip, whenever the node wants it
+    if (i == fab->boot && (node->rports & portbits[fab->bootport])
+        && fab->fed < fab->nfeed) {
+      node->pval = fab->feed[fab->fed++];
+      node->rports = 0;
+      node->done = true;
+      transfers++;
+    }
+    if (node->rports) q->readers[n++] = i;
+    else q->ready[q->nready++] = i;
+  }
+  q->nreaders = n;
+  return transfers;
+}
+
+
+static void completewrites(fabric *fab, queue_t *q) {
+  int n = 0;
+  for (int k = 0; k < q->nwriters; k++) {
+    int i = q->writers[k];
+    f18a *node = &fab->nodes[i];
+    bool taken = false;
+    for (int port = 0; port < 4; port++) {
+      if (node->taken[port] && node->time < node->when[port])
+        node->time = node->when[port];
+      taken |= node->taken[port];
+      node->taken[port] = false;
+    }
+    if (taken) {
+      node->wports = 0;
+      node->done = true;
+      q->ready[q->nready++] = i;
+    } else {
+      q->writers[n++] = i;
+    }
+  }
+  q->nwriters = n;
+}
+
+
+u64 fabric_step(fabric *fab, engine_t engine) {
+  if (!fab->queued) {
+    enqueue(fab, &fab->queue, 0, FABRIC_NODES);
+    fab->queued = true;
+  }
+  u64 steps = runqueue(fab, engine, &fab->queue);
+  fab->transfers += takewrites(fab, &fab->queue);
+  completewrites(fab, &fab->queue);
+  return steps;
+}
+
+
+static double elapsed(struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+
+// with several threads, each owns a contiguous run of nodes and runs the same
+// epochs as fabric_step, in the same order:
+//
+//   complete writes of the previous epoch, run own nodes   (barrier)
+//   take writes on offer to own nodes                      (barrier)
+//
+// no node is touched by two threads between a pair of barriers, so there's no
+// other synchronization, and the results are identical to a single thread.
+// after the second barrier, every thread sums the counts of the epoch and
+// makes the same decision about whether to stop. the counts are indexed by
+// epoch parity, since a fast thread may start the next epoch while a slow one
+// is still reading them.
+
+typedef struct crew_t crew_t;
+
+typedef struct {
+  crew_t *crew;
+  int index;
+  queue_t queue; // of this worker's own nodes
+  u64 steps[2];
+  u64 transfers[2];
+  int late[2];
+} worker_t;
+
+struct crew_t {
+  fabric *fab;
+  engine_t engine;
+  int nworkers;
+  worker_t workers[FABRIC_NODES];
+  pthread_barrier_t barrier;
+  u64 max_steps;
+  double max_secs;
+  struct timespec start;
+  // set by the first worker between the barriers, so all agree on them
+  bool timeout;
+  bool interrupt;
+  stop_t stop;
+  u64 steps;
+};
+
+
+static bool stopped(crew_t *crew, int phase, u64 *steps, u64 *transfers,
+    stop_t *stop) {
+  u64 done = 0, taken = 0;
+  int late = 0;
+  for (int i = 0; i < crew->nworkers; i++) {
+    done += crew->workers[i].steps[phase];
+    taken += crew->workers[i].transfers[phase];
+    late += crew->workers[i].late[phase];
+  }
+  *transfers += taken;
+  // same checks, in the same order, as the single-threaded loop...
+  if (!done && !taken) {
+    *stop = late ? S_DEADLINE : S_HALT;
+    return true;
+  }
+  *steps += done;
+  if (crew->timeout) *stop = S_TIMEOUT;
+  else if (crew->interrupt) *stop = S_BREAK;
+  else if (crew->max_steps && *steps >= crew->max_steps) *stop = S_BUDGET;
+  else return false;
+  return true;
+}
+
+
+static void *work(void *arg) {
+  worker_t *w = arg;
+  crew_t *crew = w->crew;
+  fabric *fab = crew->fab;
+  u64 steps = 0, transfers = 0;
+  stop_t stop;
+  for (int phase = 0; ; phase ^= 1) {
+    completewrites(fab, &w->queue);
+    w->steps[phase] = runqueue(fab, crew->engine, &w->queue);
+    w->late[phase] = w->queue.nlate;
+    pthread_barrier_wait(&crew->barrier);
+
+    w->transfers[phase] = takewrites(fab, &w->queue);
+    if (w->index == 0) {
+      crew->timeout = crew->max_secs > 0 &&
+        elapsed(&crew->start) >= crew->max_secs;
+      crew->interrupt = f18a_stopped(fab->host);
+    }
+    pthread_barrier_wait(&crew->barrier);
+
+    if (stopped(crew, phase, &steps, &transfers, &stop)) break;
+  }
+  // leave the fabric as fabric_step would...
+  completewrites(fab, &w->queue);
+  if (w->index == 0) {
+    crew->stop = stop;
+    crew->steps = steps;
+    fab->transfers += transfers;
+  }
+  return NULL;
+}
+
+
+static stop_t runcrew(fabric *fab, engine_t engine, u64 max_steps,
+    double max_secs, u64 *steps) {
+  crew_t *crew = calloc(1, sizeof(crew_t));
+  if (!crew) return S_BREAK;
+  int n = fab->threads < FABRIC_NODES ? fab->threads : FABRIC_NODES;
+  crew->fab = fab;
+  crew->engine = engine;
+  crew->nworkers = n;
+  crew->max_steps = max_steps;
+  crew->max_secs = max_secs;
+  clock_gettime(CLOCK_MONOTONIC, &crew->start);
+  pthread_barrier_init(&crew->barrier, NULL, n);
+
+  // the calling thread is worker 0
+  pthread_t threads[FABRIC_NODES];
+  for (int i = 0; i < n; i++) {
+    worker_t *w = &crew->workers[i];
+    w->crew = crew;
+    w->index = i;
+    enqueue(fab, &w->queue, FABRIC_NODES * i / n, FABRIC_NODES * (i + 1) / n);
+  }
+  for (int i = 1; i < n; i++)
+    if (pthread_create(&threads[i], NULL, work, &crew->workers[i])) {
+      f18a_hostmsg(fab->host, "unable to start thread %d\n", i);
+      exit(1);
+    }
+  work(&crew->workers[0]);
+  for (int i = 1; i < n; i++)
+    pthread_join(threads[i], NULL);
+
+  stop_t stop = crew->stop;
+  *steps = crew->steps;
+  fab->queued = false; // the workers' queues are gone
+  pthread_barrier_destroy(&crew->barrier);
+  free(crew);
+  return stop;
+}
+
+
+stop_t fabric_runheadless(fabric *fab, engine_t engine, u64 max_steps,
+    double max_secs, u64 *steps) {
+  if (fab->threads > 1)
+    return runcrew(fab, engine, max_steps, max_secs, steps);
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  *steps = 0;
+  for (;;) {
+    if (f18a_stopped(fab->host)) return S_BREAK;
+    // the step limit is only checked between epochs.
+    if (max_steps && *steps >= max_steps) return S_BUDGET;
+
+    u64 transfers = fab->transfers;
+    u64 done = fabric_step(fab, engine);
+    // an epoch without a single step or transfer means every node is halted,
+    // or blocked with no transfer that could ever complete, or past the
+    // deadline.
+    if (!done && fab->transfers == transfers)
+      return fab->queue.nlate ? S_DEADLINE : S_HALT;
+    *steps += done;
+    if (max_secs > 0 && elapsed(&start) >= max_secs) return S_TIMEOUT;
+  }
+}
@@ -0,0 +1,379 @@
+/*
+ * Copyright (c) 2013, Matt Hellige
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above copyright 
+ *   notice, this list of conditions and the following disclaimer in the 
+ *   documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT 
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// reverse execution. while a node keeps a history, it takes a checkpoint of
+// its state every so many steps, and logs every value it reads from outside
+// itself (see iomap.c). going back is a matter of restoring the last
+// checkpoint before the step wanted and running forward from it: the node is
+// deterministic given its inputs, so the rerun takes exactly the same path,
+// and the writes it makes have been seen already, so they go nowhere.
+//
+// steps are counted from the start of the history, and the furthest step
+// reached is the frontier. short of it the node is rerunning, whatever runs
+// it, and its inputs come from the log; slices stop at the frontier so that
+// it goes live again exactly there. checkpoints are only ever taken at the
+// frontier, so they never have to be replaced.
+//
+// most of a checkpoint is the same as the one before, so only the first of
+// every KEY_EVERY is whole, and the rest hold just the words of the state
+// that changed. once the checkpoints and inputs take more than the limit, the
+// oldest run of them, from one whole checkpoint to the next, is dropped.
+// inputs are kept as runs of the same value, since a node mostly polls.
+// recording costs one slice boundary per interval, and a little per input.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "f18a.h"
+
+#define KEY_EVERY 16
+
+typedef struct {
+  u32 val;
+  u32 count;
+} input_t; // a run of the same value
+
+// how far through the inputs: off values into the given run. off may be the
+// whole of the run, which may have grown since.
+typedef struct {
+  u64 run;
+  u32 off;
+} place_t;
+
+typedef struct {
+  u64 step;
+  place_t input; // inputs taken by then
+  bool key; // whole, or (index, word) pairs of what changed since the last
+  u32 words; // of data
+  u32 *data;
+} checkpoint_t;
+
+typedef struct history_t {
+  u64 interval; // steps between checkpoints
+  size_t limit; // bytes, roughly
+  size_t used;
+  u64 step; // where the node is
+  u64 frontier;
+  checkpoint_t *points; // oldest first
+  int n, cap;
+  int run; // checkpoints since the last whole one
+  u32 *last; // the state at the newest checkpoint
+  u32 *state; // scratch
+  input_t *inputs; // from run base on
+  u64 base;
+  u64 ninputs; // runs taken by the frontier
+  u64 cap_inputs;
+  place_t at; // inputs taken by now
+  bool broken; // out of memory
+} history_t;
+
+
+static void drop(checkpoint_t *point, history_t *h) {
+  h->used -= point->words * sizeof(u32);
+  free(point->data);
+}
+
+
+// drop the oldest run of checkpoints while over the limit, keeping at least
+// the newest run, and then the inputs from before the oldest left
+static void trim(history_t *h) {
+  while (h->used > h->limit) {
+    int k = 1;
+    while (k < h->n && !h->points[k].key) k++;
+    if (k == h->n) break;
+    for (int i = 0; i < k; i++) drop(&h->points[i], h);
+    h->n -= k;
+    memmove(h->points, h->points + k, h->n * sizeof(checkpoint_t));
+    u64 gone = h->points[0].input.run - h->base;
+    memmove(h->inputs, h->inputs + gone,
+        (h->ninputs - h->points[0].input.run) * sizeof(input_t));
+    h->base += gone;
+    h->used -= gone * sizeof(input_t);
+  }
+}
+
+
+// take a checkpoint, now, at the frontier
+static bool checkpoint(f18a *f, history_t *h) {
+  if (h->n == h->cap) {
+    int cap = h->cap ? 2 * h->cap : 64;
+    checkpoint_t *points = realloc(h->points, cap * sizeof(checkpoint_t));
+    if (!points) return false;
+    h->points = points;
+    h->cap = cap;
+  }
+  f18a_savestate(f, h->state);
+  checkpoint_t *point = &h->points[h->n];
+  *point = (checkpoint_t){h->step, h->at, !h->n || h->run == KEY_EVERY, 0,
+    NULL};
+  if (point->key) {
+    point->words = f18a_statewords;
+  } else {
+    for (u32 i = 0; i < f18a_statewords; i++)
+      if (h->state[i] != h->last[i]) point->words += 2;
+  }
+  if (point->words && !(point->data = malloc(point->words * sizeof(u32))))
+    return false;
+  if (point->key) {
+    memcpy(point->data, h->state, f18a_statewords * sizeof(u32));
+    h->run = 0;
+  } else {
+    u32 *out = point->data;
+    for (u32 i = 0; i < f18a_statewords; i++) {
+      if (h->state[i] == h->last[i]) continue;
+      *out++ = i;
+      *out++ = h->state[i];
+    }
+  }
+  memcpy(h->last, h->state, f18a_statewords * sizeof(u32));
+  h->run++;
+  h->n++;
+  h->used += point->words * sizeof(u32);
+  trim(h);
+  return true;
+}
+
+
+// back to checkpoint j
+static void restore(f18a *f, history_t *h, int j) {
+  int k = j;
+  while (!h->points[k].key) k--;
+  memcpy(h->state, h->points[k].data, f18a_statewords * sizeof(u32));
+  for (int i = k + 1; i <= j; i++) {
+    const checkpoint_t *point = &h->points[i];
+    for (u32 w = 0; w < point->words; w += 2)
+      h->state[point->data[w]] = point->data[w + 1];
+  }
+  f18a_loadstate(f, h->state);
+  h->step = h->points[j].step;
+  h->at = h->points[j].input;
+}
+
+
+// the last checkpoint at or before step
+static int before(const history_t *h, u64 step) {
+  int lo = 0, hi = h->n - 1;
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if (h->points[mid].step <= step) lo = mid;
+    else hi = mid - 1;
+  }
+  return lo;
+}
+
+
+// run forward to target, which must not be past the frontier, going over any
+// points. *hit is the last step at which one would have stopped the node.
+static void rerun(f18a *f, history_t *h, u64 target, u64 *hit) {
+  while (h->step < target) {
+    u64 slice = target - h->step, budget = slice;
+    action_t action = f18a_stepn(f, &budget);
+    h->step += slice - budget;
+    if (action == A_BREAK) {
+      *hit = h->step;
+      action = f18a_stepover(f);
+      if (action == A_CONTINUE) h->step++;
+    }
+    if (action != A_CONTINUE) return; // not that it ever could, the first time
+  }
+}
+
+
+bool f18a_histon(f18a *f, u64 interval, size_t limit) {
+  f18a_histoff(f);
+  history_t *h = calloc(1, sizeof(history_t));
+  if (h) {
+    h->last = malloc(f18a_statewords * sizeof(u32));
+    h->state = malloc(f18a_statewords * sizeof(u32));
+  }
+  u64 none = 0;
+  f18a_stepn(f, &none); // so that every checkpoint falls between steps
+  if (h) {
+    h->interval = interval ? interval : 1;
+    h->limit = limit;
+    f->history = h;
+  }
+  if (!h || !h->last || !h->state || !checkpoint(f, h)) {
+    f18a_hosterr(f->host, "unable to allocate a history\n");
+    f18a_histoff(f);
+    return false;
+  }
+  return true;
+}
+
+
+void f18a_histoff(f18a *f) {
+  history_t *h = f->history;
+  if (!h) return;
+  for (int i = 0; i < h->n; i++) drop(&h->points[i], h);
+  free(h->points);
+  free(h->last);
+  free(h->state);
+  free(h->inputs);
+  free(h);
+  f->history = NULL;
+}
+
+
+// run as engine would, but keeping the history. slices end at every
+// checkpoint and at the frontier.
+action_t f18a_forward(f18a *f, engine_t engine, u64 *budget) {
+  history_t *h = f->history;
+  if (!h) return engine(f, budget);
+  action_t action = A_CONTINUE;
+  while (*budget && action == A_CONTINUE) {
+    u64 slice = h->interval - h->step % h->interval;
+    if (h->step < h->frontier && h->frontier - h->step < slice)
+      slice = h->frontier - h->step;
+    if (*budget < slice) slice = *budget;
+    u64 left = slice;
+    action = engine(f, &left);
+    h->step += slice - left;
+    *budget -= slice - left;
+    if (h->step <= h->frontier) continue;
+    h->frontier = h->step;
+    if (h->broken || (h->step % h->interval == 0 && !checkpoint(f, h))) {
+      f18a_hosterr(f->host, "unable to extend the history; dropping it\n");
+      f18a_histoff(f);
+      return engine(f, budget);
+    }
+  }
+  return action;
+}
+
+
+static action_t stepover(f18a *f, u64 *budget) {
+  action_t action = f18a_stepover(f);
+  if (action == A_CONTINUE) --*budget;
+  return action;
+}
+
+
+static action_t step(f18a *f, u64 *budget) {
+  action_t action = f18a_step(f);
+  if (action == A_CONTINUE) --*budget;
+  return action;
+}
+
+
+// take one step, going over any point that stops the node here if over
+action_t f18a_advance(f18a *f, bool over) {
+  u64 one = 1;
+  return f18a_forward(f, over ? stepover : step, &one);
+}
+
+
+// go back steps steps, or as far as the history goes. returns how far it went.
+u64 f18a_rewind(f18a *f, u64 steps) {
+  history_t *h = f->history;
+  if (!h) return 0;
+  u64 now = h->step, first = h->points[0].step;
+  u64 target = now - first < steps ? first : now - steps;
+  u64 hit;
+  restore(f, h, before(h, target));
+  rerun(f, h, target, &hit);
+  return now - target;
+}
+
+
+// go back to the last step at which a point stopped (or would have stopped)
+// the node, and stop there again. A_CONTINUE if there's none in the history,
+// which leaves the node at its start.
+action_t f18a_reverse(f18a *f) {
+  history_t *h = f->history;
+  if (!h) return A_CONTINUE;
+  u64 now = h->step;
+  if (now == h->points[0].step) return A_CONTINUE;
+  for (int j = before(h, now - 1); j >= 0; j--) {
+    u64 end = j + 1 < h->n && h->points[j + 1].step < now
+      ? h->points[j + 1].step : now;
+    u64 hit = now;
+    restore(f, h, j);
+    rerun(f, h, end, &hit);
+    if (hit == now) continue;
+    u64 ignored;
+    restore(f, h, j);
+    rerun(f, h, hit, &ignored);
+    return f18a_step(f); // which stops here again, and says why
+  }
+  restore(f, h, 0);
+  return A_CONTINUE;
+}
+
+
+// whether the node is rerunning steps it's taken before, so that its writes
+// are nothing new
+bool f18a_rerunning(const f18a *f) {
+  return f->history->step < f->history->frontier;
+}
+
+
+// what the rerunning node read from outside itself at this point before
+u32 f18a_recall(f18a *f) {
+  history_t *h = f->history;
+  place_t *at = &h->at;
+  while (at->run < h->ninputs && at->off == h->inputs[at->run - h->base].count)
+    *at = (place_t){at->run + 1, 0};
+  if (at->run == h->ninputs) return 0;
+  at->off++;
+  return h->inputs[at->run - h->base].val;
+}
+
+
+// a value the node just read from outside, live
+void f18a_remember(f18a *f, u32 val) {
+  history_t *h = f->history;
+  input_t *last = h->ninputs > h->base ? &h->inputs[h->ninputs - 1 - h->base]
+    : NULL;
+  if (last && last->val == val && last->count < UINT32_MAX) {
+    h->at.off = ++last->count;
+    return;
+  }
+  if (h->ninputs - h->base == h->cap_inputs) {
+    u64 cap = h->cap_inputs ? 2 * h->cap_inputs : 1024;
+    input_t *inputs = realloc(h->inputs, cap * sizeof(input_t));
+    if (!inputs) {
+      h->broken = true; // f18a_forward drops it
+      return;
+    }
+    h->inputs = inputs;
+    h->cap_inputs = cap;
+  }
+  h->inputs[h->ninputs++ - h->base] = (input_t){val, 1};
+  h->at = (place_t){h->ninputs - 1, 1};
+  h->used += sizeof(input_t);
+}
+
+
+void f18a_histinfo(const f18a *f, u64 *first, u64 *now, u64 *last,
+    size_t *bytes) {
+  const history_t *h = f->history;
+  *first = h->points[0].step;
+  *now = h->step;
+  *last = h->frontier;
+  *bytes = h->used;
+}
@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2013, Matt Hellige
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above copyright 
+ *   notice, this list of conditions and the following disclaimer in the 
+ *   documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT 
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// image containers: the code for any number of nodes of a fabric in one
+// file, which is mapped rather than read, so that opening one costs the same
+// however many nodes it holds. a node's code is only copied out (and its
+// checksum checked) when it's first needed, which in a fabric is when the
+// node is first run (see fabric.c).
+//
+// a container is a header, a table of nodes, a table of rom sections, and
+// then the sections themselves, each RAM_WORDS or ROM_WORDS u32s. nodes
+// sharing a rom (as most do) share a single section. everything is u32s in
+// host byte order, as in a snapshot, and a container from a host of the other
+// byte order fails the magic check. the header and tables are covered by one
+// checksum, checked on opening, and each section has its own.
+//
+// the flat images ffas writes (RAM_WORDS then ROM_WORDS big-endian words,
+// for a single node) are still loaded by f18a_loadcore, which also takes a
+// container holding just one node. read as a flat image, the magic would be
+// out of range, so the two can't be confused.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "f18a.h"
+
+#define IMAGE_MAGIC 0x66313863 // "f18c"
+#define IMAGE_VERSION 1
+
+typedef struct {
+  u32 magic;
+  u32 version;
+  u32 nodes; // entries in the node table, which follows
+  u32 roms; // entries in the rom table, which follows that
+  u32 sum; // of the header, with sum 0, and both tables
+  u32 unused;
+} header_t;
+
+typedef struct {
+  u32 id; // yxx within a fabric
+  u32 p, a, b, io, r, t, s; // registers at boot
+  u32 ram; // offset of the ram section, in bytes from the start of the file
+  u32 sum; // of the ram section
+  u32 rom; // index in the rom table
+  u32 unused;
+} entry_t;
+
+typedef struct {
+  u32 offset; // of the section, in bytes from the start of the file
+  u32 sum;
+} romentry_t;
+
+struct image_t {
+  const u8 *base;
+  size_t size;
+  const header_t *hdr;
+  const entry_t *nodes;
+  const romentry_t *roms;
+  char *path;
+  f18a_host *host;
+};
+
+
+// fnv-1a, a word at a time: cheap, and good enough to catch a damaged or
+// truncated file, which is all it's for
+static u32 checksum(u32 sum, const u32 *w, size_t n) {
+  for (size_t k = 0; k < n; k++) {
+    sum ^= w[k];
+    sum *= 16777619u;
+  }
+  return sum;
+}
+
+#define SUM_SEED 2166136261u
+
+
+static u32 tablesum(const header_t *hdr, const entry_t *nodes,
+    const romentry_t *roms) {
+  header_t h = *hdr;
+  h.sum = 0;
+  u32 sum = checksum(SUM_SEED, (const u32 *)&h, sizeof(h) / 4);
+  sum = checksum(sum, (const u32 *)nodes, hdr->nodes * sizeof(entry_t) / 4);
+  return checksum(sum, (const u32 *)roms, hdr->roms * sizeof(romentry_t) / 4);
+}
+
+
+// true if n words at offset lie within the file
+static bool inside(const struct image_t *img, u32 offset, size_t n) {
+  return !(offset % 4) && offset <= img->size
+    && n * 4 <= img->size - offset;
+}
+
+
+bool f18a_isimage(const char *path) {
+  u32 magic;
+  FILE *in = fopen(path, "rb");
+  if (!in) return false;
+  bool ok = fread(&magic, sizeof(magic), 1, in) == 1 && magic == IMAGE_MAGIC;
+  fclose(in);
+  return ok;
+}
+
+
+// only the header and tables are checked here; sections are checked as
+// they're materialized
+struct image_t *f18a_openimage(f18a_host *host, const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    f18a_hosterr(host, "error reading image '%s': %s\n", path,
+        strerror(errno));
+    return NULL;
+  }
+  struct image_t *img = calloc(1, sizeof(*img));
+  struct stat st;
+  const u8 *base = MAP_FAILED;
+  bool big = !fstat(fd, &st) && st.st_size >= (off_t)sizeof(header_t);
+  if (img && big) {
+    img->size = st.st_size;
+    base = mmap(NULL, img->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (base == MAP_FAILED) {
+    f18a_hosterr(host, "error reading image '%s': %s\n", path,
+        !img ? "out of memory" : big ? strerror(errno) : "too short");
+    free(img);
+    return NULL;
+  }
+  img->base = base;
+  img->host = host;
+  img->hdr = (const header_t *)base;
+  img->nodes = (const entry_t *)(img->hdr + 1);
+  img->roms = (const romentry_t *)(img->nodes + img->hdr->nodes);
+
+  const header_t *hdr = img->hdr;
+  bool ok = hdr->magic == IMAGE_MAGIC && hdr->version == IMAGE_VERSION;
+  if (!ok) {
+    f18a_hosterr(host, "'%s' is not a version %d image container\n", path,
+        IMAGE_VERSION);
+  } else {
+    size_t table = (sizeof(entry_t) * (size_t)hdr->nodes
+        + sizeof(romentry_t) * (size_t)hdr->roms) / 4;
+    ok = hdr->nodes <= FABRIC_NODES && hdr->roms <= hdr->nodes
+      && inside(img, sizeof(header_t), table)
+      && tablesum(hdr, img->nodes, img->roms) == hdr->sum;
+    for (u32 k = 0; ok && k < hdr->nodes; k++) {
+      const entry_t *e = &img->nodes[k];
+      ok = fabric_index(e->id) >= 0 && e->rom < hdr->roms
+        && inside(img, e->ram, RAM_WORDS);
+    }
+    for (u32 k = 0; ok && k < hdr->roms; k++)
+      ok = inside(img, img->roms[k].offset, ROM_WORDS);
+    if (!ok) f18a_hosterr(host, "image container '%s' is damaged\n", path);
+  }
+  if (ok) ok = (img->path = strdup(path)) != NULL;
+  if (!ok) {
+    munmap((void *)base, img->size);
+    free(img);
+    return NULL;
+  }
+  return img;
+}
+
+
+void f18a_closeimage(struct image_t *img) {
+  if (!img) return;
+  munmap((void *)img->base, img->size);
+  free(img->path);
+  free(img);
+}
+
+
+int f18a_imagenodes(const struct image_t *img) {
+  return img->hdr->nodes;
+}
+
+
+int f18a_imageid(const struct image_t *img, int k) {
+  return img->nodes[k].id;
+}
+
+
+static bool section(const struct image_t *img, u32 offset, int n, u32 sum,
+    u32 *out) {
+  const u32 *w = (const u32 *)(img->base + offset);
+  if (checksum(SUM_SEED, w, n) != sum) return false;
+  for (int i = 0; i < n; i++)
+    if (w[i] & ~MAX_VAL) return false;
+  memcpy(out, w, n * sizeof(u32));
+  return true;
+}
+
+
+// copies the k'th node of a container into f18a, leaving the rest of its
+// state (ports, devices and so on) as it is. on a bad checksum, complains
+// and returns false, and the node's memory is left in an unspecified state.
+bool f18a_materialize(f18a *f18a, const struct image_t *img, int k) {
+  const entry_t *e = &img->nodes[k];
+  const romentry_t *rom = &img->roms[e->rom];
+  if (!section(img, e->ram, RAM_WORDS, e->sum, f18a->ram)
+      || !section(img, rom->offset, ROM_WORDS, rom->sum, f18a->rom)) {
+    f18a_hosterr(img->host, "node %03d in image container '%s' is damaged\n",
+        e->id, img->path);
+    return false;
+  }
+  f18a->p = e->p & (P9 | ADDR_MASK);
+  f18a->a = e->a & MAX_VAL;
+  f18a->b = e->b & ADDR_MASK;
+  f18a->io = e->io & MAX_VAL;
+  f18a->r = e->r & MAX_VAL;
+  f18a->t = e->t & MAX_VAL;
+  f18a->s = e->s & MAX_VAL;
+  f18a->slot = 4;
+  f18a_flushcache(f18a);
+  return true;
+}
+
+
+// writes the given nodes, booting from their current registers and memory,
+// to a container. ids are yxx, one per node.
+bool f18a_writeimage(f18a_host *host, const char *path,
+    const f18a *const *nodes, const int *ids, int n) {
+  if (n < 0 || n > FABRIC_NODES) {
+    f18a_hosterr(host, "can't write %d nodes to an image container\n", n);
+    return false;
+  }
+  header_t hdr = {.magic = IMAGE_MAGIC, .version = IMAGE_VERSION, .nodes = n};
+  entry_t entries[FABRIC_NODES];
+  romentry_t roms[FABRIC_NODES];
+  int first[FABRIC_NODES]; // node whose rom each rom section holds
+  memset(entries, 0, sizeof(entries));
+
+  u32 offset = sizeof(hdr) + n * sizeof(entry_t);
+  for (int k = 0; k < n; k++) {
+    const f18a *f = nodes[k];
+    u32 r = 0;
+    while (r < hdr.roms
+        && memcmp(nodes[first[r]]->rom, f->rom, sizeof(f->rom)))
+      r++;
+    if (r == hdr.roms) {
+      first[r] = k;
+      roms[r].sum = checksum(SUM_SEED, f->rom, ROM_WORDS);
+      hdr.roms++;
+    }
+    entry_t *e = &entries[k];
+    e->id = ids[k];
+    e->p = f->p;
+    e->a = f->a;
+    e->b = f->b;
+    e->io = f->io;
+    e->r = f->r;
+    e->t = f->t;
+    e->s = f->s;
+    e->sum = checksum(SUM_SEED, f->ram, RAM_WORDS);
+    e->rom = r;
+  }
+  offset += hdr.roms * sizeof(romentry_t);
+  for (int k = 0; k < n; k++, offset += RAM_WORDS * sizeof(u32))
+    entries[k].ram = offset;
+  for (u32 r = 0; r < hdr.roms; r++, offset += ROM_WORDS * sizeof(u32))
+    roms[r].offset = offset;
+  hdr.sum = tablesum(&hdr, entries, roms);
+
+  FILE *out = fopen(path, "wb");
+  bool ok = out && fwrite(&hdr, sizeof(hdr), 1, out) == 1
+    && fwrite(entries, sizeof(entry_t), n, out) == (size_t)n
+    && fwrite(roms, sizeof(romentry_t), hdr.roms, out) == hdr.roms;
+  for (int k = 0; ok && k < n; k++)
+    ok = fwrite(nodes[k]->ram, sizeof(u32), RAM_WORDS, out) == RAM_WORDS;
+  for (u32 r = 0; ok && r < hdr.roms; r++)
+    ok = fwrite(nodes[first[r]]->rom, sizeof(u32), ROM_WORDS, out) == ROM_WORDS;
+  if (out && fclose(out)) ok = false;
+  if (!ok)
+    f18a_hosterr(host, "error writing image container '%s': %s\n", path,
+        strerror(errno));
+  return ok;
+}
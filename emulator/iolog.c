@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2013, Matt Hellige
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above copyright 
+ *   notice, this list of conditions and the following disclaimer in the 
+ *   documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT 
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// record and replay of everything a node takes from outside itself: reads of
+// the io register while the host or a device drives it, and reads of
+// devices. recording costs a few bytes per such read and nothing elsewhere.
+// a replay attaches a device of its own at every address in the log, which
+// gives back the logged values in order, so the run needs none of the live
+// inputs and goes exactly as it did, on any engine. as a check, each read must
+// be of the logged address at the logged simulated time, and the first that
+// isn't is reported.
+//
+// see f18a.h for the file format.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "f18a.h"
+
+#define BUF_BYTES (1 << 16)
+#define MAX_BYTES 15 // encoded, for any one record
+
+
+typedef struct iolog_t {
+  bool replay;
+  const char *path;
+  u64 records;
+  tstamp_t last; // time of the record before
+  u32 addr; // and its address
+  // recording
+  FILE *out;
+  bool failed;
+  u32 n;
+  u8 buf[BUF_BYTES];
+  // replaying
+  f18a_device dev;
+  const u8 *data;
+  size_t size;
+  size_t at;
+  bool diverged;
+} iolog_t;
+
+
+static u8 *varint(u8 *out, u64 val) {
+  while (val >= 0x80) {
+    *out++ = val | 0x80;
+    val >>= 7;
+  }
+  *out++ = val;
+  return out;
+}
+
+
+// returns false if the data runs out first
+static bool unvarint(const u8 *data, size_t size, size_t *at, u64 *val) {
+  *val = 0;
+  for (int shift = 0; *at < size && shift < 64; shift += 7) {
+    u8 byte = data[(*at)++];
+    *val |= (u64)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) return true;
+  }
+  return false;
+}
+
+
+static void flush(iolog_t *log) {
+  if (!log->failed && fwrite(log->buf, 1, log->n, log->out) != log->n)
+    log->failed = true;
+  log->n = 0;
+}
+
+
+bool f18a_record(f18a *f, const char *path) {
+  FILE *out = fopen(path, "w");
+  if (!out) {
+    f18a_hosterr(f->host, "error opening '%s': %s\n", path, strerror(errno));
+    return false;
+  }
+  iologheader_t header = {.magic = IOLOG_MAGIC, .version = IOLOG_VERSION};
+  iolog_t *log = calloc(1, sizeof(iolog_t));
+  if (!log || fwrite(&header, sizeof(header), 1, out) != 1) {
+    f18a_hosterr(f->host, "unable to start an io log in '%s'\n", path);
+    free(log);
+    fclose(out);
+    return false;
+  }
+  log->out = out;
+  log->path = path;
+  log->last = f->time;
+  f->iolog = log;
+  return true;
+}
+
+
+// a read of addr has given val, from outside the node
+void f18a_logio(f18a *f, u32 addr, u32 val) {
+  iolog_t *log = f->iolog;
+  if (log->replay) return;
+  u8 *out = log->buf + log->n;
+  out = varint(out, (f->time - log->last) << 1 | (addr != log->addr));
+  if (addr != log->addr) out = varint(out, addr);
+  out = varint(out, val);
+  log->n = out - log->buf;
+  log->last = f->time;
+  log->addr = addr;
+  log->records++;
+  if (log->n > BUF_BYTES - MAX_BYTES) flush(log);
+}
+
+
+// decode the record at *at, after one of last and addr
+static bool decode(const iolog_t *log, size_t *at, tstamp_t *last, u32 *addr,
+    u64 *val) {
+  u64 delta, logged = *addr;
+  if (!unvarint(log->data, log->size, at, &delta)
+      || (delta & 1 && !unvarint(log->data, log->size, at, &logged))
+      || !unvarint(log->data, log->size, at, val))
+    return false;
+  *last += delta >> 1;
+  *addr = logged;
+  return true;
+}
+
+
+// the next logged value, which should be a read of addr, now
+static u32 next(f18a *f, iolog_t *log, u32 addr) {
+  u64 val;
+  if (!decode(log, &log->at, &log->last, &log->addr, &val)) {
+    if (!log->diverged)
+      f18a_hosterr(f->host, "io log '%s' ran out at %llu ps\n", log->path,
+          (unsigned long long)f->time);
+    log->diverged = true;
+    log->at = log->size;
+    return 0;
+  }
+  if (!log->diverged && (log->addr != addr || log->last != f->time)) {
+    f18a_hosterr(f->host, "replay of '%s' diverged at record %llu: a read of "
+        "0x%03x at %llu ps, but 0x%03x at %llu ps in the log\n", log->path,
+        (unsigned long long)log->records, addr, (unsigned long long)f->time,
+        log->addr, (unsigned long long)log->last);
+    log->diverged = true;
+  }
+  log->records++;
+  return val;
+}
+
+
+static u32 replayread(f18a_device *dev, f18a *f, u32 addr) {
+  return next(f, dev->data, addr);
+}
+
+
+static u32 replaystatus(f18a_device *dev, f18a *f, u32 io) {
+  (void)io;
+  return next(f, dev->data, IO_ADDR);
+}
+
+
+bool f18a_replay(f18a *f, const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    f18a_hosterr(f->host, "error reading io log '%s': %s\n", path,
+        strerror(errno));
+    return false;
+  }
+  struct stat st;
+  const u8 *data = MAP_FAILED;
+  bool big = !fstat(fd, &st) && st.st_size >= (off_t)sizeof(iologheader_t);
+  if (big) data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    f18a_hosterr(f->host, "error reading io log '%s': %s\n", path,
+        big ? strerror(errno) : "too short");
+    return false;
+  }
+  const iologheader_t *header = (const iologheader_t *)data;
+  iolog_t *log = NULL;
+  if (header->magic != IOLOG_MAGIC || header->version != IOLOG_VERSION
+      || !(log = calloc(1, sizeof(iolog_t)))) {
+    f18a_hosterr(f->host, "'%s' is not a version %d io log\n", path,
+        IOLOG_VERSION);
+    munmap((void *)data, st.st_size);
+    return false;
+  }
+  log->replay = true;
+  log->path = path;
+  log->data = data;
+  log->size = st.st_size;
+  log->at = sizeof(iologheader_t);
+  log->last = f->time;
+  log->dev = (f18a_device){.read = replayread, .status = replaystatus,
+    .data = log};
+
+  // every address in the log goes to the replay
+  bool logged[ADDR_MASK + 1] = {false};
+  size_t at = log->at;
+  tstamp_t last = 0;
+  u32 addr = 0;
+  u64 val;
+  while (decode(log, &at, &last, &addr, &val)) logged[addr & ADDR_MASK] = true;
+  f->iolog = log;
+  for (u32 a = 0; a <= ADDR_MASK; a++)
+    if (logged[a] && !f18a_attach(f, &log->dev, a, 1)) return false;
+  return true;
+}
+
+
+bool f18a_iologclose(f18a *f) {
+  iolog_t *log = f->iolog;
+  if (!log) return true;
+  bool ok = true;
+  if (log->replay) {
+    f18a_detach(f, &log->dev);
+    munmap((void *)log->data, log->size);
+  } else {
+    flush(log);
+    iologheader_t header = {.magic = IOLOG_MAGIC, .version = IOLOG_VERSION,
+      .records = log->records};
+    ok = !log->failed && !fseek(log->out, 0, SEEK_SET)
+      && fwrite(&header, sizeof(header), 1, log->out) == 1;
+    ok = !fclose(log->out) && ok;
+    if (!ok) f18a_hosterr(f->host, "error writing io log '%s'\n", log->path);
+  }
+  free(log);
+  f->iolog = NULL;
+  return ok;
+}
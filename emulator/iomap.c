@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2013, Matt Hellige
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above copyright 
+ *   notice, this list of conditions and the following disclaimer in the 
+ *   documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT 
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// the address map of a node, and the devices attached to it. every access
+// that doesn't go to ram or rom is dispatched on map[addr] (see f18a_read in
+// emulator.c), so a device costs nothing until it's touched. timed devices
+// don't get polled either: they schedule events, and the events that are due
+// run whenever the node next touches the io register or a device, which is
+// the first anything could see of them.
+
+#include <stdlib.h>
+
+#include "f18a.h"
+
+#define MAX_DEVICES 16 // an index must fit in the high bits of a map entry
+#define MAX_EVENTS 64
+
+typedef struct {
+  tstamp_t when;
+  f18a_device *dev;
+  u64 arg;
+} event_t;
+
+typedef struct devices_t {
+  f18a_device *devs[MAX_DEVICES]; // by index, NULL where free
+  u16 io; // bit per device sharing the io register
+  event_t queue[MAX_EVENTS]; // a heap, soonest first
+  int events;
+} devices_t;
+
+
+// comm port addresses are 1xxxx0101, where the four x bits select right,
+// down, left and up respectively, with down and up active low. any
+// combination may be addressed at once.
+static u8 portmask(u32 addr) {
+  if ((addr & 0x10f) != 0x105) return 0;
+  return ((addr >> 7) & PORT_R) | ((~addr >> 5) & PORT_D)
+    | ((addr >> 3) & PORT_L) | ((~addr >> 1) & PORT_U);
+}
+
+
+// ...and the address of the given ports, the other way round
+u32 f18a_portaddr(u8 ports) {
+  return 0x105 | (ports & PORT_R) << 7 | (~ports & PORT_D) << 5
+    | (ports & PORT_L) << 3 | (~ports & PORT_U) << 1;
+}
+
+
+static u8 kind(u32 addr) {
+  if (addr < 0x080) return M_RAM;
+  if (addr < 0x100) return M_ROM;
+  if (addr == IO_ADDR) return M_IO;
+  if (portmask(addr)) return M_PORT | portmask(addr) << 4;
+  return M_NONE;
+}
+
+
+void f18a_mapinit(f18a *f) {
+  for (u32 addr = 0; addr <= ADDR_MASK; addr++) f->map[addr] = kind(addr);
+  f->devices = NULL;
+}
+
+
+// wire dev to count addresses from addr, all in the io range. IO_ADDR itself
+// is shared (see f18a_device); any other address can go to only one device.
+// count may be 0, for a device that only schedules events, and a device may
+// be attached again, to more addresses.
+bool f18a_attach(f18a *f, f18a_device *dev, u32 addr, u32 count) {
+  for (u32 a = addr; a < addr + count; a++) {
+    if (a > ADDR_MASK || !(a & 0x100) || (f->map[a] & 0xf) == M_DEVICE) {
+      f18a_hosterr(f->host, "can't attach a device at 0x%03x\n", a);
+      return false;
+    }
+  }
+  devices_t *ds = f->devices;
+  if (!ds && !(ds = f->devices = calloc(1, sizeof(devices_t)))) {
+    f18a_hosterr(f->host, "unable to allocate devices\n");
+    return false;
+  }
+  int k = 0;
+  while (k < MAX_DEVICES && ds->devs[k] != dev) k++;
+  if (k == MAX_DEVICES) k = 0;
+  while (k < MAX_DEVICES && ds->devs[k] && ds->devs[k] != dev) k++;
+  if (k == MAX_DEVICES) {
+    f18a_hosterr(f->host, "too many devices\n");
+    return false;
+  }
+  ds->devs[k] = dev;
+  for (u32 a = addr; a < addr + count; a++) {
+    if (a == IO_ADDR) ds->io |= 1 << k;
+    else f->map[a] = M_DEVICE | k << 4;
+  }
+  return true;
+}
+
+
+static void down(devices_t *ds, int i) {
+  for (;;) {
+    int least = i;
+    for (int c = 2 * i + 1; c <= 2 * i + 2 && c < ds->events; c++)
+      if (ds->queue[c].when < ds->queue[least].when) least = c;
+    if (least == i) return;
+    event_t tmp = ds->queue[i];
+    ds->queue[i] = ds->queue[least];
+    ds->queue[least] = tmp;
+    i = least;
+  }
+}
+
+
+void f18a_detach(f18a *f, f18a_device *dev) {
+  devices_t *ds = f->devices;
+  int k = 0;
+  while (ds && k < MAX_DEVICES && ds->devs[k] != dev) k++;
+  if (!ds || k == MAX_DEVICES) return;
+  ds->devs[k] = NULL;
+  ds->io &= ~(1 << k);
+  for (u32 a = 0x100; a <= ADDR_MASK; a++)
+    if (f->map[a] == (M_DEVICE | k << 4)) f->map[a] = kind(a);
+  int n = 0;
+  for (int i = 0; i < ds->events; i++)
+    if (ds->queue[i].dev != dev) ds->queue[n++] = ds->queue[i];
+  ds->events = n;
+  for (int i = n / 2 - 1; i >= 0; i--) down(ds, i);
+}
+
+
+// free every device still attached, and the table
+void f18a_mapfree(f18a *f) {
+  devices_t *ds = f->devices;
+  if (!ds) return;
+  for (int k = 0; k < MAX_DEVICES; k++)
+    if (ds->devs[k]) f18a_devfree(f, ds->devs[k]);
+  free(ds);
+  f->devices = NULL;
+}
+
+
+// run dev's event at when, with arg. if when has passed, it runs at the
+// next access.
+bool f18a_schedule(f18a *f, f18a_device *dev, tstamp_t when, u64 arg) {
+  devices_t *ds = f->devices;
+  if (!ds || ds->events == MAX_EVENTS) {
+    f18a_hosterr(f->host, "too many device events\n");
+    return false;
+  }
+  int i = ds->events++;
+  while (i && ds->queue[(i - 1) / 2].when > when) {
+    ds->queue[i] = ds->queue[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  ds->queue[i] = (event_t){when, dev, arg};
+  return true;
+}
+
+
+// run the events that are due, soonest first. they may schedule more.
+static void events(f18a *f, devices_t *ds) {
+  while (ds->events && ds->queue[0].when <= f->time) {
+    event_t ev = ds->queue[0];
+    ds->queue[0] = ds->queue[--ds->events];
+    down(ds, 0);
+    if (ev.dev->event) ev.dev->event(ev.dev, f, ev.when, ev.arg);
+  }
+}
+
+
+u32 f18a_ioread(f18a *f) {
+  bool host = f->host && f->host->ioread;
+  devices_t *ds = f->devices;
+  // the value only comes from outside if something drives the register
+  bool outside = host || (ds && ds->io);
+  if (f->history && f18a_rerunning(f)) return outside ? f18a_recall(f) : f->io;
+  u32 val = host ? f->host->ioread(f->host, f) : f->io;
+  if (ds) {
+    events(f, ds);
+    for (int k = 0; k < MAX_DEVICES; k++)
+      if (ds->io & (1 << k) && ds->devs[k]->status)
+        val = ds->devs[k]->status(ds->devs[k], f, val);
+  }
+  if (outside && f->iolog) f18a_logio(f, IO_ADDR, val);
+  if (outside && f->history) f18a_remember(f, val);
+  return val;
+}
+
+
+// TODO is this right?
+void f18a_iowrite(f18a *f, u32 val) {
+  f->io = val;
+  if (f->history && f18a_rerunning(f)) return; // it's been seen once
+  if (f->host && f->host->iowrite) f->host->iowrite(f->host, f, val);
+  devices_t *ds = f->devices;
+  if (!ds) return;
+  events(f, ds);
+  for (int k = 0; k < MAX_DEVICES; k++)
+    if (ds->io & (1 << k) && ds->devs[k]->write)
+      ds->devs[k]->write(ds->devs[k], f, IO_ADDR, val);
+}
+
+
+// an access to an address mapped to device k. devices never block.
+bool f18a_devread(f18a *f, u8 k, u32 addr, u32 *val) {
+  if (f->history && f18a_rerunning(f)) {
+    *val = f18a_recall(f);
+    return true;
+  }
+  devices_t *ds = f->devices;
+  events(f, ds);
+  f18a_device *dev = ds->devs[k];
+  *val = dev->read ? dev->read(dev, f, addr) & MAX_VAL : 0;
+  if (f->iolog) f18a_logio(f, addr, *val);
+  if (f->history) f18a_remember(f, *val);
+  return true;
+}
+
+
+bool f18a_devwrite(f18a *f, u8 k, u32 addr, u32 val) {
+  if (f->history && f18a_rerunning(f)) return true;
+  devices_t *ds = f->devices;
+  events(f, ds);
+  f18a_device *dev = ds->devs[k];
+  if (dev->write) dev->write(dev, f, addr, val);
+  return true;
+}
@@ -0,0 +1,1017 @@
+/*
+ * Copyright (c) 2013, Matt Hellige
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above copyright 
+ *   notice, this list of conditions and the following disclaimer in the 
+ *   documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT 
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// a dynamic translator to x86-64 code. each instruction word is translated
+// on first use, keyed by the value of p just after it's fetched, into code
+// that runs it with t, s, the stack pointers and the step budget held in host
+// registers. words that fall through to their successor are laid out one
+// after another; static jumps are chained directly to their targets, patching
+// the jump in place once a target has been translated, and ; and ex go
+// through a small dispatcher. anything unusual (io fetches, blocked ports,
+// self-modifying code, the last few steps of the budget) drops back to
+// f18a_step, which remains the reference.
+//
+// a store to a ram word that has been translated throws away all of the
+// node's code. that's rare enough, and far simpler than tracking which
+// translations include which words.
+
+#include "f18a.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "opcodes.h"
+
+#define CODE_BYTES (1 << 20)
+#define CODE_SLACK 4096 // enough for any single word and its stubs
+#define KEYS 512 // p values that can follow a fetch from ram or rom
+#define STUBS 2048
+#define RUN_WORDS 16 // longest run of straight-line words translated at once
+
+// results of a trip through translated code, other than the actions. any
+// larger value is the address of a jump to be chained.
+enum {
+  X_BUDGET = 16, // too few steps left to finish a word: interpret the rest
+  X_FLUSH, // a translated word was overwritten
+  X_TRAP, // a breakpoint or watchpoint: interpret the next step
+  X_CHAIN // first non-action, non-exit value: an address
+};
+
+typedef struct {
+  u8 *rel; // rel32 field of the jump to this stub
+  bool chain; // otherwise an exit with the state below
+  u32 p;
+  u8 slot;
+  u8 cw;
+  u32 word;
+  u8 steps; // steps taken in the word since the budget was last charged
+  u32 ps; // and their simulated time
+  u32 result;
+} stub_t;
+
+typedef u64 (*entry_t)(f18a *f, u8 *code, u64 *budget);
+
+typedef struct jit_t {
+  u8 *buf;
+  u8 *here;
+  u8 *start; // first byte after the fixed routines
+  u8 *epilogue;
+  u8 *dispatch;
+  entry_t enter;
+  u32 gen; // bumped on every flush
+  u8 *table[KEYS]; // translated code by key, or NULL
+  u32 words[KEYS]; // instruction word each entry was translated from
+  int nstubs;
+  stub_t stubs[STUBS];
+} jit_t;
+
+// the word being translated
+typedef struct {
+  u32 p; // p as of the current slot, known statically
+  u32 key; // p just after the fetch
+  u8 cw;
+  u32 word;
+  u8 cost; // steps in one pass through the word
+  u8 steps; // steps not yet charged to the budget
+  u32 ps; // simulated time not yet charged to the node
+  u8 *body; // code for slot 0, past the budget check
+  const decoded_t *d;
+} word_t;
+
+
+// registers, and the role of each in translated code
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+  R8, R9, R10, R11, R12, R13, R14, R15 };
+#define F RBX // the node
+#define T R12
+#define S R13
+#define N R14 // remaining budget
+#define SP R15
+#define RP RBP
+
+#define W 1 // 64-bit operand
+#define BYTE 2 // byte operand: spl, bpl, sil and dil need a rex prefix
+
+enum { ADD = 0x01, OR = 0x09, SBB = 0x19, AND = 0x21, SUB = 0x29, XOR = 0x31,
+  CMP = 0x39, TEST = 0x85 };
+enum { I_ADD, I_OR, I_AND = 4, I_SUB, I_XOR, I_CMP };
+enum { CC_B = 2, CC_Z = 4, CC_NZ = 5 };
+
+#define OFF(field) ((int32_t)offsetof(f18a, field))
+
+
+static void emit(jit_t *j, u8 b) {
+  *j->here++ = b;
+}
+
+
+static void emit32(jit_t *j, u32 v) {
+  memcpy(j->here, &v, 4);
+  j->here += 4;
+}
+
+
+static void emit64(jit_t *j, u64 v) {
+  memcpy(j->here, &v, 8);
+  j->here += 8;
+}
+
+
+static void opcode(jit_t *j, int flags, int op, int reg, int index, int rm) {
+  u8 rex = 0x40 | (flags & W) << 3 | (reg & 8) >> 1 | (index & 8) >> 2
+    | (rm & 8) >> 3;
+  if (rex != 0x40 || ((flags & BYTE) && reg >= RSP && reg <= RDI))
+    emit(j, rex);
+  if (op > 0xff) emit(j, op >> 8);
+  emit(j, op);
+}
+
+
+// op reg, [base + index * scale + disp]. index is -1 for none.
+static void mem(jit_t *j, int flags, int op, int reg, int base, int index,
+    int scale, int32_t disp) {
+  opcode(j, flags, op, reg, index < 0 ? 0 : index, base);
+  if (index >= 0) {
+    emit(j, 0x84 | (reg & 7) << 3);
+    emit(j, (scale == 8 ? 3 : scale == 4 ? 2 : 0) << 6 | (index & 7) << 3
+        | (base & 7));
+  } else if ((base & 7) == RSP) {
+    emit(j, 0x84 | (reg & 7) << 3);
+    emit(j, 0x24);
+  } else {
+    emit(j, 0x80 | (reg & 7) << 3 | (base & 7));
+  }
+  emit32(j, disp);
+}
+
+
+// op reg, rm, both registers
+static void reg2(jit_t *j, int flags, int op, int reg, int rm) {
+  opcode(j, flags, op, reg, 0, rm);
+  emit(j, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+
+static void load(jit_t *j, int dst, int base, int index, int32_t disp) {
+  mem(j, 0, 0x8b, dst, base, index, 4, disp);
+}
+
+
+static void store(jit_t *j, int src, int base, int index, int32_t disp) {
+  mem(j, 0, 0x89, src, base, index, 4, disp);
+}
+
+
+static void storei(jit_t *j, int32_t disp, u32 imm) {
+  mem(j, 0, 0xc7, 0, F, -1, 0, disp);
+  emit32(j, imm);
+}
+
+
+static void storebi(jit_t *j, int index, int32_t disp, u8 imm) {
+  mem(j, 0, 0xc6, 0, F, index, 1, disp);
+  emit(j, imm);
+}
+
+
+static void mov(jit_t *j, int flags, int dst, int src) {
+  reg2(j, flags, 0x89, src, dst);
+}
+
+
+static void movi(jit_t *j, int dst, u32 imm) {
+  opcode(j, 0, 0xb8 + (dst & 7), 0, 0, dst);
+  emit32(j, imm);
+}
+
+
+static void movi64(jit_t *j, int dst, u64 imm) {
+  opcode(j, W, 0xb8 + (dst & 7), 0, 0, dst);
+  emit64(j, imm);
+}
+
+
+static void alu(jit_t *j, int flags, int op, int dst, int src) {
+  reg2(j, flags, op, src, dst);
+}
+
+
+static void alui(jit_t *j, int flags, int ext, int dst, u32 imm) {
+  reg2(j, flags, 0x81, ext, dst);
+  emit32(j, imm);
+}
+
+
+static void testi(jit_t *j, int reg, u32 imm) {
+  reg2(j, 0, 0xf7, 0, reg);
+  emit32(j, imm);
+}
+
+
+static void lea(jit_t *j, int flags, int dst, int base, int32_t disp) {
+  mem(j, flags, 0x8d, dst, base, -1, 0, disp);
+}
+
+
+// add ps to the node's simulated time
+static void addtime(jit_t *j, int32_t ps) {
+  if (!ps) return;
+  mem(j, W, 0x81, I_ADD, F, -1, 0, OFF(time));
+  emit32(j, ps);
+}
+
+
+// charge the budget and the clock for the steps so far, which are then done
+static void charge(jit_t *j, word_t *w) {
+  if (w->steps) alui(j, W, I_SUB, N, w->steps);
+  addtime(j, w->ps);
+  w->steps = 0;
+  w->ps = 0;
+}
+
+
+static void call(jit_t *j, u64 fn) {
+  movi64(j, RAX, fn);
+  reg2(j, 0, 0xff, 2, RAX);
+}
+
+
+// a forward jump, returning its rel32 field to be bound later
+static u8 *jcc(jit_t *j, int cc) {
+  emit(j, 0x0f);
+  emit(j, 0x80 | cc);
+  emit32(j, 0);
+  return j->here - 4;
+}
+
+
+static u8 *jmp(jit_t *j) {
+  emit(j, 0xe9);
+  emit32(j, 0);
+  return j->here - 4;
+}
+
+
+static void bind(u8 *rel, u8 *target) {
+  int32_t d = target - (rel + 4);
+  memcpy(rel, &d, 4);
+}
+
+
+static void here(jit_t *j, u8 *rel) {
+  bind(rel, j->here);
+}
+
+
+static u32 dec(u32 p) {
+  return (p & ~0x7f) | ((p - 1) & 0x7f);
+}
+
+
+static int key(u32 p) {
+  return ((p >> 1) & 0x100) | (p & 0xff);
+}
+
+
+// ram and rom are adjacent, so this indexes either from ram
+static int32_t memoff(u32 addr) {
+  return OFF(ram) + 4 * ((((addr) & 0x80) >> 1) | ((addr) & 0x3f));
+}
+
+
+static void stub(jit_t *j, u8 *rel, word_t *w, u8 slot, u8 steps, u32 ps,
+    u32 result) {
+  stub_t *s = &j->stubs[j->nstubs++];
+  s->rel = rel;
+  s->chain = false;
+  s->p = w->p;
+  s->slot = slot;
+  s->cw = w->cw;
+  s->word = w->word;
+  s->steps = steps;
+  s->ps = ps;
+  s->result = result;
+}
+
+
+// charge for the word so far and the fetch, then go to the word fetched from
+// q. the fetch is taken back if it's left to f18a_step (see emitstubs).
+static void chain(jit_t *j, word_t *w, u32 q) {
+  w->ps += T_FETCH;
+  charge(j, w);
+  u8 *rel = jmp(j);
+  u8 *target = q & 0x100 ? NULL : j->table[key(f18a_inc(q))];
+  if (target) {
+    bind(rel, target);
+  } else {
+    stub_t *s = &j->stubs[j->nstubs++];
+    s->rel = rel;
+    s->chain = true;
+    s->p = q;
+  }
+}
+
+
+static void emitstubs(jit_t *j) {
+  for (int i = 0; i < j->nstubs; i++) {
+    stub_t *s = &j->stubs[i];
+    here(j, s->rel);
+    if (s->chain) {
+      addtime(j, -T_FETCH);
+      storei(j, OFF(p), s->p);
+      storebi(j, -1, OFF(slot), 4);
+      movi64(j, RAX, (u64)s->rel);
+    } else {
+      if (s->steps) alui(j, W, I_SUB, N, s->steps);
+      addtime(j, s->ps);
+      storei(j, OFF(p), s->p);
+      storebi(j, -1, OFF(slot), s->slot);
+      storebi(j, -1, OFF(cw), s->cw);
+      storei(j, OFF(i), s->word);
+      movi(j, RAX, s->result);
+    }
+    bind(jmp(j), j->epilogue);
+  }
+  j->nstubs = 0;
+}
+
+
+static void push(jit_t *j, int src) {
+  alui(j, 0, I_ADD, SP, 1);
+  alui(j, 0, I_AND, SP, STACK_WORDS - 1);
+  store(j, S, F, SP, OFF(stack));
+  mov(j, 0, S, T);
+  mov(j, 0, T, src);
+}
+
+
+static void pops(jit_t *j) {
+  load(j, S, F, SP, OFF(stack));
+  alui(j, 0, I_SUB, SP, 1);
+  alui(j, 0, I_AND, SP, STACK_WORDS - 1);
+}
+
+
+static void pop(jit_t *j) {
+  mov(j, 0, T, S);
+  pops(j);
+}
+
+
+// r = src, which must not be ecx
+static void pushr(jit_t *j, int src) {
+  alui(j, 0, I_ADD, RP, 1);
+  alui(j, 0, I_AND, RP, RSTACK_WORDS - 1);
+  load(j, RCX, F, -1, OFF(r));
+  store(j, RCX, F, RP, OFF(rstack));
+  store(j, src, F, -1, OFF(r));
+}
+
+
+static void popr(jit_t *j) {
+  load(j, RCX, F, RP, OFF(rstack));
+  store(j, RCX, F, -1, OFF(r));
+  alui(j, 0, I_SUB, RP, 1);
+  alui(j, 0, I_AND, RP, RSTACK_WORDS - 1);
+}
+
+
+static void incmem(jit_t *j, int32_t off) {
+  load(j, RAX, F, -1, off);
+  testi(j, RAX, 0x100);
+  u8 *io = jcc(j, CC_NZ);
+  lea(j, 0, RCX, RAX, 1);
+  alui(j, 0, I_AND, RCX, 0x7f);
+  alui(j, 0, I_AND, RAX, ~0x7f);
+  alu(j, 0, OR, RAX, RCX);
+  store(j, RAX, F, -1, off);
+  here(j, io);
+}
+
+
+// f18a_read(f, esi, &val), to eax, or stop if the read blocks. devices may
+// need the time, so it's brought up to date for the call.
+static void slowread(jit_t *j, word_t *w, u8 slot) {
+  mov(j, W, RDI, F);
+  lea(j, W, RDX, RSP, 8);
+  addtime(j, w->ps);
+  call(j, (uintptr_t)f18a_read);
+  addtime(j, -(int32_t)w->ps);
+  reg2(j, 0, 0x84, RAX, RAX);
+  stub(j, jcc(j, CC_Z), w, slot, w->steps, w->ps, A_BLOCK);
+  load(j, RAX, RSP, -1, 8);
+}
+
+
+// read from the address in ecx to eax
+static void readdyn(jit_t *j, word_t *w, u8 slot) {
+  testi(j, RCX, 0x100);
+  u8 *io = jcc(j, CC_NZ);
+  mov(j, 0, RDX, RCX);
+  reg2(j, 0, 0xc1, 5, RDX); // shr edx, 1
+  emit(j, 1);
+  alui(j, 0, I_AND, RDX, 0x40);
+  alui(j, 0, I_AND, RCX, 0x3f);
+  alu(j, 0, OR, RDX, RCX);
+  load(j, RAX, F, RDX, OFF(ram));
+  u8 *done = jmp(j);
+  here(j, io);
+  mov(j, 0, RSI, RCX);
+  slowread(j, w, slot);
+  here(j, done);
+}
+
+
+static void readstatic(jit_t *j, word_t *w, u8 slot, u32 addr) {
+  if (addr & 0x100) {
+    movi(j, RSI, addr);
+    slowread(j, w, slot);
+  } else {
+    load(j, RAX, F, -1, memoff(addr));
+  }
+}
+
+
+// f18a_write(f, esi, t), or stop if the write blocks. as for slowread.
+static void slowwrite(jit_t *j, word_t *w, u8 slot) {
+  mov(j, W, RDI, F);
+  mov(j, 0, RDX, T);
+  addtime(j, w->ps);
+  call(j, (uintptr_t)f18a_write);
+  addtime(j, -(int32_t)w->ps);
+  reg2(j, 0, 0x84, RAX, RAX);
+  stub(j, jcc(j, CC_Z), w, slot, w->steps, w->ps, A_BLOCK);
+}
+
+
+// write t to the address in ecx, leaving esi non-zero if the word written
+// has been translated
+static void writedyn(jit_t *j, word_t *w, u8 slot) {
+  testi(j, RCX, 0x180);
+  u8 *slow = jcc(j, CC_NZ);
+  alui(j, 0, I_AND, RCX, 0x3f);
+  store(j, T, F, RCX, OFF(ram));
+  reg2(j, 0, 0x69, RDX, RCX); // imul edx, ecx, sizeof(decoded_t)
+  emit32(j, sizeof(decoded_t));
+  storebi(j, RDX, OFF(dcache) + offsetof(decoded_t, valid), 0);
+  mem(j, W, 0x8b, RAX, F, -1, 0, OFF(jitted));
+  reg2(j, W, 0x0fa3, RCX, RAX); // bt rax, rcx
+  alu(j, 0, SBB, RSI, RSI);
+  u8 *done = jmp(j);
+  here(j, slow);
+  mov(j, 0, RSI, RCX);
+  slowwrite(j, w, slot);
+  alu(j, 0, XOR, RSI, RSI);
+  here(j, done);
+}
+
+
+static void flushdyn(jit_t *j, word_t *w, u8 slot, u8 op) {
+  alu(j, 0, TEST, RSI, RSI);
+  stub(j, jcc(j, CC_NZ), w, slot + 1, w->steps + 1, w->ps + optimes[op],
+      X_FLUSH);
+}
+
+
+// write t to a known address. returns true if a check for overwritten
+// translations must follow (see flushstatic).
+static bool writestatic(jit_t *j, word_t *w, u8 slot, u32 addr) {
+  if (addr & 0x180) {
+    movi(j, RSI, addr);
+    slowwrite(j, w, slot);
+    return false;
+  }
+  store(j, T, F, -1, memoff(addr));
+  storebi(j, -1, OFF(dcache) + (addr & 0x3f) * sizeof(decoded_t)
+      + offsetof(decoded_t, valid), 0);
+  return true;
+}
+
+
+static void flushstatic(jit_t *j, word_t *w, u8 slot, u32 addr) {
+  mem(j, W, 0x0fba, 4, F, -1, 0, OFF(jitted)); // bt qword [jitted], bit
+  emit(j, addr & 0x3f);
+  stub(j, jcc(j, CC_B), w, slot + 1, w->steps + 1, w->ps + optimes[OP_SVPI],
+      X_FLUSH);
+}
+
+
+static u32 jumpdest(word_t *w, u8 slot) {
+  static const u32 dmasks[] = {0x3ff, 0xff, 0x7};
+  u32 dest = w->word & dmasks[slot];
+  return (w->p & ~(dmasks[slot] | 0x100)) | dest;
+}
+
+
+// micro-loops that only read memory can go to f18a_bulk from translated code.
+// any that store might throw the code away from under us. f18a_bulk won't
+// take adds while p9 is set, but it only sees f->p, which is stale here.
+static bool bulkable(const word_t *w) {
+  const decoded_t *d = w->d;
+  if ((w->p & P9) && (d->loop == L_MULS || d->loop == L_OVERADD
+        || d->loop == L_DUPADD || d->loop == L_SUM)) return false;
+  return d->loop != L_NONE && d->loop != L_FILL && d->loop != L_MOVEA
+    && d->loop != L_MOVEB;
+}
+
+
+// +*, and + with p9 set, are left to C, as in f18a_step
+static u32 muls(f18a *f, u32 t, u32 s) {
+  f18a_muls(&t, s, &f->a, NULL);
+  return t;
+}
+
+
+static u32 mulsc(f18a *f, u32 t, u32 s) {
+  f18a_muls(&t, s, &f->a, &f->carry);
+  return t;
+}
+
+
+static u32 addc(f18a *f, u32 t, u32 s) {
+  return f18a_addc(t, s, &f->carry);
+}
+
+
+// t = fn(f, t, s)
+static void callts(jit_t *j, u32 (*fn)(f18a *, u32, u32)) {
+  mov(j, W, RDI, F);
+  mov(j, 0, RSI, T);
+  mov(j, 0, RDX, S);
+  call(j, (uintptr_t)fn);
+  mov(j, 0, T, RAX);
+}
+
+
+enum { CONTINUE, FALL, LEAVE };
+
+// translate one slot. returns whether the word goes on to the next slot,
+// falls through to the next word at w->p, or has left by other means.
+static int translateop(jit_t *j, word_t *w, u8 slot, u8 op) {
+  bool flush;
+  switch (op) {
+    case OP_RET:
+      w->steps++;
+      w->ps += optimes[op];
+      charge(j, w);
+      load(j, RAX, F, -1, OFF(r));
+      alui(j, 0, I_AND, RAX, MAX_P);
+      popr(j);
+      bind(jmp(j), j->dispatch);
+      return LEAVE;
+    case OP_EXEC:
+      w->steps++;
+      w->ps += optimes[op];
+      charge(j, w);
+      load(j, RAX, F, -1, OFF(r));
+      storei(j, OFF(r), w->p);
+      alui(j, 0, I_AND, RAX, MAX_P);
+      bind(jmp(j), j->dispatch);
+      return LEAVE;
+    case OP_JUMP:
+      w->steps++;
+      w->ps += optimes[op];
+      chain(j, w, jumpdest(w, slot));
+      return LEAVE;
+    case OP_CALL:
+      w->steps++;
+      w->ps += optimes[op];
+      movi(j, RAX, w->p);
+      pushr(j, RAX);
+      chain(j, w, jumpdest(w, slot));
+      return LEAVE;
+    case OP_UNXT: {
+      load(j, RAX, F, -1, OFF(r));
+      alu(j, 0, TEST, RAX, RAX);
+      u8 *done = jcc(j, CC_Z);
+      alui(j, 0, I_SUB, RAX, 1);
+      store(j, RAX, F, -1, OFF(r));
+      alui(j, W, I_SUB, N, w->steps + 1);
+      addtime(j, w->ps + optimes[op]);
+      if (w->p == w->key && bulkable(w)) {
+        // run any further passes at once. f18a_bulk looks at t, s and sp.
+        store(j, T, F, -1, OFF(t));
+        store(j, S, F, -1, OFF(s));
+        mem(j, BYTE, 0x88, SP, F, -1, 0, OFF(sp));
+        mov(j, W, RDI, F);
+        lea(j, W, RSI, F, OFF(dcache) + w->cw * sizeof(decoded_t));
+        mov(j, W, RDX, N);
+        call(j, (uintptr_t)f18a_bulk);
+        alu(j, W, SUB, N, RAX);
+        load(j, T, F, -1, OFF(t));
+        load(j, S, F, -1, OFF(s));
+      }
+      if (w->p != w->key) {
+        // @p or !p moved p, so the next pass isn't the same code...
+        stub(j, jmp(j), w, 0, 0, 0, A_CONTINUE);
+      } else {
+        alui(j, W, I_CMP, N, w->cost);
+        stub(j, jcc(j, CC_B), w, 0, 0, 0, X_BUDGET);
+        bind(jmp(j), w->body);
+      }
+      here(j, done);
+      popr(j);
+      break;
+    }
+    case OP_NEXT: {
+      w->steps++;
+      w->ps += optimes[op];
+      charge(j, w);
+      load(j, RAX, F, -1, OFF(r));
+      alu(j, 0, TEST, RAX, RAX);
+      u8 *done = jcc(j, CC_Z);
+      alui(j, 0, I_SUB, RAX, 1);
+      store(j, RAX, F, -1, OFF(r));
+      chain(j, w, jumpdest(w, slot));
+      here(j, done);
+      popr(j);
+      return FALL;
+    }
+    case OP_IF:
+    case OP_IFG: {
+      w->steps++;
+      w->ps += optimes[op];
+      charge(j, w);
+      if (op == OP_IF) alu(j, 0, TEST, T, T);
+      else testi(j, T, 0x20000);
+      u8 *skip = jcc(j, CC_NZ);
+      chain(j, w, jumpdest(w, slot));
+      here(j, skip);
+      return FALL;
+    }
+    case OP_LVPI:
+      readstatic(j, w, slot, w->p);
+      push(j, RAX);
+      w->p = f18a_inc(w->p);
+      break;
+    case OP_LVAI:
+    case OP_LVA:
+      load(j, RCX, F, -1, OFF(a));
+      readdyn(j, w, slot);
+      push(j, RAX);
+      if (op == OP_LVAI) incmem(j, OFF(a));
+      break;
+    case OP_LVB:
+      load(j, RCX, F, -1, OFF(b));
+      readdyn(j, w, slot);
+      push(j, RAX);
+      break;
+    case OP_SVPI: {
+      u32 addr = w->p;
+      flush = writestatic(j, w, slot, addr);
+      pop(j);
+      w->p = f18a_inc(w->p);
+      if (flush) flushstatic(j, w, slot, addr);
+      break;
+    }
+    case OP_SVAI:
+    case OP_SVA:
+      load(j, RCX, F, -1, OFF(a));
+      writedyn(j, w, slot);
+      pop(j);
+      if (op == OP_SVAI) incmem(j, OFF(a));
+      flushdyn(j, w, slot, op);
+      break;
+    case OP_SVB:
+      load(j, RCX, F, -1, OFF(b));
+      writedyn(j, w, slot);
+      pop(j);
+      flushdyn(j, w, slot, op);
+      break;
+    case OP_MULS: callts(j, w->p & P9 ? mulsc : muls); break;
+    case OP_SHL: reg2(j, 0, 0xd1, 4, T); break;
+    case OP_SHR: reg2(j, 0, 0xd1, 7, T); break;
+    case OP_INV: reg2(j, 0, 0xf7, 2, T); break;
+    case OP_ADD:
+      if (w->p & P9) callts(j, addc);
+      else alu(j, 0, ADD, T, S);
+      pops(j);
+      break;
+    case OP_AND: alu(j, 0, AND, T, S); pops(j); break;
+    case OP_OR: alu(j, 0, XOR, T, S); pops(j); break;
+    case OP_DROP: pop(j); break;
+    case OP_DUP: mov(j, 0, RAX, T); push(j, RAX); break;
+    case OP_POP:
+      load(j, RAX, F, -1, OFF(r));
+      popr(j);
+      push(j, RAX);
+      break;
+    case OP_OVER: mov(j, 0, RAX, S); push(j, RAX); break;
+    case OP_A: load(j, RAX, F, -1, OFF(a)); push(j, RAX); break;
+    case OP_NOP: break;
+    case OP_PUSH: pushr(j, T); pop(j); break;
+    case OP_SB:
+      mov(j, 0, RAX, T);
+      alui(j, 0, I_AND, RAX, MAX_B);
+      store(j, RAX, F, -1, OFF(b));
+      pop(j);
+      break;
+    case OP_SA: store(j, T, F, -1, OFF(a)); pop(j); break;
+    case OP_HALT:
+      stub(j, jmp(j), w, slot, w->steps, w->ps, A_HALT);
+      return LEAVE;
+    case OP_TRAP:
+      stub(j, jmp(j), w, slot, w->steps, w->ps, X_TRAP);
+      return LEAVE;
+  }
+  w->steps++;
+  w->ps += optimes[op];
+  return CONTINUE;
+}
+
+
+static bool transfer(u8 op) {
+  return op != OP_UNXT && (op <= OP_IFG || op >= OP_HALT);
+}
+
+
+// translate the word fetched from dec(k), which must be in the decode cache.
+// returns CONTINUE if it's straight-line code, FALL if it may fall through
+// after a conditional transfer, or LEAVE. either of the former falls through
+// to the word at *next.
+static int translateword(jit_t *j, f18a *f, u32 k, u32 *next) {
+  word_t w;
+  w.key = w.p = k;
+  w.cw = CACHE_INDEX(dec(k));
+  decoded_t *d = &f->dcache[w.cw];
+  w.d = d;
+  w.word = d->word;
+  w.steps = 0;
+  w.ps = 0;
+  w.cost = 4;
+  for (int slot = 0; slot < 4; slot++) {
+    if (transfer(d->ops[slot])) {
+      w.cost = slot + 1;
+      break;
+    }
+  }
+
+  j->table[key(k)] = j->here;
+  j->words[key(k)] = w.word;
+  if (!(dec(k) & 0x80)) f->jitted |= 1ull << (dec(k) & 0x3f);
+
+  alui(j, W, I_CMP, N, w.cost);
+  stub(j, jcc(j, CC_B), &w, 0, 0, 0, X_BUDGET);
+  w.body = j->here;
+  for (int slot = 0; slot < 4; slot++) {
+    switch (translateop(j, &w, slot, d->ops[slot])) {
+      case LEAVE: return LEAVE;
+      case FALL: *next = w.p; return FALL;
+    }
+  }
+  charge(j, &w);
+  *next = w.p;
+  return CONTINUE;
+}
+
+
+static void flush(f18a *f) {
+  jit_t *j = f->jit;
+  f->jitted = 0;
+  if (!j) return;
+  j->here = j->start;
+  memset(j->table, 0, sizeof(j->table));
+  j->gen++;
+}
+
+
+static bool room(jit_t *j) {
+  return j->here + CODE_SLACK < j->buf + CODE_BYTES
+    && j->nstubs < STUBS - 16;
+}
+
+
+// translate a run of words starting with the one fetched from dec(k), which
+// must be in the decode cache, and carrying on through straight-line code.
+// the run stops at the first transfer, since whatever follows may well be
+// data, and translating a word means any store to it costs a flush.
+static u8 *translate(f18a *f, u32 k) {
+  jit_t *j = f->jit;
+  if (!room(j)) flush(f);
+  u8 *code = j->here;
+  u32 q;
+  for (int words = 1; ; words++) {
+    int end = translateword(j, f, k, &q);
+    if (end == LEAVE) break;
+    k = f18a_inc(q);
+    if (end == FALL || words == RUN_WORDS || (q & 0x100) || j->table[key(k)]
+        || !room(j)) {
+      word_t w = {.steps = 0, .ps = 0};
+      chain(j, &w, q);
+      break;
+    }
+    // ...or fall into it, fetching it as chain would
+    addtime(j, T_FETCH);
+    // make sure the next word is decoded, without disturbing anything...
+    u8 cw = CACHE_INDEX(q);
+    if (!f->dcache[cw].valid) {
+      u32 p = f->p, i = f->i;
+      f->p = q;
+      f18a_fill(f, cw);
+      f->p = p;
+      f->i = i;
+    }
+  }
+  emitstubs(j);
+  return code;
+}
+
+
+// the fixed routines: entry, exit and the dispatcher for computed jumps
+static void prelude(jit_t *j) {
+  j->enter = (entry_t)(uintptr_t)j->here;
+  int saved[] = {RBP, RBX, R12, R13, R14, R15};
+  for (int i = 0; i < 6; i++) opcode(j, 0, 0x50 + (saved[i] & 7), 0, 0,
+      saved[i]);
+  alui(j, W, I_SUB, RSP, 24); // keeps calls aligned; budget pointer and val
+  mem(j, W, 0x89, RDX, RSP, -1, 0, 0);
+  mov(j, W, F, RDI);
+  mem(j, W, 0x8b, N, RDX, -1, 0, 0);
+  load(j, T, F, -1, OFF(t));
+  load(j, S, F, -1, OFF(s));
+  mem(j, 0, 0x0fb6, SP, F, -1, 0, OFF(sp));
+  mem(j, 0, 0x0fb6, RP, F, -1, 0, OFF(rsp));
+  reg2(j, 0, 0xff, 4, RSI); // jmp rsi
+
+  j->epilogue = j->here;
+  store(j, T, F, -1, OFF(t));
+  store(j, S, F, -1, OFF(s));
+  mem(j, BYTE, 0x88, SP, F, -1, 0, OFF(sp));
+  mem(j, BYTE, 0x88, RP, F, -1, 0, OFF(rsp));
+  mem(j, W, 0x8b, RCX, RSP, -1, 0, 0);
+  mem(j, W, 0x89, N, RCX, -1, 0, 0);
+  alui(j, W, I_ADD, RSP, 24);
+  for (int i = 5; i >= 0; i--) opcode(j, 0, 0x58 + (saved[i] & 7), 0, 0,
+      saved[i]);
+  emit(j, 0xc3);
+
+  // eax is the new p, to be fetched from
+  j->dispatch = j->here;
+  testi(j, RAX, 0x100);
+  u8 *miss1 = jcc(j, CC_NZ);
+  lea(j, 0, RCX, RAX, 1);
+  alui(j, 0, I_AND, RCX, 0x7f);
+  mov(j, 0, RDX, RAX);
+  alui(j, 0, I_AND, RDX, ~0x7f);
+  alu(j, 0, OR, RDX, RCX);
+  mov(j, 0, RCX, RDX);
+  reg2(j, 0, 0xc1, 5, RCX); // shr ecx, 1
+  emit(j, 1);
+  alui(j, 0, I_AND, RCX, 0x100);
+  alui(j, 0, I_AND, RDX, 0xff);
+  alu(j, 0, OR, RCX, RDX);
+  movi64(j, RDX, (u64)j->table);
+  mem(j, W, 0x8b, RDX, RDX, RCX, 8, 0);
+  alu(j, W, TEST, RDX, RDX);
+  u8 *miss2 = jcc(j, CC_Z);
+  addtime(j, T_FETCH); // as next() would
+  reg2(j, 0, 0xff, 4, RDX); // jmp rdx
+  here(j, miss1);
+  here(j, miss2);
+  store(j, RAX, F, -1, OFF(p));
+  storebi(j, -1, OFF(slot), 4);
+  movi(j, RAX, A_CONTINUE);
+  bind(jmp(j), j->epilogue);
+
+  j->start = j->here;
+}
+
+
+static jit_t *newjit(void) {
+  jit_t *j = calloc(1, sizeof(jit_t));
+  if (!j) return NULL;
+  j->buf = mmap(NULL, CODE_BYTES, PROT_READ | PROT_WRITE | PROT_EXEC,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (j->buf == MAP_FAILED) {
+    free(j);
+    return NULL;
+  }
+  j->here = j->buf;
+  prelude(j);
+  return j;
+}
+
+
+// translated code for the word just fetched, if there can be any
+static u8 *lookup(f18a *f) {
+  jit_t *j = f->jit;
+  if (f->slot || (f->p & 0x100) || f->cw != CACHE_INDEX(dec(f->p)))
+    return NULL;
+  decoded_t *d = &f->dcache[f->cw];
+  if (!d->valid || d->word != f->i) return NULL;
+  u8 *code = j->table[key(f->p)];
+  if (code && j->words[key(f->p)] == d->word) return code;
+  return translate(f, f->p);
+}
+
+
+void f18a_jitflush(f18a *f) {
+  flush(f);
+}
+
+
+void f18a_jitfree(f18a *f) {
+  jit_t *j = f->jit;
+  if (!j) return;
+  munmap(j->buf, CODE_BYTES);
+  free(j);
+  f->jit = NULL;
+  f->jitted = 0;
+}
+
+
+action_t f18a_jit(f18a *f, u64 *budget) {
+  if (!f->jit && !(f->jit = newjit())) {
+    f18a_hostmsg(f->host,
+        "unable to allocate code for the jit, using threaded code\n");
+    return f18a_threaded(f, budget);
+  }
+  jit_t *j = f->jit;
+  u64 n = *budget;
+  u64 none = 0;
+  action_t action = A_CONTINUE;
+  f18a_stepn(f, &none); // just to fetch
+  while (n) {
+    u8 *code = lookup(f);
+    if (!code) {
+      u64 one = 1;
+      action = f18a_stepn(f, &one);
+      if (action != A_CONTINUE) break;
+      n--;
+      continue;
+    }
+
+    u32 gen = j->gen;
+    u64 result = j->enter(f, code, &n);
+    if (result == A_CONTINUE) {
+      f18a_stepn(f, &none);
+    } else if (result == X_BUDGET) {
+      action = f18a_stepn(f, &n);
+      break;
+    } else if (result == X_FLUSH) {
+      flush(f);
+      f18a_stepn(f, &none);
+    } else if (result == X_TRAP) {
+      u64 one = 1;
+      action = f18a_stepn(f, &one);
+      if (action != A_CONTINUE) break;
+      n--;
+    } else if (result >= X_CHAIN) {
+      f18a_stepn(f, &none);
+      u8 *target = lookup(f);
+      if (target && j->gen == gen) bind((u8 *)result, target);
+    } else {
+      action = result;
+      break;
+    }
+  }
+  *budget = n;
+  return action;
+}
+
+#else
+
+// no jit here, but the threaded engine is the next best thing
+void f18a_jitflush(f18a *f) {
+  f->jitted = 0;
+}
+
+
+void f18a_jitfree(f18a *f) {
+  f->jitted = 0;
+}
+
+
+action_t f18a_jit(f18a *f, u64 *budget) {
+  return f18a_threaded(f, budget);
+}
+
+#endif
@@ -27,6 +27,7 @@
 
 #include <stdlib.h>
 
+#include "f18a.h"
 #include "opcodes.h"
 
 
@@ -37,3 +38,26 @@ const char *opnames[] = {
 };
 #undef NAME
 
+
+// roughly the figures in the greenarrays data sheets. a transfer costs
+// T_FETCH on top of these, for the word it goes on to, as does any op that
+// finishes a word.
+#define T_ALU 1500
+#define T_MEM 5100 // ops that go to memory or a port
+#define T_BRANCH 1600
+#define T_UNXT 2000 // one pass of a micro-loop, on top of its body
+
+const u16 optimes[] = {
+  [OP_RET] = T_BRANCH, [OP_EXEC] = T_BRANCH, [OP_JUMP] = T_BRANCH,
+  [OP_CALL] = T_BRANCH, [OP_UNXT] = T_UNXT, [OP_NEXT] = T_BRANCH,
+  [OP_IF] = T_BRANCH, [OP_IFG] = T_BRANCH,
+  [OP_LVPI] = T_MEM, [OP_LVAI] = T_MEM, [OP_LVB] = T_MEM, [OP_LVA] = T_MEM,
+  [OP_SVPI] = T_MEM, [OP_SVAI] = T_MEM, [OP_SVB] = T_MEM, [OP_SVA] = T_MEM,
+  [OP_MULS] = T_ALU, [OP_SHL] = T_ALU, [OP_SHR] = T_ALU, [OP_INV] = T_ALU,
+  [OP_ADD] = T_ALU, [OP_AND] = T_ALU, [OP_OR] = T_ALU, [OP_DROP] = T_ALU,
+  [OP_DUP] = T_ALU, [OP_POP] = T_ALU, [OP_OVER] = T_ALU, [OP_A] = T_ALU,
+  [OP_NOP] = T_ALU, [OP_PUSH] = T_ALU, [OP_SB] = T_ALU, [OP_SA] = T_ALU,
+  [OP_HALT] = 0, // never runs
+  [OP_TRAP] = 0, // charges for the op it stands for
+  [OP_PFETCH] = 0 // charged as a fetch
+};
@@ -66,10 +66,20 @@
 #define ID(x, _) x,
 enum opcode {
   FOR_EACH_OP(ID)
+  OP_COUNT
 };
 #undef ID
 
+// pseudo-opcodes never appear in an instruction word, but the emulator may
+// substitute them into decoded words.
+enum pseudo_opcode {
+  OP_HALT = OP_COUNT, // a slot 0 jump to its own word
+  OP_TRAP, // an op with a breakpoint or watchpoint on it (see breaks.c)
+  OP_PFETCH // a fetch from a comm port, which may block (see f18a_fill)
+};
+
 extern const char *opnames[];
+extern const u16 optimes[]; // picoseconds, by opcode, including pseudo-opcodes
 
 
 #endif
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2013, Matt Hellige
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above copyright 
+ *   notice, this list of conditions and the following disclaimer in the 
+ *   documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT 
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// f18a-pack: packs the images of any number of nodes, as ffas writes them,
+// into one image container (see image.c), for f18a --image, or into a boot
+// stream (see boot.c), for f18a --boot. each node can be given its own boot
+// address.
+
+#include <getopt.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "f18a.h"
+
+static void error(f18a_host *host, const char *fmt, va_list args) {
+  (void)host;
+  vfprintf(stderr, fmt, args);
+}
+
+static f18a_host host = {.error = error};
+
+static void usage(char **argv) {
+  fprintf(stderr, "usage: %s [options] -o <container> <yxx>=<image>[@<boot>] "
+      "...\n", argv[0]);
+  fprintf(stderr, "   -h, --help           display this message\n");
+  fprintf(stderr, "   -o, --output <f>     write the container to f\n");
+  fprintf(stderr, "   -b, --boot <yxx>     write a boot stream fed through "
+      "node yxx (in the top\n"
+      "                        row, e.g. %03d), not a container\n", BOOT_NODE);
+  fprintf(stderr, "each node boots at boot (hex), or 0x%03x if none is given\n",
+      BOOT_ADDR);
+}
+
+// loads the node given by spec, checking its id against those already packed
+static bool pack(char *spec, f18a *node, int *id, int nodes, const int *ids) {
+  char *endptr;
+  long n = strtol(spec, &endptr, 10);
+  if (*endptr != '=' || fabric_index(n) < 0) {
+    fprintf(stderr, "bad node: %s (expected yxx=image[@boot], e.g. "
+        "708=a.img)\n", spec);
+    return false;
+  }
+  for (int k = 0; k < nodes; k++) {
+    if (ids[k] == n) {
+      fprintf(stderr, "node %03ld is given twice\n", n);
+      return false;
+    }
+  }
+  char *path = endptr + 1;
+  char *at = strrchr(path, '@');
+  u32 boot = BOOT_ADDR;
+  if (at) {
+    *at = '\0';
+    boot = strtoul(at + 1, &endptr, 16);
+    if (!at[1] || *endptr || boot > (P9 | ADDR_MASK)) {
+      fprintf(stderr, "bad boot address: %s\n", at + 1);
+      return false;
+    }
+  }
+  f18a_init(node, &host);
+  if (!f18a_loadcore(node, path)) return false;
+  node->p = boot;
+  *id = n;
+  return true;
+}
+
+int main(int argc, char **argv) {
+  const char *output = NULL;
+  int boot = -1;
+
+  for (;;) {
+    static struct option long_options[] = {
+      {"help", 0, 0, 'h'},
+      {"output", 1, 0, 'o'},
+      {"boot", 1, 0, 'b'},
+      {0, 0, 0, 0},
+    };
+
+    int c = getopt_long(argc, argv, "ho:b:", long_options, NULL);
+    if (c == -1) break;
+
+    switch (c) {
+      case 'h':
+        usage(argv);
+        return 0;
+      case 'o':
+        output = optarg;
+        break;
+      case 'b': {
+        char *endptr;
+        boot = strtol(optarg, &endptr, 10);
+        if (*endptr || fabric_index(boot) < 0) {
+          fprintf(stderr, "bad boot node: %s\n", optarg);
+          return 1;
+        }
+        break;
+      }
+      default:
+        usage(argv);
+        return 1;
+    }
+  }
+
+  int n = argc - optind;
+  if (!output || n < 1 || n > FABRIC_NODES) {
+    usage(argv);
+    return 1;
+  }
+  static f18a nodes[FABRIC_NODES];
+  static const f18a *ptrs[FABRIC_NODES];
+  static int ids[FABRIC_NODES];
+  for (int k = 0; k < n; k++) {
+    if (!pack(argv[optind + k], &nodes[k], &ids[k], k, ids)) return 1;
+    ptrs[k] = &nodes[k];
+  }
+  if (boot >= 0)
+    return f18a_writeboot(&host, output, ptrs, ids, n, boot) ? 0 : 1;
+  return f18a_writeimage(&host, output, ptrs, ids, n) ? 0 : 1;
+}
@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) 2013, Matt Hellige
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above copyright 
+ *   notice, this list of conditions and the following disclaimer in the 
+ *   documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT 
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// conditions for the debugger's until: c-like expressions over the registers,
+// the stacks and memory of a node, such as "t == 0 && p == 0x0b2". they're
+// compiled once into code for a little stack machine, since they're tested
+// after every step. all values are unsigned, and x / 0 and x % 0 are 0.
+//
+//   registers: p r t s a b io i slot sp rsp
+//   stack[n], rstack[n]: the nth entry below s or r, as the debugger lists them
+//   ram[n], rom[n]: words of either, by index; mem[addr]: any word, by address
+//   operators: || && | ^ & == != < <= > >= << >> + - * / % ! ~ -, and ()
+//   numbers: decimal, or hex with 0x
+
+#include <ctype.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "f18a.h"
+
+#define PRED_DEPTH 32
+
+enum {
+  C_LIT, // push arg
+  C_REG, // push the u32 at offset arg into the node
+  C_REG8, // push the u8 at offset arg
+  C_STACK, C_RSTACK, C_RAM, C_ROM, C_MEM, // replace the top with an entry
+  C_NOT, C_INV, C_NEG,
+  C_OR, C_AND, C_BOR, C_XOR, C_BAND, C_EQ, C_NE, C_LT, C_LE, C_GT, C_GE,
+  C_SHL, C_SHR, C_ADD, C_SUB, C_MUL, C_DIV, C_MOD
+};
+
+static const struct {
+  const char *name;
+  u8 op;
+  u32 offset;
+} regs[] = {
+  {"p", C_REG, offsetof(f18a, p)}, {"r", C_REG, offsetof(f18a, r)},
+  {"t", C_REG, offsetof(f18a, t)}, {"s", C_REG, offsetof(f18a, s)},
+  {"a", C_REG, offsetof(f18a, a)}, {"b", C_REG, offsetof(f18a, b)},
+  {"io", C_REG, offsetof(f18a, io)}, {"i", C_REG, offsetof(f18a, i)},
+  {"slot", C_REG8, offsetof(f18a, slot)}, {"sp", C_REG8, offsetof(f18a, sp)},
+  {"rsp", C_REG8, offsetof(f18a, rsp)},
+  {"carry", C_REG8, offsetof(f18a, carry)},
+};
+
+static const struct {
+  const char *name;
+  u8 op;
+} arrays[] = {
+  {"stack", C_STACK}, {"rstack", C_RSTACK}, {"ram", C_RAM}, {"rom", C_ROM},
+  {"mem", C_MEM},
+};
+
+// longer operators first, so that < doesn't take the start of <=
+static const struct {
+  const char *name;
+  u8 prec;
+  u8 op;
+} binops[] = {
+  {"||", 1, C_OR}, {"&&", 2, C_AND}, {"==", 6, C_EQ}, {"!=", 6, C_NE},
+  {"<=", 7, C_LE}, {">=", 7, C_GE}, {"<<", 8, C_SHL}, {">>", 8, C_SHR},
+  {"|", 3, C_BOR}, {"^", 4, C_XOR}, {"&", 5, C_BAND}, {"<", 7, C_LT},
+  {">", 7, C_GT}, {"+", 9, C_ADD}, {"-", 9, C_SUB}, {"*", 10, C_MUL},
+  {"/", 10, C_DIV}, {"%", 10, C_MOD},
+};
+
+#define COUNT(x) (sizeof(x) / sizeof((x)[0]))
+
+typedef struct {
+  const char *src;
+  const char *at;
+  predicate *pred;
+  f18a_host *host;
+  int depth; // of the stack, when the code so far runs
+  bool ok;
+} parser;
+
+
+static void fail(parser *ps, const char *what) {
+  if (ps->ok)
+    f18a_hosterr(ps->host, "%s at column %d of '%s'\n", what,
+        (int)(ps->at - ps->src) + 1, ps->src);
+  ps->ok = false;
+}
+
+
+// emit an op that leaves the stack changed in depth by delta
+static void emit(parser *ps, u8 op, u32 arg, int delta) {
+  if (!ps->ok) return;
+  if (ps->pred->n == PRED_CODE) {
+    fail(ps, "expression too long");
+    return;
+  }
+  ps->depth += delta;
+  if (ps->depth > PRED_DEPTH) {
+    fail(ps, "expression too deep");
+    return;
+  }
+  ps->pred->code[ps->pred->n].op = op;
+  ps->pred->code[ps->pred->n++].arg = arg;
+}
+
+
+static void space(parser *ps) {
+  while (isspace((unsigned char)*ps->at)) ps->at++;
+}
+
+
+static bool accept(parser *ps, const char *tok) {
+  space(ps);
+  if (strncmp(ps->at, tok, strlen(tok))) return false;
+  ps->at += strlen(tok);
+  return true;
+}
+
+
+static void expr(parser *ps, int prec);
+
+static void operand(parser *ps) {
+  space(ps);
+  if (!ps->ok) return;
+  if (accept(ps, "(")) {
+    expr(ps, 1);
+    if (!accept(ps, ")")) fail(ps, "expected ')'");
+  } else if (accept(ps, "!")) {
+    operand(ps);
+    emit(ps, C_NOT, 0, 0);
+  } else if (accept(ps, "~")) {
+    operand(ps);
+    emit(ps, C_INV, 0, 0);
+  } else if (accept(ps, "-")) {
+    operand(ps);
+    emit(ps, C_NEG, 0, 0);
+  } else if (isdigit((unsigned char)*ps->at)) {
+    char *end;
+    bool hex = ps->at[0] == '0' && tolower((unsigned char)ps->at[1]) == 'x';
+    u32 val = strtoul(ps->at, &end, hex ? 16 : 10);
+    ps->at = end;
+    emit(ps, C_LIT, val, 1);
+  } else if (isalpha((unsigned char)*ps->at)) {
+    const char *name = ps->at;
+    while (isalnum((unsigned char)*ps->at)) ps->at++;
+    size_t len = ps->at - name;
+    for (u32 k = 0; k < COUNT(regs); k++) {
+      if (strlen(regs[k].name) != len || strncmp(regs[k].name, name, len))
+        continue;
+      emit(ps, regs[k].op, regs[k].offset, 1);
+      return;
+    }
+    for (u32 k = 0; k < COUNT(arrays); k++) {
+      if (strlen(arrays[k].name) != len || strncmp(arrays[k].name, name, len))
+        continue;
+      if (!accept(ps, "[")) {
+        fail(ps, "expected '['");
+        return;
+      }
+      expr(ps, 1);
+      if (!accept(ps, "]")) fail(ps, "expected ']'");
+      emit(ps, arrays[k].op, 0, 0);
+      return;
+    }
+    ps->at = name;
+    fail(ps, "unknown name");
+  } else {
+    fail(ps, "expected a value");
+  }
+}
+
+
+// an expression of binary operators binding at least as tightly as prec
+static void expr(parser *ps, int prec) {
+  operand(ps);
+  while (ps->ok) {
+    space(ps);
+    u32 k = 0;
+    while (k < COUNT(binops)
+        && strncmp(ps->at, binops[k].name, strlen(binops[k].name)))
+      k++;
+    if (k == COUNT(binops) || binops[k].prec < prec) return;
+    ps->at += strlen(binops[k].name);
+    expr(ps, binops[k].prec + 1);
+    emit(ps, binops[k].op, 0, -1);
+  }
+}
+
+
+bool f18a_compile(f18a_host *host, const char *src, predicate *pred) {
+  parser ps = {src, src, pred, host, 0, true};
+  pred->n = 0;
+  expr(&ps, 1);
+  space(&ps);
+  if (ps.ok && *ps.at) fail(&ps, "unexpected text");
+  return ps.ok;
+}
+
+
+bool f18a_test(const predicate *pred, f18a *f) {
+  u32 stack[PRED_DEPTH];
+  int sp = -1;
+#define TOP stack[sp]
+#define BINARY(e) do { \
+    u32 x = stack[sp - 1], y = stack[sp]; \
+    stack[--sp] = (e); \
+  } while (0)
+  for (int k = 0; k < pred->n; k++) {
+    u32 arg = pred->code[k].arg;
+    switch (pred->code[k].op) {
+      case C_LIT: stack[++sp] = arg; break;
+      case C_REG: stack[++sp] = *(u32 *)((char *)f + arg); break;
+      case C_REG8: stack[++sp] = *((u8 *)f + arg); break;
+      case C_STACK:
+        TOP = f->stack[(f->sp + STACK_WORDS - TOP % STACK_WORDS) % STACK_WORDS];
+        break;
+      case C_RSTACK:
+        TOP = f->rstack[(f->rsp + RSTACK_WORDS - TOP % RSTACK_WORDS)
+          % RSTACK_WORDS];
+        break;
+      case C_RAM: TOP = f->ram[TOP % RAM_WORDS]; break;
+      case C_ROM: TOP = f->rom[TOP % ROM_WORDS]; break;
+      case C_MEM: TOP = f18a_load(f, TOP); break;
+      case C_NOT: TOP = !TOP; break;
+      case C_INV: TOP = ~TOP; break;
+      case C_NEG: TOP = -TOP; break;
+      case C_OR: BINARY(x || y); break;
+      case C_AND: BINARY(x && y); break;
+      case C_BOR: BINARY(x | y); break;
+      case C_XOR: BINARY(x ^ y); break;
+      case C_BAND: BINARY(x & y); break;
+      case C_EQ: BINARY(x == y); break;
+      case C_NE: BINARY(x != y); break;
+      case C_LT: BINARY(x < y); break;
+      case C_LE: BINARY(x <= y); break;
+      case C_GT: BINARY(x > y); break;
+      case C_GE: BINARY(x >= y); break;
+      case C_SHL: BINARY(y < 32 ? x << y : 0); break;
+      case C_SHR: BINARY(y < 32 ? x >> y : 0); break;
+      case C_ADD: BINARY(x + y); break;
+      case C_SUB: BINARY(x - y); break;
+      case C_MUL: BINARY(x * y); break;
+      case C_DIV: BINARY(y ? x / y : 0); break;
+      case C_MOD: BINARY(y ? x % y : 0); break;
+    }
+  }
+  return stack[0];
+#undef TOP
+#undef BINARY
+}
@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2013, Matt Hellige
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above copyright 
+ *   notice, this list of conditions and the following disclaimer in the 
+ *   documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT 
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// an exact profiler. f18a_profiled is an engine like any other, which runs
+// one step at a time on f18a_step and counts everything about each: steps by
+// word and slot, by opcode, branches taken or not, and calls. the other
+// engines know nothing about it, so they cost no more for its being here.
+//
+// costs are also charged to functions, meaning the words that calls go to, so
+// that they can be written out in callgrind's format. the profiler follows
+// calls and returns on a shadow of the return stack, which moves exactly as
+// the real one does, so a ; that returns from a call is told apart from one
+// that jumps to an address pushed as data.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "f18a.h"
+#include "opcodes.h"
+
+#define WORDS (CACHE_WORDS + 1) // by cache index, anything fetched from io last
+#define HOT 20 // percent of all steps that marks a word as hot
+
+
+// a call site, within one function
+typedef struct {
+  u64 calls;
+  u64 steps; // inclusive of everything run until the matching return
+  tstamp_t time;
+  u8 callee;
+} site_t;
+
+// an entry on the shadow return stack
+typedef struct {
+  bool call; // otherwise, something pushed as data
+  u8 fn; // caller, to return to
+  u8 site;
+  u64 steps; // counts as of the call
+  tstamp_t time;
+} frame_t;
+
+typedef struct profile_t {
+  u64 steps;
+  tstamp_t time;
+  u64 slots[WORDS][4];
+  u32 words[WORDS]; // as last run, since ram may change
+  u64 ops[OP_COUNT];
+  u64 taken[WORDS][4]; // conditional transfers, by the slot they're in
+  u64 fell[WORDS][4];
+  u64 called[WORDS];
+
+  // by function, then word
+  u64 cost[WORDS][WORDS];
+  tstamp_t costtime[WORDS][WORDS];
+  site_t sites[WORDS][WORDS];
+  bool entered[WORDS];
+  u8 fn; // the current function
+  frame_t r;
+  frame_t rstack[RSTACK_WORDS];
+  u8 rsp;
+} profile_t;
+
+
+// the address a cache index stands for, taking ram and rom at their lowest
+static u32 address(int cw) {
+  if (cw == CACHE_SCRATCH) return IO_ADDR;
+  return cw < RAM_WORDS ? cw : 0x80 + cw - RAM_WORDS;
+}
+
+
+static void push(profile_t *prof, frame_t frame) {
+  prof->rsp = (prof->rsp + 1) % RSTACK_WORDS;
+  prof->rstack[prof->rsp] = prof->r;
+  prof->r = frame;
+}
+
+
+static frame_t pop(profile_t *prof) {
+  frame_t frame = prof->r;
+  prof->r = prof->rstack[prof->rsp];
+  prof->rsp = (prof->rsp + RSTACK_WORDS - 1) % RSTACK_WORDS;
+  return frame;
+}
+
+
+static profile_t *newprofile(f18a *f) {
+  profile_t *prof = calloc(1, sizeof(profile_t));
+  if (!prof) return NULL;
+  // the shadow stack starts where the real one is, with nothing called
+  prof->rsp = f->rsp;
+  prof->fn = f->cw;
+  prof->entered[f->cw] = true;
+  return prof;
+}
+
+
+// back to the caller in frame, if it's a call, charging the call for all the
+// steps since
+static void leave(profile_t *prof, f18a *f, frame_t frame) {
+  if (!frame.call) return;
+  site_t *site = &prof->sites[frame.fn][frame.site];
+  site->steps += prof->steps - frame.steps;
+  site->time += f->time - frame.time;
+  prof->fn = frame.fn;
+}
+
+
+// count one step, of op in slot of word cw, which has just been run
+static void count(profile_t *prof, f18a *f, u8 cw, u8 slot, u8 op, u32 word,
+    bool taken, tstamp_t before) {
+  tstamp_t time = f->time - before;
+  prof->steps++;
+  prof->time += time;
+  prof->slots[cw][slot]++;
+  prof->words[cw] = word;
+  prof->ops[op]++;
+  prof->cost[prof->fn][cw]++;
+  prof->costtime[prof->fn][cw] += time;
+
+  frame_t frame = {.call = false};
+  switch (op) {
+    case OP_CALL: {
+      // the step has fetched the callee's first word
+      u8 callee = f->cw;
+      site_t *site = &prof->sites[prof->fn][cw];
+      site->calls++;
+      site->callee = callee;
+      prof->called[callee]++;
+      frame = (frame_t){true, prof->fn, cw, prof->steps, f->time};
+      push(prof, frame);
+      prof->fn = callee;
+      prof->entered[callee] = true;
+      break;
+    }
+    case OP_RET:
+      leave(prof, f, pop(prof));
+      break;
+    case OP_EXEC:
+      // a coroutine jump counts as a return, and r is now an address in the
+      // word, not a return from a call
+      leave(prof, f, prof->r);
+      prof->r = frame;
+      break;
+    case OP_PUSH:
+      push(prof, frame);
+      break;
+    case OP_POP:
+      pop(prof);
+      break;
+    case OP_UNXT:
+    case OP_NEXT:
+    case OP_IF:
+    case OP_IFG:
+      if (taken) prof->taken[cw][slot]++;
+      else prof->fell[cw][slot]++;
+      if ((op == OP_UNXT || op == OP_NEXT) && !taken) pop(prof);
+      break;
+  }
+}
+
+
+action_t f18a_profiled(f18a *f, u64 *budget) {
+  if (!f->prof && !(f->prof = newprofile(f))) {
+    f18a_hostmsg(f->host,
+        "unable to allocate a profile, running without one\n");
+    return f18a_stepn(f, budget);
+  }
+  profile_t *prof = f->prof;
+  u64 n = *budget;
+  u64 none = 0;
+  action_t action = A_CONTINUE;
+  f18a_stepn(f, &none); // just to fetch
+  for (; n; n--) {
+    u8 cw = f->cw, slot = f->slot;
+    u8 op = f->dcache[cw].ops[slot];
+    if (op == OP_TRAP) op = f18a_untrap(f, cw, slot);
+    u32 word = f->i;
+    bool taken = op == OP_IF ? !f->t
+      : op == OP_IFG ? !(f->t & 0x20000)
+      : f->r != 0;
+    tstamp_t before = f->time;
+    action = f18a_step(f);
+    if (action != A_CONTINUE) break;
+    if (op < OP_COUNT) count(prof, f, cw, slot, op, word, taken, before);
+  }
+  *budget = n;
+  return action;
+}
+
+
+static u64 total(const profile_t *prof, int cw) {
+  const u64 *s = prof->slots[cw];
+  return s[0] + s[1] + s[2] + s[3];
+}
+
+
+// the annotated listing, to the log: every word that ran, with steps by slot
+// and what its branches and calls did, hot words marked with a *
+void f18a_listing(const f18a *f, const char *name) {
+  const profile_t *prof = f->prof;
+  f18a_host *host = f->host;
+  if (!prof) return;
+  f18a_hostmsg(host, "profile of %s: %llu steps, %.1f ns\n", name,
+      (unsigned long long)prof->steps, prof->time / 1000.0);
+  if (!prof->steps) return;
+  f18a_hostmsg(host, "addr word     steps      %%   slot 0   slot 1   slot 2   "
+      "slot 3  code\n");
+  for (int cw = 0; cw < WORDS; cw++) {
+    u64 steps = total(prof, cw);
+    if (!steps) continue;
+    u32 addr = address(cw);
+    char code[DISASM_CHARS];
+    f18a_disassemble(prof->words[cw], f18a_inc(addr), code);
+    double share = 100.0 * steps / prof->steps;
+    f18a_hostmsg(host, "%s%03x %05x %8llu %5.1f%%", share >= HOT ? "*" : " ",
+        addr, prof->words[cw], (unsigned long long)steps, share);
+    for (int slot = 0; slot < 4; slot++)
+      f18a_hostmsg(host, " %8llu", (unsigned long long)prof->slots[cw][slot]);
+    f18a_hostmsg(host, "  %s\n", code);
+    if (prof->called[cw])
+      f18a_hostmsg(host, "%27s called %llu times\n", "",
+          (unsigned long long)prof->called[cw]);
+    for (int slot = 0; slot < 4; slot++) {
+      if (!prof->taken[cw][slot] && !prof->fell[cw][slot]) continue;
+      f18a_hostmsg(host, "%27s slot %d: taken %llu, not taken %llu\n", "", slot,
+          (unsigned long long)prof->taken[cw][slot],
+          (unsigned long long)prof->fell[cw][slot]);
+    }
+  }
+  f18a_hostmsg(host, "steps by opcode:\n");
+  for (int op = 0; op < OP_COUNT; op++) {
+    if (!prof->ops[op]) continue;
+    f18a_hostmsg(host, "  %-6s %12llu %5.1f%%\n", opnames[op],
+        (unsigned long long)prof->ops[op], 100.0 * prof->ops[op] / prof->steps);
+  }
+}
+
+
+void f18a_callgrindhead(FILE *out) {
+  fprintf(out, "# callgrind format\nversion: 1\ncreator: f18a "
+      F18A_VERSION "\npositions: line\nevents: Steps Ps\n");
+}
+
+
+// one node's profile in callgrind's format: the lines are word addresses, and
+// functions are named for the words they start at, after name
+void f18a_callgrind(const f18a *f, const char *name, FILE *out) {
+  const profile_t *prof = f->prof;
+  if (!prof) return;
+  fprintf(out, "\nfl=%s\n", name);
+  for (int fn = 0; fn < WORDS; fn++) {
+    if (!prof->entered[fn]) continue;
+    fprintf(out, "fn=%s:%03x\n", name, address(fn));
+    for (int cw = 0; cw < WORDS; cw++) {
+      if (prof->cost[fn][cw])
+        fprintf(out, "%u %llu %llu\n", address(cw),
+            (unsigned long long)prof->cost[fn][cw],
+            (unsigned long long)prof->costtime[fn][cw]);
+      const site_t *site = &prof->sites[fn][cw];
+      if (!site->calls) continue;
+      fprintf(out, "cfn=%s:%03x\ncalls=%llu %u\n%u %llu %llu\n", name,
+          address(site->callee), (unsigned long long)site->calls,
+          address(site->callee), address(cw),
+          (unsigned long long)site->steps, (unsigned long long)site->time);
+    }
+  }
+}
@@ -0,0 +1,363 @@
+/*
+ * Copyright (c) 2013, Matt Hellige
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above copyright 
+ *   notice, this list of conditions and the following disclaimer in the 
+ *   documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT 
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// snapshots of a node or a whole fabric, and in-process forks.
+//
+// a snapshot file is a header followed by one fixed-size record per node, all
+// u32s in host byte order, so it can be mapped and read in place. a file
+// from a host of the other byte order fails the magic check. whatever is
+// derived from the architectural state (decode cache, translated code, run
+// queues) isn't saved, and is rebuilt on restore.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "f18a.h"
+
+#define SNAP_MAGIC 0x66313873 // "f18s"
+#define SNAP_VERSION 2
+
+typedef struct {
+  u32 magic;
+  u32 version;
+  u32 fabric; // 0 for a lone node
+  u32 nodes;
+  u32 record; // bytes per node record
+  u32 unused;
+  u64 epoch; // fabric only, as are the rest
+  u64 transfers;
+} header_t;
+
+typedef struct {
+  u32 id; // yxx within a fabric
+  u32 state; // nodestate_t
+  u32 p, io, r, t, s, i, a, b;
+  u32 sp, rsp, slot, cw;
+  u32 stack[STACK_WORDS];
+  u32 rstack[RSTACK_WORDS];
+  u32 ram[RAM_WORDS];
+  u32 rom[ROM_WORDS];
+  u32 rports, wports, done, pval;
+  u32 taken; // one bit per port, in the order of f18a.ports
+  u32 carry;
+  u64 time;
+  u64 when[4];
+} record_t;
+
+
+static void save(const f18a *f, int id, nodestate_t state, record_t *rec) {
+  memset(rec, 0, sizeof(*rec));
+  rec->id = id;
+  rec->state = state;
+  rec->p = f->p;
+  rec->io = f->io;
+  rec->r = f->r;
+  rec->t = f->t;
+  rec->s = f->s;
+  rec->i = f->i;
+  rec->a = f->a;
+  rec->b = f->b;
+  rec->sp = f->sp;
+  rec->rsp = f->rsp;
+  rec->slot = f->slot;
+  rec->cw = f->cw;
+  memcpy(rec->stack, f->stack, sizeof(rec->stack));
+  memcpy(rec->rstack, f->rstack, sizeof(rec->rstack));
+  memcpy(rec->ram, f->ram, sizeof(rec->ram));
+  memcpy(rec->rom, f->rom, sizeof(rec->rom));
+  rec->rports = f->rports;
+  rec->wports = f->wports;
+  rec->done = f->done;
+  rec->pval = f->pval;
+  for (int k = 0; k < 4; k++) rec->taken |= f->taken[k] << k;
+  rec->carry = f->carry;
+  rec->time = f->time;
+  memcpy(rec->when, f->when, sizeof(rec->when));
+}
+
+
+static bool restore(f18a *f, const record_t *rec) {
+  if (rec->sp >= STACK_WORDS || rec->rsp >= RSTACK_WORDS || rec->slot > 4
+      || rec->cw > CACHE_SCRATCH) return false;
+  f->p = rec->p;
+  f->io = rec->io;
+  f->r = rec->r;
+  f->t = rec->t;
+  f->s = rec->s;
+  f->i = rec->i;
+  f->a = rec->a;
+  f->b = rec->b;
+  f->sp = rec->sp;
+  f->rsp = rec->rsp;
+  f->slot = rec->slot;
+  f->cw = rec->cw;
+  memcpy(f->stack, rec->stack, sizeof(f->stack));
+  memcpy(f->rstack, rec->rstack, sizeof(f->rstack));
+  memcpy(f->ram, rec->ram, sizeof(f->ram));
+  memcpy(f->rom, rec->rom, sizeof(f->rom));
+  f->rports = rec->rports;
+  f->wports = rec->wports;
+  f->done = rec->done;
+  f->pval = rec->pval;
+  for (int k = 0; k < 4; k++) f->taken[k] = (rec->taken >> k) & 1;
+  f->carry = rec->carry & 1;
+  f->time = rec->time;
+  memcpy(f->when, rec->when, sizeof(f->when));
+  f18a_latch(f);
+  return true;
+}
+
+
+// the state of a node as f18a_statewords u32s, for checkpoints kept in memory
+// (see history.c), in the same form as a node in a snapshot
+const u32 f18a_statewords = sizeof(record_t) / sizeof(u32);
+
+void f18a_savestate(const f18a *f, u32 *state) {
+  save(f, 0, N_RUN, (record_t *)state);
+}
+
+
+bool f18a_loadstate(f18a *f, const u32 *state) {
+  return restore(f, (const record_t *)state);
+}
+
+
+static bool writesnap(f18a_host *host, const char *path, const header_t *hdr,
+    const record_t *recs) {
+  FILE *out = fopen(path, "wb");
+  bool ok = out && fwrite(hdr, sizeof(*hdr), 1, out) == 1
+    && fwrite(recs, sizeof(*recs), hdr->nodes, out) == hdr->nodes;
+  if (out && fclose(out)) ok = false;
+  if (!ok)
+    f18a_hosterr(host, "error writing snapshot '%s': %s\n", path,
+        strerror(errno));
+  return ok;
+}
+
+
+// map a snapshot, checking that it's one we can read. returns the header,
+// with the records following it, or NULL. unmap with unmap().
+static const header_t *map(f18a_host *host, const char *path,
+    size_t *size) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    f18a_hosterr(host, "error reading snapshot '%s': %s\n", path,
+        strerror(errno));
+    return NULL;
+  }
+  struct stat st;
+  const header_t *hdr = MAP_FAILED;
+  bool big = !fstat(fd, &st) && st.st_size >= (off_t)sizeof(header_t);
+  if (big) {
+    *size = st.st_size;
+    hdr = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  if (hdr == MAP_FAILED) {
+    f18a_hosterr(host, "error reading snapshot '%s': %s\n", path,
+        big ? strerror(errno) : "too short");
+    close(fd);
+    return NULL;
+  }
+  close(fd);
+  if (hdr->magic != SNAP_MAGIC || hdr->version != SNAP_VERSION
+      || hdr->record != sizeof(record_t)
+      || *size != sizeof(header_t) + (size_t)hdr->nodes * sizeof(record_t)) {
+    f18a_hosterr(host, "'%s' is not a version %d snapshot\n", path,
+        SNAP_VERSION);
+    munmap((void *)hdr, *size);
+    return NULL;
+  }
+  return hdr;
+}
+
+
+static void unmap(const header_t *hdr, size_t size) {
+  munmap((void *)hdr, size);
+}
+
+
+// 1 for a snapshot of a fabric, 0 for one of a lone node, -1 for anything
+// else. says nothing either way; restoring will complain.
+int f18a_snapkind(const char *path) {
+  header_t hdr;
+  FILE *in = fopen(path, "rb");
+  if (!in) return -1;
+  bool ok = fread(&hdr, sizeof(hdr), 1, in) == 1 && hdr.magic == SNAP_MAGIC;
+  fclose(in);
+  return ok ? hdr.fabric != 0 : -1;
+}
+
+
+bool f18a_save(const f18a *f18a, const char *path) {
+  header_t hdr = {
+    .magic = SNAP_MAGIC,
+    .version = SNAP_VERSION,
+    .nodes = 1,
+    .record = sizeof(record_t)
+  };
+  record_t rec;
+  save(f18a, 0, N_RUN, &rec);
+  return writesnap(f18a->host, path, &hdr, &rec);
+}
+
+
+// a node or fabric restored from a snapshot keeps its host, so it must have
+// been initialized. whatever it held is released first.
+bool f18a_restore(f18a *f18a, const char *path) {
+  size_t size;
+  const header_t *hdr = map(f18a->host, path, &size);
+  if (!hdr) return false;
+  bool ok = !hdr->fabric;
+  if (!ok) f18a_hosterr(f18a->host, "'%s' is a snapshot of a fabric\n", path);
+  f18a_release(f18a);
+  f18a_init(f18a, f18a->host);
+  if (ok && !(ok = restore(f18a, (const record_t *)(hdr + 1))))
+    f18a_hosterr(f18a->host, "bad node in snapshot '%s'\n", path);
+  unmap(hdr, size);
+  return ok;
+}
+
+
+bool fabric_save(const fabric *fab, const char *path) {
+  record_t *recs = malloc(FABRIC_NODES * sizeof(record_t));
+  if (!recs) {
+    f18a_hosterr(fab->host, "unable to allocate snapshot '%s'\n", path);
+    return false;
+  }
+  header_t hdr = {
+    .magic = SNAP_MAGIC,
+    .version = SNAP_VERSION,
+    .fabric = 1,
+    .record = sizeof(record_t),
+    .epoch = fab->epoch,
+    .transfers = fab->transfers
+  };
+  bool ok = true;
+  for (int i = 0; ok && i < FABRIC_NODES; i++) {
+    if (fab->state[i] == N_OFF) continue;
+    // a node not yet loaded from its container is saved as it will boot
+    const f18a *node = &fab->nodes[i];
+    f18a boot;
+    if (fab->pending[i]) {
+      boot = *node;
+      node = &boot;
+      ok = f18a_materialize(&boot, fab->image, fab->pending[i] - 1);
+    }
+    save(node, fabric_id(i), fab->state[i], &recs[hdr.nodes++]);
+  }
+  ok = ok && writesnap(fab->host, path, &hdr, recs);
+  free(recs);
+  return ok;
+}
+
+
+bool fabric_restore(fabric *fab, const char *path) {
+  size_t size;
+  const header_t *hdr = map(fab->host, path, &size);
+  if (!hdr) return false;
+  bool ok = hdr->fabric;
+  if (!ok) f18a_hosterr(fab->host, "'%s' is a snapshot of a lone node\n", path);
+  if (ok && !(ok = hdr->epoch))
+    f18a_hosterr(fab->host, "bad epoch in snapshot '%s'\n", path);
+  fabric_release(fab);
+  fabric_init(fab, fab->host);
+  fab->epoch = hdr->epoch;
+  fab->transfers = hdr->transfers;
+  const record_t *rec = (const record_t *)(hdr + 1);
+  for (u32 n = 0; ok && n < hdr->nodes; n++, rec++) {
+    int i = fabric_index(rec->id);
+    ok = i >= 0 && fab->state[i] == N_OFF && rec->state != N_OFF
+      && rec->state <= N_HALT && restore(&fab->nodes[i], rec);
+    if (ok) fab->state[i] = rec->state;
+    else f18a_hosterr(fab->host, "bad node %03d in snapshot '%s'\n", rec->id,
+        path);
+  }
+  unmap(hdr, size);
+  return ok;
+}
+
+
+// a fork is a plain copy, and costs no more than one. a node's rom is only
+// 64 words, so sharing it would save nothing worth the bookkeeping. the
+// decode cache comes along warm; translated code, any profile and any trace
+// stay with the parent, and a forked node has no neighbours. a fork shares
+// its parent's host; give it one of its own to run it on another thread. a
+// fork owns whatever it picks up from then on, and is released like any
+// other node.
+void f18a_fork(f18a *child, const f18a *parent) {
+  *child = *parent;
+  child->jit = NULL;
+  child->jitted = 0;
+  child->prof = NULL;
+  child->tracer = NULL;
+  child->breaks = NULL;
+  child->iolog = NULL;
+  child->history = NULL;
+  if (parent->devices) f18a_mapinit(child); // devices aren't shared
+  for (int k = 0; k < 4; k++) child->ports[k] = NULL;
+  if (parent->breaks) f18a_latch(child); // for the parent's traps
+}
+
+
+void fabric_fork(fabric *child, const fabric *parent) {
+  *child = *parent;
+  for (int i = 0; i < FABRIC_NODES; i++) {
+    f18a *node = &child->nodes[i];
+    node->jit = NULL;
+    node->jitted = 0;
+    node->prof = NULL;
+    node->tracer = NULL;
+    node->breaks = NULL;
+    node->iolog = NULL;
+    node->history = NULL;
+    if (node->devices) f18a_mapinit(node);
+    for (int k = 0; k < 4; k++)
+      if (node->ports[k])
+        node->ports[k] = &child->nodes[node->ports[k] - parent->nodes];
+    if (parent->nodes[i].breaks) f18a_latch(node);
+  }
+  // the container belongs to the parent, but the rest of a boot stream is
+  // the child's to feed
+  fabric_settle(child);
+  child->image = NULL;
+  child->feed = NULL;
+  if (parent->fed < parent->nfeed) {
+    u32 n = parent->nfeed - parent->fed;
+    if ((child->feed = malloc(n * sizeof(u32))))
+      memcpy(child->feed, parent->feed + parent->fed, n * sizeof(u32));
+    else f18a_hosterr(child->host, "unable to allocate a boot stream\n");
+    child->nfeed = child->feed ? n : 0;
+  } else {
+    child->nfeed = 0;
+  }
+  child->fed = 0;
+}
@@ -0,0 +1,596 @@
+/*
+ * Copyright (c) 2013, Matt Hellige
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above copyright 
+ *   notice, this list of conditions and the following disclaimer in the 
+ *   documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT 
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// a superoptimizer: searches every sequence of ops, shortest first, for
+// those that do what a reference sequence does.
+//
+// only the ops that touch nothing but the stacks and registers are searched:
+// no memory or port access and no control flow, and no nop, which could only
+// make a sequence longer. they're run by a kernel of their own, on a state
+// cut down to the stacks, a and b, with values kept to 18 bits throughout.
+//
+// every candidate is run on a handful of random inputs, which rejects nearly
+// all of them after the first, and as the search is depth-first, runs only
+// its last op to do it. survivors are run on many more inputs, and then
+// proved equal to the reference symbolically: both are run on terms over the
+// inputs, built up so that equal terms are the same term, after sorting the
+// arguments of + and or and, and a few identities (x x + is x 2*, x x or is
+// 0 and so on) and folding constants. where terms still differ but are made
+// only of and, or and -, they're compared exhaustively, a bit at a time (see
+// bitwise). a survivor that can't be proved either way is still reported, as
+// only having passed every input tried.
+//
+// a pair of ops that can be done with fewer (dup drop, say, or push pop) is
+// never searched, as a shorter sequence does the same. lengths are searched
+// in turn, on a crew of threads that take the first two ops of a candidate
+// as a unit of work.
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "f18a.h"
+#include "opcodes.h"
+
+#define QUICK 4 // inputs every candidate runs on
+#define VECTORS 256 // inputs survivors run on
+#define TERMS 256 // more than two sequences can build
+
+// term kinds, other than the opcodes that build them
+enum { T_VAR = OP_COUNT + 2, T_CONST, T_MULSA };
+
+typedef struct {
+  u32 t, s, r, a, b;
+  u8 sp, rsp;
+  u32 stack[STACK_WORDS];
+  u32 rstack[RSTACK_WORDS];
+} state_t;
+
+typedef struct {
+  u8 op;
+  u32 x, y, z; // arguments, or a constant's value, or a variable's number
+} term_t;
+
+typedef struct {
+  int n;
+  term_t terms[TERMS];
+} terms_t;
+
+typedef struct {
+  f18a_sopt *opt;
+  int len; // of the candidates being searched
+  int nalpha;
+  u8 alpha[OP_COUNT];
+  bool reducible[OP_COUNT][OP_COUNT]; // pairs that can be done with fewer
+  state_t in[VECTORS], out[VECTORS]; // the reference's
+  state_t scratch[VECTORS];
+  int units; // of work, each a two-op prefix
+  int next; // unit, under lock
+  pthread_mutex_t lock;
+} search_t;
+
+typedef struct {
+  search_t *s;
+  pthread_t thread;
+  u64 candidates;
+  u8 seq[SOPT_MAX];
+  state_t st[SOPT_MAX + 1][QUICK];
+} worker_t;
+
+// the ops searched unless asked otherwise
+const u32 f18a_soptops = 1u << OP_MULS | 1u << OP_SHL | 1u << OP_SHR
+  | 1u << OP_INV | 1u << OP_ADD | 1u << OP_AND | 1u << OP_OR | 1u << OP_DROP
+  | 1u << OP_DUP | 1u << OP_POP | 1u << OP_OVER | 1u << OP_A | 1u << OP_PUSH
+  | 1u << OP_SB | 1u << OP_SA;
+
+
+bool f18a_soptable(u8 op) {
+  return op == OP_NOP || (op < OP_COUNT && f18a_soptops >> op & 1);
+}
+
+
+// what an op computes from its arguments, which are t (and s and a)
+static u32 eval(u8 op, u32 x, u32 y, u32 z) {
+  switch (op) {
+    case OP_MULS: f18a_muls(&x, y, &z, NULL); return x;
+    case T_MULSA: f18a_muls(&x, y, &z, NULL); return z;
+    case OP_SHL: return (x << 1) & MAX_VAL;
+    case OP_SHR: return x >> 1 | (x & 0x20000);
+    case OP_INV: return ~x & MAX_VAL;
+    case OP_ADD: return (x + y) & MAX_VAL;
+    case OP_AND: return x & y;
+    case OP_OR: return x ^ y;
+    case OP_SB: return x & MAX_B;
+  }
+  return 0;
+}
+
+
+static u32 intern(terms_t *ts, u8 op, u32 x, u32 y, u32 z) {
+  for (int k = 0; k < ts->n; k++) {
+    term_t *t = &ts->terms[k];
+    if (t->op == op && t->x == x && t->y == y && t->z == z) return k;
+  }
+  if (ts->n == TERMS) abort(); // sequences are far too short for this
+  ts->terms[ts->n] = (term_t){op, x, y, z};
+  return ts->n++;
+}
+
+
+static bool isconst(const terms_t *ts, u32 x, u32 val) {
+  return ts->terms[x].op == T_CONST && ts->terms[x].x == val;
+}
+
+
+// the term for op applied to the terms x (and y and z), in normal form
+static u32 term(terms_t *ts, u8 op, u32 x, u32 y, u32 z) {
+  const term_t *tx = &ts->terms[x], *ty = &ts->terms[y], *tz = &ts->terms[z];
+  bool binary = op == OP_ADD || op == OP_AND || op == OP_OR;
+  bool ternary = op == OP_MULS || op == T_MULSA;
+  if (tx->op == T_CONST && (!(binary || ternary) || ty->op == T_CONST)
+      && (!ternary || tz->op == T_CONST))
+    return intern(ts, T_CONST, eval(op, tx->x, ty->x, tz->x), 0, 0);
+  if (!binary && !ternary) y = z = 0;
+  if (binary) {
+    z = 0;
+    if (x > y) { u32 tmp = x; x = y; y = tmp; }
+    if (isconst(ts, x, 0) || isconst(ts, y, 0)) {
+      u32 other = isconst(ts, x, 0) ? y : x;
+      return op == OP_AND ? intern(ts, T_CONST, 0, 0, 0) : other;
+    }
+    if (x == y) {
+      if (op == OP_ADD) return term(ts, OP_SHL, x, 0, 0);
+      if (op == OP_AND) return x;
+      return intern(ts, T_CONST, 0, 0, 0);
+    }
+  }
+  if ((op == OP_INV && tx->op == OP_INV) || (op == OP_SB && tx->op == OP_SB))
+    return op == OP_INV ? tx->x : x;
+  return intern(ts, op, x, y, z);
+}
+
+
+// the kernel: execute(), for just the ops searched, on values or, given
+// terms, on terms
+static void push(state_t *x, u32 val) {
+  x->sp = (x->sp + 1) % STACK_WORDS;
+  x->stack[x->sp] = x->s;
+  x->s = x->t;
+  x->t = val;
+}
+
+
+static u32 pop(state_t *x) {
+  u32 t = x->t;
+  x->t = x->s;
+  x->s = x->stack[x->sp];
+  x->sp = (x->sp + STACK_WORDS - 1) % STACK_WORDS;
+  return t;
+}
+
+
+static void pushr(state_t *x, u32 val) {
+  x->rsp = (x->rsp + 1) % RSTACK_WORDS;
+  x->rstack[x->rsp] = x->r;
+  x->r = val;
+}
+
+
+static u32 popr(state_t *x) {
+  u32 r = x->r;
+  x->r = x->rstack[x->rsp];
+  x->rsp = (x->rsp + RSTACK_WORDS - 1) % RSTACK_WORDS;
+  return r;
+}
+
+
+static inline void run(state_t *x, u8 op, terms_t *ts) {
+  switch (op) {
+    case OP_MULS:
+      if (ts) {
+        u32 t = x->t;
+        x->t = term(ts, OP_MULS, t, x->s, x->a);
+        x->a = term(ts, T_MULSA, t, x->s, x->a);
+      } else {
+        f18a_muls(&x->t, x->s, &x->a, NULL);
+      }
+      break;
+    case OP_SHL:
+    case OP_SHR:
+    case OP_INV:
+      x->t = ts ? term(ts, op, x->t, 0, 0) : eval(op, x->t, 0, 0);
+      break;
+    case OP_ADD:
+    case OP_AND:
+    case OP_OR: {
+      u32 t = pop(x);
+      x->t = ts ? term(ts, op, t, x->t, 0) : eval(op, t, x->t, 0);
+      break;
+    }
+    case OP_DROP: pop(x); break;
+    case OP_DUP: push(x, x->t); break;
+    case OP_POP: push(x, popr(x)); break;
+    case OP_OVER: push(x, x->s); break;
+    case OP_A: push(x, x->a); break;
+    case OP_NOP: break;
+    case OP_PUSH: pushr(x, pop(x)); break;
+    case OP_SB:
+      x->b = ts ? term(ts, OP_SB, pop(x), 0, 0) : eval(OP_SB, pop(x), 0, 0);
+      break;
+    case OP_SA: x->a = pop(x); break;
+  }
+}
+
+
+static void runseq(state_t *x, const u8 *seq, int n, terms_t *ts) {
+  for (int k = 0; k < n; k++) run(x, seq[k], ts);
+}
+
+
+// whether two results agree on all that's asked of them. a stack is compared
+// from the top down, so where its pointer points doesn't matter.
+static bool same(const f18a_sopt *opt, const state_t *x, const state_t *y) {
+  if (opt->depth > 0 && x->t != y->t) return false;
+  if (opt->depth > 1 && x->s != y->s) return false;
+  for (int k = 0; k < opt->depth - 2; k++)
+    if (x->stack[(x->sp + STACK_WORDS - k) % STACK_WORDS]
+        != y->stack[(y->sp + STACK_WORDS - k) % STACK_WORDS]) return false;
+  if (opt->rdepth > 0 && x->r != y->r) return false;
+  for (int k = 0; k < opt->rdepth - 1; k++)
+    if (x->rstack[(x->rsp + RSTACK_WORDS - k) % RSTACK_WORDS]
+        != y->rstack[(y->rsp + RSTACK_WORDS - k) % RSTACK_WORDS]) return false;
+  return (opt->deada || x->a == y->a) && (opt->deadb || x->b == y->b);
+}
+
+
+// inputs are mostly random, but often the values most likely to show up a
+// difference: the edges of the range, and alternating bits
+static u32 value(u64 *seed, u32 mask) {
+  static const u32 edges[] = {0, 1, 2, MAX_VAL, 0x20000, 0x1ffff, 0x15555,
+    0x2aaaa};
+  *seed ^= *seed << 13;
+  *seed ^= *seed >> 7;
+  *seed ^= *seed << 17;
+  u32 v = *seed >> 8;
+  if (!(*seed & 3)) v = edges[(*seed >> 2) % 8];
+  return v & mask;
+}
+
+
+static void inputs(state_t *in, int n) {
+  u64 seed = 0x9e3779b97f4a7c15ull;
+  for (int v = 0; v < n; v++) {
+    state_t *x = &in[v];
+    memset(x, 0, sizeof(*x));
+    x->t = value(&seed, MAX_VAL);
+    x->s = value(&seed, MAX_VAL);
+    x->r = value(&seed, MAX_VAL);
+    x->a = value(&seed, MAX_VAL);
+    x->b = value(&seed, MAX_B);
+    for (int k = 0; k < STACK_WORDS; k++) x->stack[k] = value(&seed, MAX_VAL);
+    for (int k = 0; k < RSTACK_WORDS; k++)
+      x->rstack[k] = value(&seed, MAX_VAL);
+  }
+}
+
+
+// the values same() compares, in order
+static int fields(const f18a_sopt *opt, const state_t *x, u32 *out) {
+  int n = 0;
+  if (opt->depth > 0) out[n++] = x->t;
+  if (opt->depth > 1) out[n++] = x->s;
+  for (int k = 0; k < opt->depth - 2; k++)
+    out[n++] = x->stack[(x->sp + STACK_WORDS - k) % STACK_WORDS];
+  if (opt->rdepth > 0) out[n++] = x->r;
+  for (int k = 0; k < opt->rdepth - 1; k++)
+    out[n++] = x->rstack[(x->rsp + RSTACK_WORDS - k) % RSTACK_WORDS];
+  if (!opt->deada) out[n++] = x->a;
+  if (!opt->deadb) out[n++] = x->b;
+  return n;
+}
+
+
+// a term made only of and, or and - (and constants with every bit the same)
+// works on each bit alone, so it's enough to try its variables as all zeroes
+// and all ones. collects its variables in vars, at most max of them.
+static bool bitwise(const terms_t *ts, u32 x, u32 *vars, int *n, int max) {
+  const term_t *t = &ts->terms[x];
+  switch (t->op) {
+    case T_VAR:
+      for (int k = 0; k < *n; k++)
+        if (vars[k] == t->x) return true;
+      if (*n == max) return false;
+      vars[(*n)++] = t->x;
+      return true;
+    case T_CONST: return t->x == 0 || t->x == MAX_VAL;
+    case OP_INV: return bitwise(ts, t->x, vars, n, max);
+    case OP_AND:
+    case OP_OR:
+      return bitwise(ts, t->x, vars, n, max)
+        && bitwise(ts, t->y, vars, n, max);
+  }
+  return false;
+}
+
+
+// the value of such a term with the variables in vars set by the bits of bits
+static u32 bitval(const terms_t *ts, u32 x, const u32 *vars, int n,
+    u32 bits) {
+  const term_t *t = &ts->terms[x];
+  switch (t->op) {
+    case T_VAR:
+      for (int k = 0; k < n; k++)
+        if (vars[k] == t->x) return bits >> k & 1 ? MAX_VAL : 0;
+      return 0;
+    case T_CONST: return t->x;
+    case OP_INV: return ~bitval(ts, t->x, vars, n, bits) & MAX_VAL;
+    case OP_AND:
+      return bitval(ts, t->x, vars, n, bits) & bitval(ts, t->y, vars, n, bits);
+    case OP_OR:
+      return bitval(ts, t->x, vars, n, bits) ^ bitval(ts, t->y, vars, n, bits);
+  }
+  return 0;
+}
+
+
+static bool bitequal(const terms_t *ts, u32 x, u32 y) {
+  u32 vars[12];
+  int n = 0;
+  if (!bitwise(ts, x, vars, &n, 12) || !bitwise(ts, y, vars, &n, 12))
+    return false;
+  for (u32 bits = 0; bits < 1u << n; bits++)
+    if (bitval(ts, x, vars, n, bits) != bitval(ts, y, vars, n, bits))
+      return false;
+  return true;
+}
+
+
+// true if the two sequences agree on every input, not just those tried
+static bool prove(const f18a_sopt *opt, const u8 *x, int nx, const u8 *y,
+    int ny) {
+  terms_t ts = {0};
+  state_t in;
+  u32 var = 0;
+  in.t = intern(&ts, T_VAR, var++, 0, 0);
+  in.s = intern(&ts, T_VAR, var++, 0, 0);
+  in.r = intern(&ts, T_VAR, var++, 0, 0);
+  in.a = intern(&ts, T_VAR, var++, 0, 0);
+  in.b = intern(&ts, T_VAR, var++, 0, 0);
+  in.sp = in.rsp = 0;
+  for (int k = 0; k < STACK_WORDS; k++)
+    in.stack[k] = intern(&ts, T_VAR, var++, 0, 0);
+  for (int k = 0; k < RSTACK_WORDS; k++)
+    in.rstack[k] = intern(&ts, T_VAR, var++, 0, 0);
+  state_t sx = in, sy = in;
+  runseq(&sx, x, nx, &ts);
+  runseq(&sy, y, ny, &ts);
+  u32 fx[STACK_WORDS + RSTACK_WORDS + 5], fy[STACK_WORDS + RSTACK_WORDS + 5];
+  int n = fields(opt, &sx, fx);
+  fields(opt, &sy, fy);
+  for (int k = 0; k < n; k++)
+    if (fx[k] != fy[k] && !bitequal(&ts, fx[k], fy[k])) return false;
+  return true;
+}
+
+
+static bool tried(const f18a_sopt *opt, const state_t *in, const state_t *out,
+    int n, const u8 *seq, int len) {
+  for (int v = 0; v < n; v++) {
+    state_t x = in[v];
+    runseq(&x, seq, len, NULL);
+    if (!same(opt, &x, &out[v])) return false;
+  }
+  return true;
+}
+
+
+// words a sequence packs into from slot 0, with only ops whose low two bits
+// are clear fitting the last slot, as in ffas
+static int words(const u8 *seq, int n) {
+  int words = 0, slot = 4;
+  for (int k = 0; k < n; k++) {
+    if (slot == 4 || (slot == 3 && seq[k] & 3)) {
+      words++;
+      slot = 0;
+    }
+    slot++;
+  }
+  return words;
+}
+
+
+static int bycost(const void *x, const void *y) {
+  const soptseq_t *a = x, *b = y;
+  if (a->words != b->words) return a->words - b->words;
+  if (a->n != b->n) return a->n - b->n;
+  if (a->time != b->time) return a->time > b->time ? 1 : -1;
+  return memcmp(a->ops, b->ops, a->n);
+}
+
+
+// the cheapest are kept, so what's kept doesn't depend on the threads
+static void found(search_t *s, const u8 *seq, int len) {
+  f18a_sopt *opt = s->opt;
+  soptseq_t f = {.n = len, .words = words(seq, len)};
+  memcpy(f.ops, seq, len);
+  for (int k = 0; k < len; k++) f.time += optimes[seq[k]];
+  f.proved = prove(opt, opt->ref, opt->nref, seq, len);
+  pthread_mutex_lock(&s->lock);
+  opt->hits++;
+  int worst = 0;
+  for (int k = 1; k < opt->nfound; k++)
+    if (bycost(&opt->found[k], &opt->found[worst]) > 0) worst = k;
+  if (opt->nfound < SOPT_FOUND) opt->found[opt->nfound++] = f;
+  else if (bycost(&f, &opt->found[worst]) < 0) opt->found[worst] = f;
+  pthread_mutex_unlock(&s->lock);
+}
+
+
+static void leaf(worker_t *w) {
+  search_t *s = w->s;
+  const state_t *st = w->st[s->len];
+  w->candidates++;
+  for (int v = 0; v < QUICK; v++)
+    if (!same(s->opt, &st[v], &s->out[v])) return;
+  if (tried(s->opt, s->in + QUICK, s->out + QUICK, VECTORS - QUICK, w->seq,
+        s->len))
+    found(s, w->seq, s->len);
+}
+
+
+static void search(worker_t *w, int d) {
+  search_t *s = w->s;
+  if (d == s->len) {
+    leaf(w);
+    return;
+  }
+  for (int k = 0; k < s->nalpha; k++) {
+    u8 op = s->alpha[k];
+    if (d && s->reducible[w->seq[d - 1]][op]) continue;
+    w->seq[d] = op;
+    for (int v = 0; v < QUICK; v++) {
+      w->st[d + 1][v] = w->st[d][v];
+      run(&w->st[d + 1][v], op, NULL);
+    }
+    search(w, d + 1);
+  }
+}
+
+
+// the first min(len, 2) ops of a candidate are a unit of work
+static void *work(void *arg) {
+  worker_t *w = arg;
+  search_t *s = w->s;
+  int prefix = s->len < 2 ? s->len : 2;
+  for (;;) {
+    pthread_mutex_lock(&s->lock);
+    int unit = s->next++;
+    pthread_mutex_unlock(&s->lock);
+    if (unit >= s->units) return NULL;
+    bool ok = true;
+    for (int d = 0; d < prefix; d++, unit /= s->nalpha) {
+      u8 op = s->alpha[unit % s->nalpha];
+      ok = ok && !(d && s->reducible[w->seq[d - 1]][op]);
+      w->seq[d] = op;
+      for (int v = 0; v < QUICK; v++) {
+        w->st[d + 1][v] = w->st[d][v];
+        run(&w->st[d + 1][v], op, NULL);
+      }
+    }
+    if (ok) search(w, prefix);
+  }
+}
+
+
+// a pair is reducible if a shorter sequence always does the same, however
+// much of the result is asked for
+static void reducible(search_t *s) {
+  f18a_sopt all = {.depth = STACK_WORDS + 2, .rdepth = RSTACK_WORDS + 1};
+  state_t *out = s->scratch;
+  for (int i = 0; i < s->nalpha; i++) {
+    for (int j = 0; j < s->nalpha; j++) {
+      u8 pair[2] = {s->alpha[i], s->alpha[j]};
+      for (int v = 0; v < VECTORS; v++) {
+        out[v] = s->in[v];
+        runseq(&out[v], pair, 2, NULL);
+      }
+      bool shorter = tried(&all, s->in, out, VECTORS, NULL, 0)
+        && prove(&all, pair, 2, NULL, 0);
+      for (int k = 0; !shorter && k < s->nalpha; k++)
+        shorter = tried(&all, s->in, out, VECTORS, &s->alpha[k], 1)
+          && prove(&all, pair, 2, &s->alpha[k], 1);
+      s->reducible[pair[0]][pair[1]] = shorter;
+    }
+  }
+}
+
+
+// false, with nothing searched, if the reference uses an op the kernel
+// doesn't have, or the limits are out of range, or memory runs out
+bool f18a_superopt(f18a_sopt *opt) {
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (opt->maxlen > SOPT_MAX || opt->nref > SOPT_MAX || opt->threads < 1)
+    return false;
+  for (int k = 0; k < opt->nref; k++)
+    if (!f18a_soptable(opt->ref[k])) return false;
+  search_t *s = calloc(1, sizeof(search_t));
+  worker_t *crew = calloc(opt->threads, sizeof(worker_t));
+  if (!s || !crew) {
+    free(s);
+    free(crew);
+    return false;
+  }
+  s->opt = opt;
+  for (int op = 0; op < OP_COUNT; op++)
+    if (opt->ops & f18a_soptops & 1u << op) s->alpha[s->nalpha++] = op;
+  inputs(s->in, VECTORS);
+  for (int v = 0; v < VECTORS; v++) {
+    s->out[v] = s->in[v];
+    runseq(&s->out[v], opt->ref, opt->nref, NULL);
+  }
+  reducible(s);
+  pthread_mutex_init(&s->lock, NULL);
+
+  opt->nfound = 0;
+  opt->hits = 0;
+  opt->candidates = 0;
+  for (int len = 0; len <= opt->maxlen; len++) {
+    s->len = len;
+    s->next = 0;
+    s->units = 1;
+    for (int d = 0; d < len && d < 2; d++) s->units *= s->nalpha;
+    // short searches aren't worth the threads
+    int threads = len < 3 ? 1 : opt->threads;
+    for (int k = 0; k < threads; k++) {
+      crew[k].s = s;
+      crew[k].candidates = 0;
+      memcpy(crew[k].st[0], s->in, sizeof(crew[k].st[0]));
+    }
+    for (int k = 1; k < threads; k++)
+      pthread_create(&crew[k].thread, NULL, work, &crew[k]);
+    work(&crew[0]);
+    opt->counts[len] = 0;
+    for (int k = 0; k < threads; k++) {
+      if (k) pthread_join(crew[k].thread, NULL);
+      opt->counts[len] += crew[k].candidates;
+    }
+    opt->candidates += opt->counts[len];
+    if (opt->hits && !opt->all) {
+      opt->maxlen = len;
+      break;
+    }
+  }
+  free(crew);
+  pthread_mutex_destroy(&s->lock);
+  free(s);
+  qsort(opt->found, opt->nfound, sizeof(soptseq_t), bycost);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  opt->secs = end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9;
+  return true;
+}
@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2013, Matt Hellige
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above copyright 
+ *   notice, this list of conditions and the following disclaimer in the 
+ *   documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT 
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// f18a-superopt: finds the shortest sequences of ops that do what a given
+// one does, as f18a_superopt searches for them, and lists them cheapest
+// first, with how fast the search went.
+
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "f18a.h"
+#include "opcodes.h"
+
+static void usage(char **argv) {
+  fprintf(stderr, "usage: %s [options] <op> ...\n", argv[0]);
+  fprintf(stderr, "   -h, --help           display this message\n");
+  fprintf(stderr, "   -n, --length <n>     search sequences of up to n ops "
+      "(default: as many as\n"
+      "                        the reference, at most %d)\n", SOPT_MAX);
+  fprintf(stderr, "   -a, --all            list every length up to n, not "
+      "just the shortest\n");
+  fprintf(stderr, "   -d, --depth <n>      only the top n cells of the data "
+      "stack, t and s\n"
+      "                        included, need agree (default %d)\n",
+      STACK_WORDS + 2);
+  fprintf(stderr, "   -r, --rdepth <n>     only the top n cells of the return "
+      "stack, r included\n"
+      "                        (default %d)\n", RSTACK_WORDS + 1);
+  fprintf(stderr, "   -i, --ignore <regs>  registers that needn't agree: a, b "
+      "or ab\n");
+  fprintf(stderr, "   -o, --ops <ops>      only search these ops, e.g. "
+      "\"dup over +\"\n");
+  fprintf(stderr, "   -j, --threads <n>    search on n threads (default: one "
+      "per core)\n");
+  fprintf(stderr, "ops are those of the stacks and registers:");
+  for (int op = 0; op < OP_COUNT; op++)
+    if (f18a_soptable(op)) fprintf(stderr, " %s", opnames[op]);
+  fprintf(stderr, "\n");
+}
+
+static int opcode(const char *name) {
+  for (int op = 0; op < OP_COUNT; op++)
+    if (!strcmp(opnames[op], name)) return op;
+  return -1;
+}
+
+// adds the ops named in text to seq, which holds *n of at most max
+static bool parseops(char *text, u8 *seq, int *n, int max) {
+  for (char *name = strtok(text, " \t\n"); name;
+      name = strtok(NULL, " \t\n")) {
+    int op = opcode(name);
+    if (op < 0 || !f18a_soptable(op)) {
+      fprintf(stderr, "can't search with op '%s'\n", name);
+      return false;
+    }
+    if (*n == max) {
+      fprintf(stderr, "too many ops, at most %d\n", max);
+      return false;
+    }
+    seq[(*n)++] = op;
+  }
+  return true;
+}
+
+static void print(const u8 *seq, int n, int width) {
+  int len = 0;
+  for (int k = 0; k < n; k++)
+    len += printf("%s%s", k ? " " : "", opnames[seq[k]]);
+  if (!n) len += printf("(nothing)");
+  printf("%*s", width > len ? width - len : 0, "");
+}
+
+int main(int argc, char **argv) {
+  f18a_sopt *opt = calloc(1, sizeof(f18a_sopt));
+  if (!opt) return 1;
+  opt->maxlen = -1;
+  opt->depth = STACK_WORDS + 2;
+  opt->rdepth = RSTACK_WORDS + 1;
+  opt->ops = f18a_soptops;
+  opt->threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (opt->threads < 1) opt->threads = 1;
+  char *endptr;
+
+  for (;;) {
+    static struct option long_options[] = {
+      {"help", 0, 0, 'h'},
+      {"length", 1, 0, 'n'},
+      {"all", 0, 0, 'a'},
+      {"depth", 1, 0, 'd'},
+      {"rdepth", 1, 0, 'r'},
+      {"ignore", 1, 0, 'i'},
+      {"ops", 1, 0, 'o'},
+      {"threads", 1, 0, 'j'},
+      {0, 0, 0, 0},
+    };
+
+    int c = getopt_long(argc, argv, "hn:ad:r:i:o:j:", long_options, NULL);
+    if (c == -1) break;
+
+    switch (c) {
+      case 'h':
+        usage(argv);
+        return 0;
+      case 'n':
+        opt->maxlen = strtol(optarg, &endptr, 10);
+        if (*endptr || opt->maxlen < 0 || opt->maxlen > SOPT_MAX) {
+          fprintf(stderr, "argument to --length must be 0 to %d\n", SOPT_MAX);
+          return 1;
+        }
+        break;
+      case 'a':
+        opt->all = true;
+        break;
+      case 'd':
+        opt->depth = strtol(optarg, &endptr, 10);
+        if (*endptr || opt->depth < 0 || opt->depth > STACK_WORDS + 2) {
+          fprintf(stderr, "argument to --depth must be 0 to %d\n",
+              STACK_WORDS + 2);
+          return 1;
+        }
+        break;
+      case 'r':
+        opt->rdepth = strtol(optarg, &endptr, 10);
+        if (*endptr || opt->rdepth < 0 || opt->rdepth > RSTACK_WORDS + 1) {
+          fprintf(stderr, "argument to --rdepth must be 0 to %d\n",
+              RSTACK_WORDS + 1);
+          return 1;
+        }
+        break;
+      case 'i':
+        if (strspn(optarg, "ab") != strlen(optarg)) {
+          fprintf(stderr, "argument to --ignore must be a, b or ab\n");
+          return 1;
+        }
+        opt->deada = strchr(optarg, 'a') != NULL;
+        opt->deadb = strchr(optarg, 'b') != NULL;
+        break;
+      case 'o': {
+        u8 ops[OP_COUNT];
+        int n = 0;
+        if (!parseops(optarg, ops, &n, OP_COUNT)) return 1;
+        opt->ops = 0;
+        for (int k = 0; k < n; k++) opt->ops |= 1u << ops[k];
+        break;
+      }
+      case 'j':
+        opt->threads = strtol(optarg, &endptr, 10);
+        if (*endptr || opt->threads < 1) {
+          fprintf(stderr, "argument to --threads must be a positive "
+              "number\n");
+          return 1;
+        }
+        break;
+      default:
+        usage(argv);
+        return 1;
+    }
+  }
+
+  for (int k = optind; k < argc; k++)
+    if (!parseops(argv[k], opt->ref, &opt->nref, SOPT_MAX)) return 1;
+  if (!opt->nref) {
+    usage(argv);
+    return 1;
+  }
+  if (opt->maxlen < 0) opt->maxlen = opt->nref;
+  tstamp_t time = 0;
+  for (int k = 0; k < opt->nref; k++) time += optimes[opt->ref[k]];
+
+  printf("reference: ");
+  print(opt->ref, opt->nref, 0);
+  printf(" (%d ops, %.1f ns)\n", opt->nref, time / 1000.0);
+  if (!f18a_superopt(opt)) {
+    fprintf(stderr, "search failed\n");
+    return 1;
+  }
+  printf("\n%-32s ops words time (ns)\n", "sequence");
+  for (int k = 0; k < opt->nfound; k++) {
+    const soptseq_t *f = &opt->found[k];
+    print(f->ops, f->n, 32);
+    printf(" %3d %5d %9.1f%s\n", f->n, f->words, f->time / 1000.0,
+        f->proved ? "" : "  (tested, not proved)");
+  }
+  if (opt->hits > (u64)opt->nfound)
+    printf("... and %llu more\n",
+        (unsigned long long)(opt->hits - opt->nfound));
+  if (!opt->hits) printf("(none up to %d ops)\n", opt->maxlen);
+
+  printf("\nlength  candidates\n");
+  for (int len = 0; len <= opt->maxlen; len++)
+    printf("%6d %11llu\n", len, (unsigned long long)opt->counts[len]);
+  printf("%llu candidates in %.3f s, %.0f per second, on %d threads\n",
+      (unsigned long long)opt->candidates, opt->secs,
+      opt->secs > 0 ? opt->candidates / opt->secs : 0.0, opt->threads);
+  return 0;
+}
@@ -36,6 +36,7 @@ struct term_t {
   WINDOW *border;
   WINDOW *vidwin;
   WINDOW *dbgwin;
+  FILE *log; // set when running headless, in which case curses is never used
 };
 
 static struct term_t term;
@@ -46,33 +47,62 @@ static inline u16 color(int fg, int bg) {
     : (fg % 8) * 8 + (bg % 8) + 1;
 }
 
-void f18a_exitmsg(char *fmt, ...) {
+static void vexitmsg(const char *fmt, va_list args) {
   f18a_killterm();
+  vfprintf(stderr, fmt, args);
+}
+
+void f18a_exitmsg(char *fmt, ...) {
   va_list args;
   va_start(args, fmt);
-  vfprintf(stderr, fmt, args);
+  vexitmsg(fmt, args);
   va_end(args);
 }
 
 int f18a_getstr(char *buf, int n) {
+  if (term.log) return 0;
   return wgetnstr(term.dbgwin, buf, n) == OK;
 }
 
+static void vmsg(const char *fmt, va_list args) {
+  if (term.log) {
+    vfprintf(term.log, fmt, args);
+  } else {
+    vwprintw(term.dbgwin, fmt, args);
+    wrefresh(term.dbgwin);
+  }
+}
+
 void f18a_msg(char *fmt, ...) {
   va_list args;
   va_start(args, fmt);
-  vwprintw(term.dbgwin, fmt, args);
-  wrefresh(term.dbgwin);
+  vmsg(fmt, args);
   va_end(args);
 }
 
+static void hostmsg(f18a_host *host, const char *fmt, va_list args) {
+  (void)host;
+  vmsg(fmt, args);
+}
+
+static void hosterr(f18a_host *host, const char *fmt, va_list args) {
+  (void)host;
+  vexitmsg(fmt, args);
+}
+
+// the host of every node the f18a program runs: messages go to the terminal
+// or the log, errors to stderr, and the signal handlers set its flags
+f18a_host f18a_termhost = {.msg = hostmsg, .error = hosterr};
+
 void f18a_runterm(void) {
+  if (term.log) return;
   curs_set(0);
   timeout(0);
   noecho();
 }
 
 void f18a_dbgterm(void) {
+  if (term.log) return;
   curs_set(1);
   timeout(-1);
   echo();
@@ -110,6 +140,13 @@ void f18a_initterm(void) {
       COLOR_PAIRS, can_change_color() ? "*can*" : "*cannot*");
 }
 
+void f18a_initlog(FILE *log) {
+  // messages are frequent and nobody is watching them live, so buffer fully.
+  term.log = log;
+  setvbuf(log, NULL, _IOFBF, BUFSIZ);
+}
+
 void f18a_killterm(void) {
-  endwin();
+  if (term.log) fflush(term.log);
+  else endwin();
 }
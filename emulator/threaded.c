@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2013, Matt Hellige
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above copyright 
+ *   notice, this list of conditions and the following disclaimer in the 
+ *   documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT 
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// a direct-threaded engine: each opcode handler fetches and dispatches the
+// next slot itself, so every handler gets its own indirect branch, and the
+// hot registers live in locals for the duration of a call. results must be
+// identical to f18a_step, which remains the reference (and what the debugger
+// uses for single-stepping).
+
+#include "f18a.h"
+#include "opcodes.h"
+
+// labels as values are the whole point here...
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+
+static const u32 dmasks[] = {0x3ff, 0xff, 0x7};
+
+
+action_t f18a_threaded(f18a *f, u64 *budget) {
+#define LABEL(op, _) &&L_##op,
+  static const void *handlers[] = {
+    FOR_EACH_OP(LABEL) &&L_OP_HALT, &&L_OP_TRAP, &&L_OP_PFETCH
+  };
+#undef LABEL
+
+  u32 t = f->t;
+  u32 s = f->s;
+  u32 p = f->p;
+  u8 slot = f->slot;
+  const decoded_t *d = &f->dcache[f->cw];
+  u64 n = *budget;
+  tstamp_t time = f->time;
+  u32 tmp;
+  action_t action = A_CONTINUE;
+
+#define PUSH(val) do { \
+    tmp = (val); \
+    f->sp = (f->sp + 1) % STACK_WORDS; \
+    f->stack[f->sp] = s; \
+    s = t; \
+    t = tmp; \
+  } while (0)
+#define POP() do { \
+    t = s; \
+    s = f->stack[f->sp]; \
+    f->sp = (f->sp + STACK_WORDS - 1) % STACK_WORDS; \
+  } while (0)
+#define POPS() do { \
+    s = f->stack[f->sp]; \
+    f->sp = (f->sp + STACK_WORDS - 1) % STACK_WORDS; \
+  } while (0)
+#define PUSHR(val) do { \
+    f->rsp = (f->rsp + 1) % RSTACK_WORDS; \
+    f->rstack[f->rsp] = f->r; \
+    f->r = (val); \
+  } while (0)
+#define POPR() do { \
+    f->r = f->rstack[f->rsp]; \
+    f->rsp = (f->rsp + RSTACK_WORDS - 1) % RSTACK_WORDS; \
+  } while (0)
+#define JUMP() do { \
+    p = (p & ~(dmasks[slot - 1] | 0x100)) | d->dest[slot - 1]; \
+    goto fetch; \
+  } while (0)
+#define DISPATCH() do { \
+    if (!n) goto out; \
+    n--; \
+    time += optimes[d->ops[slot]]; \
+    goto *handlers[d->ops[slot++]]; \
+  } while (0)
+#define NEXT() do { \
+    if (slot > 3) goto fetch; \
+    DISPATCH(); \
+  } while (0)
+// ram and rom are handled inline, everything else by f18a_read/f18a_write.
+// devices may need the time, as it was before the op.
+#define READ(addr) do { \
+    u32 a_ = (addr); \
+    if (a_ & 0x100) { \
+      f->time = time - optimes[d->ops[slot - 1]]; \
+      if (!f18a_read(f, a_, &tmp)) STOP(A_BLOCK); \
+    } else { \
+      tmp = (a_ & 0x80 ? f->rom : f->ram)[a_ & 0x3f]; \
+    } \
+  } while (0)
+#define WRITE(addr) do { \
+    u32 a_ = (addr); \
+    if (a_ & 0x180) { \
+      f->time = time - optimes[d->ops[slot - 1]]; \
+      if (!f18a_write(f, a_, t)) STOP(A_BLOCK); \
+    } else { \
+      f->ram[a_ & 0x3f] = t; \
+      f->dcache[a_ & 0x3f].valid = false; \
+      if (f->jitted & (1ull << (a_ & 0x3f))) f18a_jitflush(f); \
+    } \
+  } while (0)
+// at slot 0 of a micro-loop, run as many passes as possible at once
+#define BULK() do { \
+    f->t = t; \
+    f->s = s; \
+    f->p = p; \
+    f->time = time; \
+    n -= f18a_bulk(f, d, n); \
+    t = f->t; \
+    s = f->s; \
+    time = f->time; \
+  } while (0)
+// undo the dispatch: a step that raises an action isn't executed
+#define STOP(act) do { \
+    slot--; \
+    n++; \
+    time -= optimes[d->ops[slot]]; \
+    action = (act); \
+    goto out; \
+  } while (0)
+
+  if (slot > 3) goto fetch;
+  DISPATCH();
+
+fetch: {
+    u8 cw = CACHE_INDEX(p);
+    d = &f->dcache[cw];
+    if (d->valid) {
+      f->i = d->word;
+      p = f18a_inc(p);
+    } else {
+      f->p = p;
+      f18a_fill(f, cw);
+      p = f->p;
+    }
+    slot = 0;
+    time += T_FETCH;
+    if (d->loop && f->r) BULK();
+    DISPATCH();
+  }
+
+L_OP_RET: p = f->r & MAX_P; POPR(); goto fetch;
+L_OP_EXEC: tmp = f->r; f->r = p; p = tmp & MAX_P; goto fetch;
+L_OP_JUMP: JUMP();
+L_OP_CALL: PUSHR(p); JUMP();
+L_OP_UNXT:
+  if (f->r) {
+    f->r--;
+    slot = 0;
+    if (d->loop) BULK();
+  } else {
+    POPR();
+  }
+  NEXT();
+L_OP_NEXT: if (f->r) { f->r--; JUMP(); } POPR(); goto fetch;
+L_OP_IF: if (t) goto fetch; JUMP();
+L_OP_IFG: if (t & 0x20000) goto fetch; JUMP();
+L_OP_LVPI: READ(p); PUSH(tmp); p = f18a_inc(p); NEXT();
+L_OP_LVAI: READ(f->a); PUSH(tmp); f->a = f18a_inc(f->a); NEXT();
+L_OP_LVB: READ(f->b); PUSH(tmp); NEXT();
+L_OP_LVA: READ(f->a); PUSH(tmp); NEXT();
+L_OP_SVPI: WRITE(p); POP(); p = f18a_inc(p); NEXT();
+L_OP_SVAI: WRITE(f->a); POP(); f->a = f18a_inc(f->a); NEXT();
+L_OP_SVB: WRITE(f->b); POP(); NEXT();
+L_OP_SVA: WRITE(f->a); POP(); NEXT();
+L_OP_MULS: f18a_muls(&t, s, &f->a, p & P9 ? &f->carry : NULL); NEXT();
+L_OP_SHL: t <<= 1; NEXT();
+// implementation-defined, correct on gcc/x86
+L_OP_SHR: t = ((int32_t)t) >> 1; NEXT();
+L_OP_INV: t = ~t; NEXT();
+L_OP_ADD:
+  if (p & P9) t = f18a_addc(t, s, &f->carry);
+  else t += s;
+  POPS();
+  NEXT();
+L_OP_AND: t &= s; POPS(); NEXT();
+L_OP_OR: t ^= s; POPS(); NEXT();
+L_OP_DROP: POP(); NEXT();
+L_OP_DUP: PUSH(t); NEXT();
+L_OP_POP: tmp = f->r; POPR(); PUSH(tmp); NEXT();
+L_OP_OVER: PUSH(s); NEXT();
+L_OP_A: PUSH(f->a); NEXT();
+L_OP_NOP: NEXT();
+L_OP_PUSH: PUSHR(t); POP(); NEXT();
+L_OP_SB: f->b = t & MAX_B; POP(); NEXT();
+L_OP_SA: f->a = t; POP(); NEXT();
+L_OP_HALT: STOP(A_HALT);
+// a breakpoint or watchpoint, or a fetch from a port: leave the step to
+// f18a_step, which knows them
+L_OP_TRAP:
+L_OP_PFETCH:
+  f->t = t;
+  f->s = s;
+  f->p = p;
+  f->slot = --slot;
+  f->cw = d - f->dcache;
+  f->time = time;
+  action = f18a_step(f);
+  t = f->t;
+  s = f->s;
+  p = f->p;
+  slot = f->slot;
+  d = &f->dcache[f->cw];
+  time = f->time;
+  if (action != A_CONTINUE) {
+    n++;
+    goto out;
+  }
+  NEXT();
+
+out:
+  f->t = t;
+  f->s = s;
+  f->p = p;
+  f->slot = slot;
+  f->cw = d - f->dcache;
+  f->time = time;
+  *budget = n;
+  return action;
+
+#undef PUSH
+#undef POP
+#undef POPS
+#undef PUSHR
+#undef POPR
+#undef JUMP
+#undef DISPATCH
+#undef NEXT
+#undef READ
+#undef WRITE
+#undef BULK
+#undef STOP
+}
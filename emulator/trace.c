@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2013, Matt Hellige
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above copyright 
+ *   notice, this list of conditions and the following disclaimer in the 
+ *   documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT 
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// a binary trace of every step, for runs far too long to step through in the
+// debugger. like the profiler, f18a_traced is an engine of its own, running on
+// f18a_step, so the other engines pay nothing for it. each step leaves a
+// fixed-size trace_t in a ring buffer, and a writer thread takes the records
+// a block at a time, delta-encodes them and appends them to the trace file.
+// the ring has just one producer and one consumer, which share nothing but
+// its head and tail, so neither ever takes a lock; the engine only waits if
+// the writer falls a whole ring behind.
+//
+// see f18a.h for the file format, and tracetool.c for a decoder.
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "f18a.h"
+#include "opcodes.h"
+
+#define RING (1 << 20) // records, so 16M
+#define BLOCK (1 << 16) // records per block, at most
+#define PUBLISH 1024 // records between updates of the head
+#define MAX_BYTES 20 // encoded, for any one record
+
+
+typedef struct tracer_t {
+  trace_t ring[RING];
+  // head is written only by the engine, tail only by the writer
+  u64 head __attribute__ ((aligned (64)));
+  u64 tail __attribute__ ((aligned (64)));
+  bool stop;
+  u16 at; // address of the word being run
+  bool started;
+  bool failed; // the writer couldn't write, but still drains the ring
+  FILE *out;
+  const char *path;
+  u64 blocks;
+  pthread_t writer;
+  u8 buf[BLOCK * MAX_BYTES];
+} tracer_t;
+
+
+static void nap(void) {
+  struct timespec ts = {0, 100000};
+  nanosleep(&ts, NULL);
+}
+
+
+static u8 *varint(u8 *out, u32 val) {
+  while (val >= 0x80) {
+    *out++ = val | 0x80;
+    val >>= 7;
+  }
+  *out++ = val;
+  return out;
+}
+
+
+static u32 zigzag(u32 diff) {
+  return (diff << 1) ^ -(diff >> 31);
+}
+
+
+// encode count records from the tail of the ring into buf, returning the
+// number of bytes
+static u32 encode(tracer_t *tr, u32 count) {
+  trace_t prev = {0};
+  u8 *out = tr->buf;
+  for (u32 i = 0; i < count; i++) {
+    const trace_t *rec = &tr->ring[(tr->tail + i) % RING];
+    u8 flags = (rec->p != prev.p ? TR_P : 0) | (rec->t != prev.t ? TR_T : 0)
+      | (rec->s != prev.s ? TR_S : 0) | (rec->addr != TRACE_NONE ? TR_ADDR : 0);
+    *out++ = rec->op | rec->slot << 5;
+    *out++ = flags;
+    if (flags & TR_P) out = varint(out, zigzag((u32)rec->p - prev.p));
+    if (flags & TR_T) out = varint(out, zigzag(rec->t - prev.t));
+    if (flags & TR_S) out = varint(out, zigzag(rec->s - prev.s));
+    if (flags & TR_ADDR) out = varint(out, rec->addr);
+    prev = *rec;
+  }
+  return out - tr->buf;
+}
+
+
+static void *writer(void *arg) {
+  tracer_t *tr = arg;
+  for (;;) {
+    // stop first: once it's set, the head is final
+    bool stop = __atomic_load_n(&tr->stop, __ATOMIC_ACQUIRE);
+    u64 avail = __atomic_load_n(&tr->head, __ATOMIC_ACQUIRE) - tr->tail;
+    if (avail < BLOCK && !(stop && avail)) {
+      if (stop) return NULL;
+      nap();
+      continue;
+    }
+    u32 count = avail < BLOCK ? avail : BLOCK;
+    traceblock_t block = {tr->tail, count, encode(tr, count)};
+    if (!tr->failed && (fwrite(&block, sizeof(block), 1, tr->out) != 1
+          || fwrite(tr->buf, 1, block.bytes, tr->out) != block.bytes))
+      tr->failed = true;
+    tr->blocks++;
+    __atomic_store_n(&tr->tail, tr->tail + count, __ATOMIC_RELEASE);
+  }
+}
+
+
+bool f18a_traceopen(f18a *f, const char *path) {
+  FILE *out = fopen(path, "w");
+  if (!out) {
+    f18a_hosterr(f->host, "error opening '%s': %s\n", path, strerror(errno));
+    return false;
+  }
+  traceheader_t header = {.magic = TRACE_MAGIC, .version = TRACE_VERSION};
+  tracer_t *tr = calloc(1, sizeof(tracer_t));
+  if (!tr || fwrite(&header, sizeof(header), 1, out) != 1) {
+    f18a_hosterr(f->host, "unable to start a trace in '%s'\n", path);
+    free(tr);
+    fclose(out);
+    return false;
+  }
+  tr->out = out;
+  tr->path = path;
+  if (pthread_create(&tr->writer, NULL, writer, tr)) {
+    f18a_hosterr(f->host, "unable to start the trace writer\n");
+    free(tr);
+    fclose(out);
+    return false;
+  }
+  f->tracer = tr;
+  return true;
+}
+
+
+// drain the ring, then fill in the header
+bool f18a_traceclose(f18a *f) {
+  tracer_t *tr = f->tracer;
+  if (!tr) return true;
+  __atomic_store_n(&tr->stop, true, __ATOMIC_RELEASE);
+  pthread_join(tr->writer, NULL);
+  traceheader_t header = {.magic = TRACE_MAGIC, .version = TRACE_VERSION,
+    .records = tr->head, .blocks = tr->blocks};
+  bool ok = !tr->failed && !fseek(tr->out, 0, SEEK_SET)
+    && fwrite(&header, sizeof(header), 1, tr->out) == 1;
+  ok = !fclose(tr->out) && ok;
+  if (!ok) f18a_hosterr(f->host, "error writing trace '%s'\n", tr->path);
+  free(tr);
+  f->tracer = NULL;
+  return ok;
+}
+
+
+// the address of the word just fetched, given p after the fetch
+static u16 fetched(u32 p) {
+  if (p & 0x100) return p & ADDR_MASK;
+  return ((p & ~0x7f) | ((p - 1) & 0x7f)) & ADDR_MASK;
+}
+
+
+// what op will read or write, if anything
+static u16 target(const f18a *f, u8 op) {
+  switch (op) {
+    case OP_LVPI: case OP_SVPI: return f->p & ADDR_MASK;
+    case OP_LVAI: case OP_SVAI: case OP_LVA: case OP_SVA:
+      return f->a & ADDR_MASK;
+    case OP_LVB: case OP_SVB: return f->b;
+    default: return TRACE_NONE;
+  }
+}
+
+
+action_t f18a_traced(f18a *f, u64 *budget) {
+  tracer_t *tr = f->tracer;
+  if (!tr) return f18a_stepn(f, budget);
+  u64 n = *budget;
+  u64 none = 0;
+  action_t action = A_CONTINUE;
+  f18a_stepn(f, &none); // just to fetch
+  // resuming a snapshot, the word might have moved p, but this is the best
+  // there is
+  if (!tr->started) tr->at = fetched(f->p);
+  tr->started = true;
+  u64 head = tr->head;
+  u64 room = RING - (head - __atomic_load_n(&tr->tail, __ATOMIC_ACQUIRE));
+  for (; n; n--) {
+    while (!room) {
+      __atomic_store_n(&tr->head, head, __ATOMIC_RELEASE);
+      nap();
+      room = RING - (head - __atomic_load_n(&tr->tail, __ATOMIC_ACQUIRE));
+    }
+    u8 op = f->dcache[f->cw].ops[f->slot];
+    if (op == OP_TRAP) op = f18a_untrap(f, f->cw, f->slot);
+    if (op == OP_PFETCH) {
+      // not an op: the word from the port is traced as it runs
+      action = f18a_step(f);
+      if (action != A_CONTINUE) break;
+      continue;
+    }
+    bool again = op == OP_UNXT && f->r; // loops without a fetch
+    trace_t *rec = &tr->ring[head % RING];
+    *rec = (trace_t){tr->at, f->slot, op, f->t, f->s, target(f, op), 0};
+    action = f18a_step(f);
+    if (action != A_CONTINUE) break;
+    if (f->slot == 0 && !again) tr->at = fetched(f->p);
+    room--;
+    if (++head % PUBLISH == 0)
+      __atomic_store_n(&tr->head, head, __ATOMIC_RELEASE);
+  }
+  __atomic_store_n(&tr->head, head, __ATOMIC_RELEASE);
+  *budget = n;
+  return action;
+}
@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2013, Matt Hellige
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above copyright 
+ *   notice, this list of conditions and the following disclaimer in the 
+ *   documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT 
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY 
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// f18a-trace: prints a binary trace, as written by f18a --trace, one step per
+// line. the file is mapped rather than read, and blocks before --first are
+// skipped by their headers alone, so looking at the end of a long trace is
+// cheap.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "f18a.h"
+#include "opcodes.h"
+
+typedef struct {
+  u32 plo, phi; // word addresses to print
+  u32 mlo, mhi; // memory addresses, if any is to be required
+  bool mem;
+  bool ops[OP_COUNT];
+  bool someops; // else all ops
+  u64 first;
+  u64 count;
+} filter_t;
+
+static void usage(char **argv) {
+  fprintf(stderr, "usage: %s [options] <trace>\n", argv[0]);
+  fprintf(stderr, "   -h, --help           display this message\n");
+  fprintf(stderr, "   -a, --addr <lo[-hi]> only steps in words at addresses "
+      "lo to hi (hex)\n");
+  fprintf(stderr, "   -m, --mem <lo[-hi]>  only steps that read or write "
+      "addresses lo to hi (hex)\n");
+  fprintf(stderr, "   -o, --op <op,...>    only these opcodes, e.g. "
+      "@p,!+,unext\n");
+  fprintf(stderr, "   -f, --first <n>      start at step n\n");
+  fprintf(stderr, "   -n, --count <n>      print at most n steps\n");
+}
+
+static bool range(const char *arg, u32 *lo, u32 *hi) {
+  char *endptr;
+  *lo = *hi = strtoul(arg, &endptr, 16);
+  if (*endptr == '-') *hi = strtoul(endptr + 1, &endptr, 16);
+  return endptr != arg && !*endptr && *lo <= *hi;
+}
+
+static bool ops(char *arg, filter_t *filter) {
+  filter->someops = true;
+  for (char *name = strtok(arg, ","); name; name = strtok(NULL, ",")) {
+    int op = 0;
+    while (op < OP_COUNT && strcmp(opnames[op], name)) op++;
+    if (op == OP_COUNT) {
+      fprintf(stderr, "unknown opcode: %s\n", name);
+      return false;
+    }
+    filter->ops[op] = true;
+  }
+  return true;
+}
+
+static const u8 *varint(const u8 *in, const u8 *end, u32 *val) {
+  *val = 0;
+  for (int shift = 0; in < end && shift < 35; shift += 7) {
+    *val |= (u32)(*in & 0x7f) << shift;
+    if (!(*in++ & 0x80)) return in;
+  }
+  return NULL;
+}
+
+static u32 unzigzag(u32 val) {
+  return (val >> 1) ^ -(val & 1);
+}
+
+static bool wanted(const trace_t *rec, const filter_t *filter) {
+  if (rec->p < filter->plo || rec->p > filter->phi) return false;
+  if (filter->mem && (rec->addr == TRACE_NONE || rec->addr < filter->mlo
+        || rec->addr > filter->mhi)) return false;
+  return !filter->someops || filter->ops[rec->op];
+}
+
+// print the wanted records of one block, returning false once enough have
+// been, or if the block is corrupt
+static bool block(const traceblock_t *block, const u8 *in, filter_t *filter) {
+  const u8 *end = in + block->bytes;
+  trace_t rec = {0};
+  for (u32 i = 0; i < block->count; i++) {
+    if (end - in < 2) return false;
+    rec.op = *in & 0x1f;
+    rec.slot = *in++ >> 5 & 3;
+    u8 flags = *in++;
+    u32 val;
+    if (flags & TR_P) {
+      if (!(in = varint(in, end, &val))) return false;
+      rec.p += unzigzag(val);
+    }
+    if (flags & TR_T) {
+      if (!(in = varint(in, end, &val))) return false;
+      rec.t += unzigzag(val);
+    }
+    if (flags & TR_S) {
+      if (!(in = varint(in, end, &val))) return false;
+      rec.s += unzigzag(val);
+    }
+    rec.addr = TRACE_NONE;
+    if (flags & TR_ADDR) {
+      if (!(in = varint(in, end, &val))) return false;
+      rec.addr = val;
+    }
+    u64 step = block->first + i;
+    if (step < filter->first || !wanted(&rec, filter)) continue;
+    if (!filter->count--) return false;
+    printf("%12llu %03x %d %-5s %05x %05x", (unsigned long long)step, rec.p,
+        rec.slot, opnames[rec.op], rec.t, rec.s);
+    if (rec.addr != TRACE_NONE) printf(" @%03x", rec.addr);
+    printf("\n");
+  }
+  return true;
+}
+
+static int decode(const char *path, filter_t *filter) {
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st)) {
+    fprintf(stderr, "error opening '%s': %s\n", path, strerror(errno));
+    return 1;
+  }
+  size_t size = st.st_size;
+  const traceheader_t *header = NULL;
+  if (size >= sizeof(*header))
+    header = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (header == MAP_FAILED || !header || header->magic != TRACE_MAGIC
+      || header->version != TRACE_VERSION) {
+    fprintf(stderr, "'%s' is not a trace\n", path);
+    return 1;
+  }
+  // the header is only filled in at the end, so a trace cut short by a crash
+  // is read for as many whole blocks as it has
+  if (!header->records)
+    fprintf(stderr, "warning: '%s' was never closed\n", path);
+  printf("        step p   s op    t     s\n");
+  const u8 *base = (const u8 *)header;
+  size_t off = sizeof(*header);
+  while (size - off >= sizeof(traceblock_t)) {
+    const traceblock_t *b = (const traceblock_t *)(base + off);
+    off += sizeof(*b);
+    if (size - off < b->bytes) break;
+    if (b->first + b->count > filter->first
+        && !block(b, base + off, filter)) break;
+    off += b->bytes;
+  }
+  munmap((void *)header, size);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  static filter_t filter = {.phi = ADDR_MASK, .count = UINT64_MAX};
+  char *endptr;
+
+  for (;;) {
+    static struct option long_options[] = {
+      {"help", 0, 0, 'h'},
+      {"addr", 1, 0, 'a'},
+      {"mem", 1, 0, 'm'},
+      {"op", 1, 0, 'o'},
+      {"first", 1, 0, 'f'},
+      {"count", 1, 0, 'n'},
+      {0, 0, 0, 0},
+    };
+
+    int c = getopt_long(argc, argv, "ha:m:o:f:n:", long_options, NULL);
+    if (c == -1) break;
+
+    switch (c) {
+      case 'h':
+        usage(argv);
+        return 0;
+      case 'a':
+        if (!range(optarg, &filter.plo, &filter.phi)) {
+          fprintf(stderr, "argument to --addr must be a hex address or "
+              "range\n");
+          return 1;
+        }
+        break;
+      case 'm':
+        filter.mem = true;
+        if (!range(optarg, &filter.mlo, &filter.mhi)) {
+          fprintf(stderr, "argument to --mem must be a hex address or range\n");
+          return 1;
+        }
+        break;
+      case 'o':
+        if (!ops(optarg, &filter)) return 1;
+        break;
+      case 'f':
+        filter.first = strtoull(optarg, &endptr, 10);
+        if (*endptr) {
+          fprintf(stderr, "argument to --first must be a decimal number\n");
+          return 1;
+        }
+        break;
+      case 'n':
+        filter.count = strtoull(optarg, &endptr, 10);
+        if (*endptr) {
+          fprintf(stderr, "argument to --count must be a decimal number\n");
+          return 1;
+        }
+        break;
+      default:
+        usage(argv);
+        return 1;
+    }
+  }
+
+  if (argc - optind != 1) {
+    usage(argv);
+    return 1;
+  }
+  return decode(argv[optind], &filter);
+}